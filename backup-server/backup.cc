@@ -8,6 +8,12 @@
 #include "server_parsing.h"
 #include "server_storage.h"
 #include "pool.h"
+#include "file.h"
+#include "log.h"
+#include "metrics.h"
+
+#include <chrono>
+#include <thread>
 
 using namespace std;
 
@@ -19,6 +25,14 @@ void usage() {
     cout << "  -p [int]    Port number of the server" << endl;
     cout << "  -C [string]  Recovery API Command" << endl;
     cout << "                   ROR (request log)" << endl;
+    cout << "  -f [string] Snapshot file name" << endl;
+    cout << "  -S [int]    Seconds between snapshots (requires -f)" << endl;
+    cout << "  -t [int]    Number of threads in the pool" << endl;
+    cout << "  -q [int]    Connections that may wait for a thread, beyond which they get BUSY (0 = no limit)" << endl;
+    cout << "  -M [int]    Seconds between printing queue metrics" << endl;
+    cout << "  -a [int]    Serve Prometheus metrics over HTTP on this port" << endl;
+    cout << "  -T [int]    Seconds a client may keep a worker waiting for a request (default 60, 0 = forever)" << endl;
+    cout << "  -W [int]    Seconds a client may keep a worker waiting to send a response (default 10, 0 = forever)" << endl;
     cout << "  -h          Print help (this message)" << endl;
 }
 
@@ -32,18 +46,55 @@ void usage() {
  */
 void parseargs(int argc, char** argv, config_t& config) {
     long opt;
-    while ((opt = getopt(argc, argv, "s:p:f:t:C:h")) != -1) {
+    while ((opt = getopt(argc, argv, "s:p:f:t:C:S:q:M:a:T:W:h")) != -1) {
         switch (opt) {
             case 's': config.server_name = std::string(optarg); break;
             case 'p': config.port = atoi(optarg); break;  
             case 'f': config.datafile = std::string(optarg); break;
             case 't': config.threads = atoi(optarg); break;  
             case 'C': config.command = std::string(optarg); break;  
+            case 'S': config.snapshot_interval = atoi(optarg); break;
+            case 'q': config.queue_depth = atoi(optarg); break;
+            case 'M': config.stats_interval = atoi(optarg); break;
+            case 'a': config.admin_port = atoi(optarg); break;
+            case 'T': config.idle_timeout = max(0, atoi(optarg)); break;
+            case 'W': config.io_timeout = max(0, atoi(optarg)); break;
             case 'h': usage(); break;
         }
     }
 }
 
+/**
+ * Build the page the admin listener serves: what the workers have counted,
+ * the keys held, and how the pool's queue is coping
+ *
+ * @param storage The Storage object the server serves
+ * @param pool    The pool of workers
+ */
+string render_metrics(Storage &storage, thread_pool &pool) {
+    MetricsText out;
+    serve_metrics(out);
+    out.family("kv_keys", "gauge", "Keys stored");
+    out.sample("kv_keys", storage.key_count());
+
+    auto st = pool.stats();
+    out.family("kv_pool_queue_depth", "gauge", "Connections waiting for a worker");
+    out.sample("kv_pool_queue_depth", st.depth);
+    out.family("kv_pool_queue_max_depth", "gauge",
+               "The most connections that have waited for a worker at once, since the server started");
+    out.sample("kv_pool_queue_max_depth", st.max_depth);
+    out.family("kv_pool_admitted_total", "counter", "Connections queued for a worker");
+    out.sample("kv_pool_admitted_total", st.admitted);
+    out.family("kv_pool_shed_total", "counter", "Connections turned away because the queue was full");
+    out.sample("kv_pool_shed_total", st.shed);
+    out.family("kv_pool_wait_seconds", "summary", "Time connections waited for a worker");
+    out.sample("kv_pool_wait_seconds_sum", st.total_wait_us / 1e6);
+    out.sample("kv_pool_wait_seconds_count", st.started);
+    out.family("kv_pool_wait_max_seconds", "gauge", "The longest a connection has waited for a worker, since the server started");
+    out.sample("kv_pool_wait_max_seconds", st.max_wait_us / 1e6);
+    return out.str();
+}
+
 int main(int argc, char **argv) {
     /** Parse command-line arguments */
     config_t args;
@@ -66,11 +117,49 @@ int main(int argc, char **argv) {
     if (args.command == "ROR") {
         storage.do_request();
     }
+    /** Otherwise start from the last snapshot, if there is one */
+    else if (!args.datafile.empty() && file_exists(args.datafile)) {
+        storage.load(load_entire_file(args.datafile));
+    }
+
+    /** Periodically write a snapshot in the background, while workers keep serving */
+    if (args.snapshot_interval > 0 && !args.datafile.empty()) {
+        thread([&storage, &args]() {
+            while (true) {
+                this_thread::sleep_for(chrono::seconds(args.snapshot_interval));
+                storage.snapshot();
+            }
+        }).detach();
+    }
 
-    /** Thread pool */
+    /** Thread pool, with a bounded queue of connections waiting for a thread */
     thread_pool pool(args.threads, [&](int sd) { 
+        /** A client that stalls is dropped instead of holding its worker */
+        set_socket_timeouts(sd, args.idle_timeout, args.io_timeout);
         return serve_client(sd, storage); 
-    });
+    }, args.queue_depth);
+
+    /** Periodically report how the queue is coping, over the last interval */
+    if (args.stats_interval > 0) {
+        thread([&pool, &args]() {
+            auto last = pool.stats();
+            while (true) {
+                this_thread::sleep_for(chrono::seconds(args.stats_interval));
+                auto st = pool.stats();
+                uint64_t started = st.started - last.started;
+                uint64_t avg_wait_us = started ? (st.total_wait_us - last.total_wait_us) / started : 0;
+                LOG_INFO << "queue: depth " << st.depth << " (max ever " << st.max_depth << "), admitted "
+                         << st.admitted - last.admitted << ", shed " << st.shed - last.shed << ", wait avg "
+                         << avg_wait_us << "us (max ever " << st.max_wait_us << "us)";
+                last = st;
+            }
+        }).detach();
+    }
+
+    /** Metrics for a scraper, answered by a thread of their own */
+    if (args.admin_port > 0) {
+        metrics_serve(create_server_socket(args.admin_port), [&]() { return render_metrics(storage, pool); });
+    }
 
     /** Start accepting connections and passing them to the pool */
     accept_client(sd, pool);
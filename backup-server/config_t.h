@@ -29,8 +29,24 @@ struct config_t {
     /** Thread count */
     int threads = 2;
 
+    /** Connections that may wait for a thread before new ones are turned away (0 = no limit) */
+    size_t queue_depth = 1024;
+
+    /** Seconds between printing the pool's queue metrics (0 = never) */
+    int stats_interval = 0;
+
+    /** Serve Prometheus metrics on this port (0 = not at all) */
+    size_t admin_port = 0;
+
+    /** Seconds a client may leave a worker waiting to read, or to write (0 = forever) */
+    int idle_timeout = 60;
+    int io_timeout = 10;
+
     /** API command */
     std::string command = "";
+
+    /** Seconds between snapshots of the lazy list to the datafile (0 = never) */
+    int snapshot_interval = 0;
 };
 
 #endif
\ No newline at end of file
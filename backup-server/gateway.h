@@ -4,6 +4,7 @@
  *
  */
 #include "net.h"
+#include "log.h"
 
 using namespace std;
 
@@ -19,10 +20,10 @@ public:
 
 /** send the message to primary server */
     vec communicate(const vec &req) {
-        cout << "test gateway!" << endl;
-        cout << "size: " << req.size() << endl;
+        LOG_DEBUG << "test gateway!";
+        LOG_DEBUG << "size: " << req.size();
         for (unsigned int i=0; i < req.size(); i++) {
-            cout << "req[i]:: " << req.at(i) << endl;
+            LOG_DEBUG << "req[i]:: " << req.at(i);
         }
         sd = connect_to_server(bname, bport);
         send_reliably(sd, req);
@@ -44,7 +45,7 @@ public:
     }
 
     vec send_message(const string &cmd, const int &key) {
-        std::cout << "send_message(PVD?)" << cmd << std::endl;
+        LOG_DEBUG << "send_message(PVD?)" << cmd;
         vec req;
         /* set up key */
         string k = to_string(key);
@@ -59,13 +60,13 @@ public:
         vec_append(req, msg);
 
         /* send via socket */
-        cout << "comm!" << endl;
+        LOG_DEBUG << "comm!";
         vec res = communicate(req);
         return res;
     }
 
     vec send_message(const string &cmd, const int &key, const int &val) {
-        std::cout << "send_message(PVI?)" << cmd << std::endl;
+        LOG_DEBUG << "send_message(PVI?)" << cmd;
         vec req;
         /* set up key and value */
         string k = to_string(key);
@@ -80,7 +81,7 @@ public:
         vec_append(req, msg);
 
         /* send via socket */
-        cout << "comm!!!!" << endl;
+        LOG_DEBUG << "comm!!!!";
         vec res = communicate(req);
         return res;
     }
@@ -0,0 +1,247 @@
+/**
+ * @file log.cc
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "log.h"
+
+using namespace std;
+
+/** Records each thread's ring holds */
+static const size_t LOG_RING_RECORDS = 512;
+
+/** How often the background thread looks for records, in milliseconds */
+static const int LOG_DRAIN_MS = 5;
+
+/** One record, as it waits in a ring */
+struct log_record_t {
+    uint64_t time_ns;
+    uint8_t level;
+    uint16_t len;
+    char text[LogLine::MAX_TEXT];
+};
+
+/**
+ * A ring of records from one thread to the background thread.  The thread
+ * only moves tail, and the background thread only moves head, so neither
+ * needs a lock.
+ */
+struct log_ring_t {
+    alignas(64) atomic<size_t> head{0};
+    alignas(64) atomic<size_t> tail{0};
+
+    /** Records dropped because the ring was full, counted by the thread */
+    atomic<uint64_t> dropped{0};
+
+    /** Drops already reported, counted by the background thread */
+    uint64_t reported = 0;
+
+    log_record_t records[LOG_RING_RECORDS];
+};
+
+/**
+ * Every ring, those whose threads have exited (which the next new thread
+ * takes over), and the background thread that drains them
+ */
+struct log_registry_t {
+    mutex lock;
+    vector<unique_ptr<log_ring_t>> all;
+    vector<log_ring_t *> unowned;
+
+    /** Wakes the background thread early, and tells log_flush() a pass is done */
+    condition_variable wake;
+    condition_variable drained;
+    uint64_t passes = 0;
+    bool stopping = false;
+    bool started = false;
+    thread drainer;
+};
+
+/** The registry, which is never destroyed, since detached threads may still log while the program exits */
+static log_registry_t &registry() {
+    static log_registry_t *r = new log_registry_t();
+    return *r;
+}
+
+/**
+ * Write out the records of every ring, oldest first.  Records are sorted
+ * within a pass only: one logged just as a pass starts may go out in the next
+ * pass, after a later one.  Warnings and errors go to stderr, the rest to
+ * stdout, and each switch of stream flushes the one before, so the two
+ * interleave in order when both go to one file.
+ */
+static void drain_once(log_registry_t &r) {
+    vector<log_ring_t *> rings;
+    {
+        lock_guard<mutex> guard(r.lock);
+        for (auto &ring : r.all) rings.push_back(ring.get());
+    }
+    static vector<log_record_t *> batch;
+    static vector<size_t> ends;
+    batch.clear();
+    ends.clear();
+    char line[LogLine::MAX_TEXT + 64];
+    for (log_ring_t *ring : rings) {
+        uint64_t dropped = ring->dropped.load(memory_order_relaxed);
+        if (dropped != ring->reported) {
+            int n = snprintf(line, sizeof(line), "log: dropped %llu records\n",
+                             (unsigned long long)(dropped - ring->reported));
+            fwrite(line, 1, n, stderr);
+            ring->reported = dropped;
+        }
+        size_t head = ring->head.load(memory_order_relaxed);
+        size_t tail = ring->tail.load(memory_order_acquire);
+        for (size_t i = head; i < tail; i++) batch.push_back(&ring->records[i % LOG_RING_RECORDS]);
+        ends.push_back(tail);
+    }
+    stable_sort(batch.begin(), batch.end(),
+                [](const log_record_t *a, const log_record_t *b) { return a->time_ns < b->time_ns; });
+
+    static const char LEVELS[] = "DIWE";
+    FILE *last = nullptr;
+    for (log_record_t *rec : batch) {
+        time_t secs = rec->time_ns / 1000000000;
+        tm t;
+        localtime_r(&secs, &t);
+        int n = snprintf(line, sizeof(line), "%02d:%02d:%02d.%06d %c ", t.tm_hour, t.tm_min, t.tm_sec,
+                         (int)(rec->time_ns % 1000000000 / 1000), LEVELS[rec->level]);
+        memcpy(line + n, rec->text, rec->len);
+        n += rec->len;
+        line[n++] = '\n';
+        FILE *out = rec->level >= LVL_WARN ? stderr : stdout;
+        if (last && out != last) fflush(last);
+        fwrite(line, 1, n, out);
+        last = out;
+    }
+    if (!batch.empty()) {
+        fflush(stdout);
+        fflush(stderr);
+    }
+    /* only now may the threads reuse the slots */
+    for (size_t i = 0; i < rings.size(); i++) rings[i]->head.store(ends[i], memory_order_release);
+}
+
+/** The background thread: drain the rings until the program exits */
+static void drain_loop(log_registry_t &r) {
+    unique_lock<mutex> guard(r.lock);
+    while (true) {
+        bool stop = r.stopping;
+        guard.unlock();
+        drain_once(r);
+        guard.lock();
+        r.passes++;
+        r.drained.notify_all();
+        if (stop) return;
+        r.wake.wait_for(guard, chrono::milliseconds(LOG_DRAIN_MS));
+    }
+}
+
+/** Drain what is left, and stop the background thread */
+static void stop_drainer() {
+    log_registry_t &r = registry();
+    {
+        lock_guard<mutex> guard(r.lock);
+        r.stopping = true;
+    }
+    r.wake.notify_one();
+    if (r.drainer.joinable() && r.drainer.get_id() != this_thread::get_id()) r.drainer.join();
+}
+
+/** A thread's claim on a ring, which it gives up when it exits */
+struct log_claim_t {
+    log_ring_t *mine = nullptr;
+
+    ~log_claim_t() {
+        if (mine) {
+            lock_guard<mutex> guard(registry().lock);
+            registry().unowned.push_back(mine);
+        }
+    }
+
+    /** The calling thread's ring, claimed on first use.  The first claim starts the background thread. */
+    log_ring_t &get() {
+        if (mine == nullptr) {
+            log_registry_t &r = registry();
+            lock_guard<mutex> guard(r.lock);
+            if (!r.unowned.empty()) {
+                mine = r.unowned.back();
+                r.unowned.pop_back();
+            } else {
+                r.all.emplace_back(new log_ring_t());
+                mine = r.all.back().get();
+            }
+            if (!r.started) {
+                r.started = true;
+                r.drainer = thread(drain_loop, ref(r));
+                atexit(stop_drainer);
+            }
+        }
+        return *mine;
+    }
+};
+
+static thread_local log_claim_t claim;
+
+/** Hand the record to the background thread */
+LogLine::~LogLine() {
+    log_ring_t &ring = claim.get();
+    size_t tail = ring.tail.load(memory_order_relaxed);
+    if (tail - ring.head.load(memory_order_acquire) >= LOG_RING_RECORDS) {
+        ring.dropped.store(ring.dropped.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        registry().wake.notify_one();
+        return;
+    }
+    log_record_t &rec = ring.records[tail % LOG_RING_RECORDS];
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec.time_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    rec.level = level;
+    rec.len = len;
+    memcpy(rec.text, text, len);
+    ring.tail.store(tail + 1, memory_order_release);
+    /* errors go out right away, and a filling ring should not wait for the next pass */
+    if (level >= LVL_ERROR || tail + 1 - ring.head.load(memory_order_relaxed) == LOG_RING_RECORDS / 2)
+        registry().wake.notify_one();
+}
+
+LogLine &LogLine::operator<<(double d) {
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%g", d);
+    return append(buf, n);
+}
+
+LogLine &LogLine::put_signed(long long v) {
+    char buf[24];
+    auto res = to_chars(buf, buf + sizeof(buf), v);
+    return append(buf, res.ptr - buf);
+}
+
+LogLine &LogLine::put_unsigned(unsigned long long v) {
+    char buf[24];
+    auto res = to_chars(buf, buf + sizeof(buf), v);
+    return append(buf, res.ptr - buf);
+}
+
+/**
+ * @brief Write out every record that has been logged so far, and wait until
+ * it has been written.  This also happens on exit().
+ */
+void log_flush() {
+    log_registry_t &r = registry();
+    unique_lock<mutex> guard(r.lock);
+    if (!r.started || r.stopping) return;
+    /* a pass that is already running may have missed the newest records, so wait for the one after */
+    uint64_t want = r.passes + 2;
+    r.wake.notify_one();
+    r.drained.wait(guard, [&]() { return r.passes >= want || r.stopping; });
+}
@@ -0,0 +1,101 @@
+/**
+ * @file log.h
+ */
+
+#ifndef LOG_DEF
+#define LOG_DEF
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+/** How much a log record matters */
+enum log_level_t { LVL_DEBUG = 0, LVL_INFO = 1, LVL_WARN = 2, LVL_ERROR = 3 };
+
+/**
+ * Records below this level are compiled out, arguments and all.  Debug
+ * records are out unless the server is built with 'make LOG_LEVEL=0'.
+ */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LVL_INFO
+#endif
+
+/**
+ * @brief LogLine builds one log record, in a fixed-size buffer, from the
+ * values streamed into it.  When it is destroyed, at the end of the
+ * statement, the record goes into the calling thread's ring, from which a
+ * background thread writes it out.  Nothing is flushed on the caller's
+ * thread and no lock is taken, so logging costs a request little more than
+ * formatting the record.  If the ring is full the record is dropped, and the
+ * drops are reported once there is room.
+ *
+ * Use it through LOG_DEBUG, LOG_INFO, LOG_WARN and LOG_ERROR, as in
+ * LOG_INFO << "Dropping " << n << " bytes";
+ */
+class LogLine {
+public:
+  /** Longest text a record holds; longer text is cut off */
+  static const size_t MAX_TEXT = 240;
+
+  /** Start a record */
+  LogLine(log_level_t level) : level(level) {}
+
+  /** Hand the record to the background thread */
+  ~LogLine();
+
+  LogLine(const LogLine &) = delete;
+  LogLine &operator=(const LogLine &) = delete;
+
+  LogLine &operator<<(const char *s) { return append(s, strlen(s)); }
+  LogLine &operator<<(const std::string &s) { return append(s.data(), s.size()); }
+  LogLine &operator<<(char c) { return append(&c, 1); }
+  LogLine &operator<<(unsigned char c) { return append((const char *)&c, 1); }
+  LogLine &operator<<(bool b) { return *this << (int)b; }
+  LogLine &operator<<(double d);
+
+  /** Integers of any size */
+  template <typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+  LogLine &operator<<(T v) {
+    return std::is_signed<T>::value ? put_signed((long long)v) : put_unsigned((unsigned long long)v);
+  }
+
+private:
+  /** Add text to the record, as much of it as fits */
+  LogLine &append(const char *s, size_t n) {
+    n = std::min(n, MAX_TEXT - len);
+    memcpy(text + len, s, n);
+    len += n;
+    return *this;
+  }
+
+  LogLine &put_signed(long long v);
+  LogLine &put_unsigned(unsigned long long v);
+
+  /** The level, and the text so far */
+  log_level_t level;
+  size_t len = 0;
+  char text[MAX_TEXT];
+};
+
+/** Swallows a LogLine expression, so that the macros below are expressions too */
+struct LogVoidify {
+  void operator&(LogLine &) {}
+};
+
+#define LOG_AT(level) ((level) < LOG_MIN_LEVEL) ? (void)0 : LogVoidify() & LogLine(level)
+#define LOG_DEBUG LOG_AT(LVL_DEBUG)
+#define LOG_INFO LOG_AT(LVL_INFO)
+#define LOG_WARN LOG_AT(LVL_WARN)
+#define LOG_ERROR LOG_AT(LVL_ERROR)
+
+/**
+ * @brief Write out every record that has been logged so far, and wait until
+ * it has been written.  This also happens on exit().
+ */
+void log_flush();
+
+#endif
@@ -0,0 +1,122 @@
+/**
+ * @file metrics.cc
+ */
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+
+#include "log.h"
+#include "metrics.h"
+
+using namespace std;
+
+/** Longest request head a scraper may send */
+static const size_t METRICS_MAX_REQUEST = 8192;
+
+/** Seconds a scraper may take to send its request, or to take the page */
+static const int METRICS_TIMEOUT = 5;
+
+/**
+ * @brief Start a metric family
+ *
+ * @param name The family's name, such as kv_requests_total
+ * @param type counter, gauge or histogram
+ * @param help One line saying what it counts
+ */
+void MetricsText::family(const string &name, const char *type, const char *help) {
+    text += "# HELP " + name + " " + help + "\n";
+    text += "# TYPE " + name + " " + type + "\n";
+}
+
+/**
+ * @brief Add a sample to the family just started.  Whole numbers are written
+ * without a fraction, so that counters read exactly.
+ */
+void MetricsText::sample(const string &name, double v, const string &labels) {
+    char buf[32];
+    if (std::isinf(v))
+        snprintf(buf, sizeof(buf), v > 0 ? "+Inf" : "-Inf");
+    else if (v == floor(v) && fabs(v) < 1e15)
+        snprintf(buf, sizeof(buf), "%.0f", v);
+    else
+        snprintf(buf, sizeof(buf), "%.9g", v);
+    text += name;
+    if (!labels.empty()) text += "{" + labels + "}";
+    text += " ";
+    text += buf;
+    text += "\n";
+}
+
+/** Send all of a string, giving up on an error or a timeout */
+static bool send_all(int sd, const string &s) {
+    size_t sent = 0;
+    while (sent < s.size()) {
+        ssize_t n = send(sd, s.data() + sent, s.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+/** Answer one scrape: read the request head, then send the page or a 404 */
+static void serve_scrape(int sd, const function<string()> &render) {
+    timeval tv = {METRICS_TIMEOUT, 0};
+    setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    string req;
+    char buf[1024];
+    while (req.find("\r\n\r\n") == string::npos && req.find("\n\n") == string::npos) {
+        if (req.size() > METRICS_MAX_REQUEST) return;
+        ssize_t n = recv(sd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        req.append(buf, n);
+    }
+
+    /* only the request line matters: GET /metrics, or GET / */
+    string line = req.substr(0, req.find_first_of("\r\n"));
+    bool found = line.rfind("GET /metrics ", 0) == 0 || line.rfind("GET /metrics?", 0) == 0 ||
+                 line.rfind("GET / ", 0) == 0;
+    string body = found ? render() : "not found\n";
+    string head = string(found ? "HTTP/1.0 200 OK\r\n" : "HTTP/1.0 404 Not Found\r\n") +
+                  "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n" +
+                  "Content-Length: " + to_string(body.size()) + "\r\n" + "Connection: close\r\n\r\n";
+    send_all(sd, head) && send_all(sd, body);
+}
+
+/**
+ * @brief Serve metrics over HTTP on a listening socket, from a thread of its
+ * own.  Scrapes are answered one at a time, which is plenty for a scraper
+ * that comes every few seconds.
+ *
+ * @param sd     The listening socket, TCP or Unix
+ * @param render Builds the page, and may be called from the serving thread at any time
+ */
+void metrics_serve(int sd, function<string()> render) {
+    /* this thread blocks in accept(), whatever the listener was set up for */
+    fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) & ~O_NONBLOCK);
+    thread([sd, render]() {
+        while (true) {
+            int csd = accept(sd, nullptr, nullptr);
+            if (csd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE) {
+                    if (errno == EMFILE || errno == ENFILE) this_thread::sleep_for(chrono::milliseconds(100));
+                    continue;
+                }
+                LOG_ERROR << "metrics: accept failed: " << strerror(errno);
+                return;
+            }
+            serve_scrape(csd, render);
+            close(csd);
+        }
+    }).detach();
+}
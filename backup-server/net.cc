@@ -2,7 +2,9 @@
  * @file net.cc
  */
 
+#include "log.h"
 #include "net.h"
+#include "protocol.h"
 #include "server_parsing.h"
 
 using namespace std;
@@ -51,13 +53,31 @@ int create_server_socket(std::size_t port) {
         close(sd);
         error_message_and_exit(0, errno, "Error binding socket to local address: ");
     }
-    if (listen(sd, 0) < 0) {
+    /** A burst of clients should queue up in the kernel rather than be refused */
+    if (listen(sd, SOMAXCONN) < 0) {
         close(sd);
         error_message_and_exit(0, errno, "Error listening on socket: ");
     }
     return sd;
 }
 
+/**
+ * @brief Bound how long blocking reads and writes on a socket may wait, so
+ * that a dead or stalled peer cannot hold a worker forever.  A read or write
+ * that times out fails with EAGAIN.
+ *
+ * @param sd        The socket
+ * @param recv_secs Seconds a recv() may wait (0 = forever)
+ * @param send_secs Seconds a send() may wait (0 = forever)
+ * @return false on error, true otherwise
+ */
+bool set_socket_timeouts(int sd, int recv_secs, int send_secs) {
+    timeval rtv = {recv_secs, 0};
+    timeval stv = {send_secs, 0};
+    return setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &rtv, sizeof(rtv)) == 0 &&
+           setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, &stv, sizeof(stv)) == 0;
+}
+
 /**
  * When a client sends a message, we use this to read from the client socket. As
  * in previous examples, we can get ourselves into some trouble if we don't know
@@ -157,7 +177,7 @@ void echo_server(int sd, bool verbose) {
  */
 void sys_error(int err, const char *prefix) {
     char buf[1024];
-    cerr << prefix << " " << strerror_r(err, buf, sizeof(buf)) << endl;
+    LOG_ERROR << prefix << " " << strerror_r(err, buf, sizeof(buf));
 }
 
 /**
@@ -202,8 +222,8 @@ int reliable_get_to_eof_or_n(int sd, vec::iterator pos, int amnt) {
  * @return A vector with the data that was read, or an empty vector on error 
  */
 vec reliable_get_to_eof(int sd) {
-    // set up the initial buffer
-    vec res(16);
+    // set up the initial buffer, big enough that most responses need one recv()
+    vec res(4096);
     int recd = 0;
     // start reading.  Double the buffer any time we fill up
     while (true) {
@@ -244,7 +264,7 @@ void accept_client(int sd, function<bool(int)> handler) {
     // Use accept() to wait for a client to connect.  When it connects, service
     // it.  When it disconnects, then and only then will we accept a new client.
     while (true) {
-        cout << "Waiting for a client to connect...\n";
+        LOG_DEBUG << "Waiting for a client to connect...";
         sockaddr_in clientAddr = {0};
         socklen_t clientAddrSize = sizeof(clientAddr);
         int connSd = accept(sd, (sockaddr *)&clientAddr, &clientAddrSize);
@@ -254,10 +274,7 @@ void accept_client(int sd, function<bool(int)> handler) {
             return;
         }
         char clientname[1024];
-        cout << "Connected to "
-             << inet_ntop(AF_INET, &clientAddr.sin_addr, clientname,
-                          sizeof(clientname))
-             << endl;
+        LOG_DEBUG << "Connected to " << inet_ntop(AF_INET, &clientAddr.sin_addr, clientname, sizeof(clientname));
         bool done = handler(connSd);
         // NB: ignore errors in close()
         close(connSd);
@@ -269,13 +286,14 @@ void accept_client(int sd, function<bool(int)> handler) {
 /**
  * @brief Given a listening socket, start calling accept() on it to get new
  * connections.  Each time a connection comes in, pass it to the thread pool so
- * that it can be processed.
+ * that it can be processed.  If the pool's queue is full, the connection gets
+ * RES_BUSY and is closed right away.
  * 
  * @param sd    The socket file descriptor on which to call accept
  * @param pool  The thread pool that handles new requests
  */
 void accept_client(int sd, thread_pool &pool) {
-    cout << "Entered accept_client!" << endl;
+    LOG_DEBUG << "Entered accept_client!";
   atomic<bool> safe_shutdown(false);
   pool.set_shutdown_handler([&]() {
     safe_shutdown = true;
@@ -284,7 +302,7 @@ void accept_client(int sd, thread_pool &pool) {
   // Use accept() to wait for a client to connect.  When it connects, service
   // it.  When it disconnects, then and only then will we accept a new client.
   while (pool.check_active()) {
-    cout << "Waiting for a client to connect...\n";
+    LOG_DEBUG << "Waiting for a client to connect...";
     sockaddr_in clientAddr = {0};
     socklen_t clientAddrSize = sizeof(clientAddr);
     int connSd = accept(sd, (sockaddr *)&clientAddr, &clientAddrSize);
@@ -296,12 +314,14 @@ void accept_client(int sd, thread_pool &pool) {
       return;
     }
     char clientname[1024];
-    cout << "Connected to "
-         << inet_ntop(AF_INET, &clientAddr.sin_addr, clientname,
-                      sizeof(clientname))
-         << endl;
-    pool.service_connection(connSd);
-    cout << "Exited accept_client!" << endl;
+    LOG_DEBUG << "Connected to " << inet_ntop(AF_INET, &clientAddr.sin_addr, clientname, sizeof(clientname));
+    if (!pool.service_connection(connSd)) {
+      // The queue is full: turn the client away now instead of letting it
+      // wait for a thread.  NB: ignore errors, the client may already be gone
+      send(connSd, RES_BUSY.c_str(), RES_BUSY.length(), MSG_DONTWAIT | MSG_NOSIGNAL);
+      close(connSd);
+    }
+    LOG_DEBUG << "Exited accept_client!";
   }
 }
 
@@ -61,6 +61,18 @@ void echo_server(int, bool);
  */
 int create_server_socket(std::size_t);
 
+/**
+ * @brief Bound how long blocking reads and writes on a socket may wait, so
+ * that a dead or stalled peer cannot hold a worker forever.  A read or write
+ * that times out fails with EAGAIN.
+ *
+ * @param sd        The socket
+ * @param recv_secs Seconds a recv() may wait (0 = forever)
+ * @param send_secs Seconds a send() may wait (0 = forever)
+ * @return false on error, true otherwise
+ */
+bool set_socket_timeouts(int sd, int recv_secs, int send_secs);
+
 /**
  * @brief Print an error message that combines some application-specific text with the
  * standard unix error message that accompanies errno.
@@ -103,7 +115,8 @@ void accept_client(int sd, std::function<bool(int)> handler);
 /**
  * @brief Given a listening socket, start calling accept() on it to get new
  * connections.  Each time a connection comes in, pass it to the thread pool so
- * that it can be processed.
+ * that it can be processed.  If the pool's queue is full, the connection gets
+ * RES_BUSY and is closed right away.
  * 
  * @param sd    The socket file descriptor on which to call accept
  * @param pool  The thread pool that handles new requests
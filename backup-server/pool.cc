@@ -1,4 +1,5 @@
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <functional>
 #include <mutex>
@@ -20,7 +21,12 @@ struct thread_pool::Internal {
   /// user-specified
   ///
   std::vector<std::thread> worker_threads;
-  std::queue<int> jobs;
+  /// each connection waiting for a thread, with the time it was queued
+  std::queue<std::pair<int, std::chrono::steady_clock::time_point>> jobs;
+  /// the most connections that may wait (0 = no limit)
+  size_t max_queue = 0;
+  /// queue metrics, guarded by m
+  thread_pool::stats_t stats = {};
   std::condition_variable cv;
   std::mutex m;
   std::function<bool(int)> handler;
@@ -37,10 +43,11 @@ struct thread_pool::Internal {
 ///
 /// @param size    The number of threads in the pool
 /// @param handler The code to run whenever something arrives in the pool
-thread_pool::thread_pool(int size, function<bool(int)> handler)
+thread_pool::thread_pool(int size, function<bool(int)> handler, size_t max_queue)
     : fields(new Internal(handler)) {
 
     fields->handler = handler;
+    fields->max_queue = max_queue;
     auto working = [&]() {
         while (true) {
             std::unique_lock<std::mutex> lock(fields->m);
@@ -49,8 +56,13 @@ thread_pool::thread_pool(int size, function<bool(int)> handler)
                 return;
             }
 
-            int job = std::move(fields->jobs.front());
+            int job = fields->jobs.front().first;
+            auto wait = chrono::steady_clock::now() - fields->jobs.front().second;
             fields->jobs.pop();
+            uint64_t wait_us = chrono::duration_cast<chrono::microseconds>(wait).count();
+            fields->stats.started++;
+            fields->stats.total_wait_us += wait_us;
+            fields->stats.max_wait_us = max(fields->stats.max_wait_us, wait_us);
             lock.unlock();
 
             fields->done = fields->handler(job);
@@ -100,8 +112,27 @@ void thread_pool::await_shutdown() {
 /// connection to the pool for processing.
 ///
 /// @param sd The socket descriptor for the new connection
-void thread_pool::service_connection(int sd) {
+///
+/// @return false if the queue is full, in which case the pool did not take
+///         the connection and the caller still owns sd
+bool thread_pool::service_connection(int sd) {
     std::lock_guard<std::mutex> lock(fields->m);
-    fields->jobs.push(sd);
+    if (fields->max_queue > 0 && fields->jobs.size() >= fields->max_queue) {
+        fields->stats.shed++;
+        return false;
+    }
+    fields->jobs.push({sd, chrono::steady_clock::now()});
+    fields->stats.admitted++;
+    fields->stats.max_depth = max(fields->stats.max_depth, fields->jobs.size());
     fields->cv.notify_one();
+    return true;
+}
+
+/// Get a snapshot of the queue metrics.  Nothing is reset, so any number of
+/// readers see the same counts and maximums.
+thread_pool::stats_t thread_pool::stats() {
+    std::lock_guard<std::mutex> lock(fields->m);
+    stats_t res = fields->stats;
+    res.depth = fields->jobs.size();
+    return res;
 }
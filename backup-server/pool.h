@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <functional>
 #include <memory>
 
@@ -17,12 +18,36 @@ class thread_pool {
   std::unique_ptr<Internal> fields;
 
 public:
+  /// A snapshot of how busy the queue is
+  struct stats_t {
+    /// Connections waiting in the queue right now
+    size_t depth;
+
+    /// The most connections that have waited in the queue at once, since the
+    /// pool started
+    size_t max_depth;
+
+    /// Connections that were queued, and that were turned away because the
+    /// queue was full
+    uint64_t admitted;
+    uint64_t shed;
+
+    /// Connections that a thread has taken off the queue, and how long they
+    /// waited there in total and at most, in microseconds, since the pool
+    /// started
+    uint64_t started;
+    uint64_t total_wait_us;
+    uint64_t max_wait_us;
+  };
+
   /// construct a thread pool by providing a size and the function to run on
   /// each element that arrives in the queue
   ///
-  /// @param size    The number of threads in the pool
-  /// @param handler The code to run whenever something arrives in the pool
-  thread_pool(int size, std::function<bool(int)> handler);
+  /// @param size      The number of threads in the pool
+  /// @param handler   The code to run whenever something arrives in the pool
+  /// @param max_queue The most connections that may wait for a thread, or 0
+  ///                  for no limit
+  thread_pool(int size, std::function<bool(int)> handler, size_t max_queue = 0);
 
   /// destruct a thread pool
   ~thread_pool();
@@ -44,5 +69,12 @@ public:
   /// connection to the pool for processing.
   ///
   /// @param sd The socket descriptor for the new connection
-  void service_connection(int sd);
+  ///
+  /// @return false if the queue is full, in which case the pool did not take
+  ///         the connection and the caller still owns sd
+  bool service_connection(int sd);
+
+  /// Get a snapshot of the queue metrics.  Nothing is reset, so any number
+  /// of readers see the same counts and maximums.
+  stats_t stats();
 };
\ No newline at end of file
@@ -19,9 +19,40 @@ const string REQ_PVD = "PVD";
 const string REQ_DOR = "DOR";
 const string REQ_ROR = "ROR";
 
+/**
+ * Switch a connection to persistent mode.  From then on every response is
+ * framed (see ST_OK), the connection stays open for more requests until the
+ * client closes it, and the client may pipeline requests: it can send the next
+ * ones before the earlier responses arrive, which come back in order.
+ */
+const string REQ_KAL = "KAL";
+
 /** Response code to indicate that the command was successful */
 const string RES_OK = "TRUE";
 
 /* Response code to indicate that there was an error when searching for the given key */
 const string RES_ERR_KEY = "FALSE";
 const string RES_ERR_INVALID = "INVALID";
+
+/**
+ * Response sent instead of serving a connection when the server is overloaded.
+ * It is sent as soon as the connection is accepted, unframed, and then the
+ * connection is closed: the client should back off and try again.
+ */
+const string RES_BUSY = "BUSY";
+
+/**
+ * Status byte that starts every framed response.  It is followed by the 4-byte
+ * length of the payload, and the payload itself: the value for KVG, the log
+ * for ROR, and nothing for the other commands.
+ */
+const unsigned char ST_OK = 0;
+
+/** Status byte of a framed RES_ERR_KEY */
+const unsigned char ST_ERR_KEY = 1;
+
+/** Status byte of a framed RES_ERR_INVALID */
+const unsigned char ST_ERR_INVALID = 2;
+
+/** Length of the status byte and payload length that start a framed response */
+const int LEN_FRAME = 5;
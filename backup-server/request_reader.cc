@@ -0,0 +1,77 @@
+/**
+ * @file request_reader.cc
+ */
+
+#include <cstring>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "net.h"
+#include "protocol.h"
+#include "request_reader.h"
+
+using namespace std;
+
+/**
+ * @brief Make sure at least n unparsed bytes are buffered
+ *
+ * @return false if the socket closed or failed first
+ */
+bool RequestReader::fill(size_t n) {
+    if (len - off >= n)
+        return true;
+    /* move the unparsed tail to the front, to make room for a whole chunk */
+    memmove(buf.data(), buf.data() + off, len - off);
+    len -= off;
+    off = 0;
+    while (len < n) {
+        ssize_t rcd = recv(sd, buf.data() + len, buf.size() - len, 0);
+        if (rcd <= 0) {
+            if (rcd < 0 && errno == EINTR)
+                continue;
+            if (rcd < 0)
+                sys_error(errno, "Error in recv():");
+            return false;
+        }
+        len += rcd;
+    }
+    return true;
+}
+
+/**
+ * @brief Get the next request
+ *
+ * @param cmd  Set to the 3-byte command
+ * @param body Set to the body of the request
+ * @return false if the socket closed or failed before a whole request
+ *         arrived, or the header was bad
+ */
+bool RequestReader::next(string &cmd, vec &body) {
+    if (!fill(LEN_RKBLOCK))
+        return false;
+    int alen;
+    memcpy(&alen, buf.data() + off + 3, sizeof(int));
+    if (alen < 0)
+        return false;
+
+    /* a request that fits in the buffer is parsed in place */
+    if (LEN_RKBLOCK + (size_t)alen <= buf.size()) {
+        if (!fill(LEN_RKBLOCK + alen))
+            return false;
+        cmd.assign((const char *)buf.data() + off, 3);
+        off += LEN_RKBLOCK;
+        body.assign(buf.data() + off, buf.data() + off + alen);
+        off += alen;
+        return true;
+    }
+
+    /* a larger body takes what is buffered, and the rest is received in place */
+    cmd.assign((const char *)buf.data() + off, 3);
+    off += LEN_RKBLOCK;
+    size_t have = len - off;
+    body.resize(alen);
+    memcpy(body.data(), buf.data() + off, have);
+    off = len = 0;
+    int rest = alen - have;
+    return reliable_get_to_eof_or_n(sd, body.begin() + have, rest) == rest;
+}
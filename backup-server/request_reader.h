@@ -0,0 +1,59 @@
+/**
+ * @file request_reader.h
+ */
+
+#ifndef REQUEST_READER_DEF
+#define REQUEST_READER_DEF
+
+#pragma once
+
+#include <string>
+
+#include "vec.h"
+
+/**
+ * @brief RequestReader is the input buffer of one client connection.  It asks
+ * recv() for a large chunk at a time and parses requests (the 3-byte command,
+ * the 4-byte body length and the body) out of the buffer in place, so a burst
+ * of small pipelined requests costs a single recv() instead of two per
+ * request.  A body larger than the buffer is received straight into place.
+ */
+class RequestReader {
+    /** The socket to read from */
+    int sd;
+
+    /** Received bytes, and the range of them that has not been parsed yet */
+    vec buf;
+    size_t off = 0;
+    size_t len = 0;
+
+    /** How much to ask recv() for at a time */
+    static const size_t READ_CHUNK = 16 * 1024;
+
+    /**
+     * @brief Make sure at least n unparsed bytes are buffered
+     *
+     * @return false if the socket closed or failed first
+     */
+    bool fill(size_t n);
+
+public:
+    /**
+     * @brief Construct a reader for a socket, which it does not own
+     *
+     * @param sd The socket
+     */
+    RequestReader(int sd) : sd(sd), buf(READ_CHUNK) {}
+
+    /**
+     * @brief Get the next request
+     *
+     * @param cmd  Set to the 3-byte command
+     * @param body Set to the body of the request
+     * @return false if the socket closed or failed before a whole request
+     *         arrived, or the header was bad
+     */
+    bool next(std::string &cmd, vec &body);
+};
+
+#endif
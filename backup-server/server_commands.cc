@@ -3,6 +3,7 @@
 
 #include "server_commands.h"
 #include "server_storage.h"
+#include "log.h"
 #include "net.h"
 #include <mutex>
 
@@ -11,7 +12,7 @@ using namespace std;
 /** 
  * Backup server loading log file from primary seerver (after primary server crashes/restarts) 
  */
-bool server_cmd_dor(int sd, const vec &disk, Storage &storage) {
+bool server_cmd_dor(vec &res, const vec &disk, Storage &storage) {
     mutex m;
     m.lock();
     storage.load(disk);
@@ -20,7 +21,7 @@ bool server_cmd_dor(int sd, const vec &disk, Storage &storage) {
 }
 
 /* update API call from primary server */
-bool server_cmd_pvi(int sd, const vec &req, Storage &storage) {
+bool server_cmd_pvi(vec &res, const vec &req, Storage &storage) {
     /** same as server_cmd_kvi */
     std::string key_str = "";
     std::string val_str = "";
@@ -37,20 +38,20 @@ bool server_cmd_pvi(int sd, const vec &req, Storage &storage) {
     int key = stoi(key_str);
     int val = stoi(val_str);
     /***************************/
-    std::cout << "PVI!" << std::endl;
-    std::cout << "key: " << key << std::endl;
-    std::cout << "val: " << val << std::endl;
+    LOG_DEBUG << "PVI!";
+    LOG_DEBUG << "key: " << key;
+    LOG_DEBUG << "val: " << val;
 
     /** Call insert() on storage object represented by hash table */
     bool from_primer = true;
     vec status = storage.kv_insert(key, val, from_primer);
 
     /** Send response to client */
-    send_reliably(sd, status);
+    res = status;
     return false;
 }
 
-bool server_cmd_pvd(int sd, const vec &req, Storage &storage) {
+bool server_cmd_pvd(vec &res, const vec &req, Storage &storage) {
     /** same as server_cmd_kvd */
     std::string key_str = "";
     unsigned char ulen[4] = {req.at(0), req.at(1), req.at(2), req.at(3)};
@@ -66,7 +67,7 @@ bool server_cmd_pvd(int sd, const vec &req, Storage &storage) {
     std::pair<bool, vec> result = storage.kv_delete(key, from_primer);
 
     /** Send response to client */
-    send_reliably(sd, result.second);
+    res = result.second;
     return false;
 }
 
@@ -74,22 +75,22 @@ bool server_cmd_pvd(int sd, const vec &req, Storage &storage) {
 /**
  * @brief Server command servering the Insert API call 
  * 
- * @param sd      The socket onto which the result should be written
+ * @param res     The vector into which the response should be written
  * @param req     The unencrypted contents of the request
  * @param storage The Storage object
  * @return        false, to indicate that the server shouldn't stop 
  */
-bool server_cmd_kvi(int sd, const vec &req, Storage &storage) {
+bool server_cmd_kvi(vec &res, const vec &req, Storage &storage) {
     /** Parse 'req' vector into strings */
     std::string key_str = "";
     std::string val_str = "";
-    cout << "size! " << req.size() << endl;
+    LOG_DEBUG << "size! " << req.size();
     unsigned char ulen[4] = {req.at(0), req.at(1), req.at(2), req.at(3)};
     int usize = *(int*) ulen;
-    cout << "usize: " << usize << endl;
+    LOG_DEBUG << "usize: " << usize;
     for (int i=4; i < usize+4; i++) {
         key_str += req[i];
-        cout << "req[i]: " << req.at(i) << endl;
+        LOG_DEBUG << "req[i]: " << req.at(i);
     }
     unsigned char plen[4] = {req.at(usize+4), req.at(usize+5), req.at(usize+6), req.at(usize+7)};
     int psize = *(int*) plen;
@@ -100,29 +101,29 @@ bool server_cmd_kvi(int sd, const vec &req, Storage &storage) {
     /** Store integer representation of key and value */
     int key = stoi(key_str);
     int val = stoi(val_str);
-    cout << "Key: " << key << endl;
-    cout << "Value: " << val << endl;
+    LOG_DEBUG << "Key: " << key;
+    LOG_DEBUG << "Value: " << val;
 
     /** Call insert() on storage object represented by hash table */
     bool from_primer = false;
     vec status = storage.kv_insert(key, val, from_primer);
 
     /** Send response to client */
-    cout << "Sending response to client..." << endl;
-    send_reliably(sd, status);
-    cout << "Sent!" << endl;
+    LOG_DEBUG << "Sending response to client...";
+    res = status;
+    LOG_DEBUG << "Sent!";
     return false;
 }
 
 /**
  * @brief Server command servering the Remove API call 
  * 
- * @param sd      The socket onto which the result should be written
+ * @param res     The vector into which the response should be written
  * @param req     The unencrypted contents of the request
  * @param storage The Storage object
  * @return        false, to indicate that the server shouldn't stop 
  */
-bool server_cmd_kvg(int sd, const vec &req, Storage &storage) {
+bool server_cmd_kvg(vec &res, const vec &req, Storage &storage) {
     /** Parse 'req' vector into strings */
     std::string key_str = "";
     unsigned char ulen[4] = {req.at(0), req.at(1), req.at(2), req.at(3)};
@@ -133,25 +134,25 @@ bool server_cmd_kvg(int sd, const vec &req, Storage &storage) {
 
     /** Store integer representation of key */
     int key = stoi(key_str);
-    cout << "Key: " << key << endl;
+    LOG_DEBUG << "Key: " << key;
 
     /** Call contains() on storage object represented by hash table */
     pair<bool, vec> result = storage.kv_get(key);
 
     /** Send response to client */
-    send_reliably(sd, result.second);
+    res = result.second;
     return false;
 }
 
 /**
  * @brief Server command servering the Contains API call 
  * 
- * @param sd      The socket onto which the result should be written
+ * @param res     The vector into which the response should be written
  * @param req     The unencrypted contents of the request
  * @param storage The Storage object
  * @return        false, to indicate that the server shouldn't stop 
  */
-bool server_cmd_kvd(int sd, const vec &req, Storage &storage) {
+bool server_cmd_kvd(vec &res, const vec &req, Storage &storage) {
     /** Parse 'req' vector into strings */
     std::string key_str = "";
     unsigned char ulen[4] = {req.at(0), req.at(1), req.at(2), req.at(3)};
@@ -162,13 +163,13 @@ bool server_cmd_kvd(int sd, const vec &req, Storage &storage) {
 
     /** Store integer representation of key */
     int key = stoi(key_str);
-    cout << "key: " << key << endl;
+    LOG_DEBUG << "key: " << key;
 
     /** Call remove() on storage object represented by hash table */
     bool from_primer = false;
     std::pair<bool, vec> result = storage.kv_delete(key, from_primer);
 
     /** Send response to client */
-    send_reliably(sd, result.second);
+    res = result.second;
     return false;
 }
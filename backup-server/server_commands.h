@@ -13,40 +13,40 @@
 /** 
  * Backup server loading log file from primary seerver (after primary server crashes/restarts) 
  */
-bool server_cmd_dor(int sd, const vec &disk, Storage &storage);
+bool server_cmd_dor(vec &res, const vec &disk, Storage &storage);
 
 /* update API call from primary server */
-bool server_cmd_pvi(int sd, const vec &req, Storage &storage);
-bool server_cmd_pvd(int sd, const vec &req, Storage &storage);
+bool server_cmd_pvi(vec &res, const vec &req, Storage &storage);
+bool server_cmd_pvd(vec &res, const vec &req, Storage &storage);
 
 /**
  * @brief Server command servering the Insert API call 
  * 
- * @param sd      The socket onto which the result should be written
+ * @param res     The vector into which the response should be written
  * @param req     The unencrypted contents of the request
  * @param storage The Storage object
  * @return        false, to indicate that the server shouldn't stop 
  */
-bool server_cmd_kvi(int sd, const vec &req, Storage &storage);
+bool server_cmd_kvi(vec &res, const vec &req, Storage &storage);
 
 /**
  * @brief Server command servering the Remove API call 
  * 
- * @param sd      The socket onto which the result should be written
+ * @param res     The vector into which the response should be written
  * @param req     The unencrypted contents of the request
  * @param storage The Storage object
  * @return        false, to indicate that the server shouldn't stop 
  */
-bool server_cmd_kvg(int sd, const vec &req, Storage &storage);
+bool server_cmd_kvg(vec &res, const vec &req, Storage &storage);
 
 /**
  * @brief Server command servering the Contains API call 
  * 
- * @param sd      The socket onto which the result should be written
+ * @param res     The vector into which the response should be written
  * @param req     The unencrypted contents of the request
  * @param storage The Storage object
  * @return        false, to indicate that the server shouldn't stop 
  */
-bool server_cmd_kvd(int sd, const vec &req, Storage &storage);
+bool server_cmd_kvd(vec &res, const vec &req, Storage &storage);
 
 #endif
\ No newline at end of file
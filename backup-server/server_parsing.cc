@@ -2,54 +2,134 @@
  * @file server_parsing.cc 
  */
 
+#include <atomic>
 #include <iostream>
 #include <string>
 
 #include "vec.h"
 #include "net.h"
 #include "protocol.h"
+#include "request_reader.h"
 #include "server_commands.h"
 #include "server_storage.h"
+#include "metrics.h"
+
+/** The commands counted per command, in the order serve_client() dispatches them, then KAL and the rest */
+static const char *CMD_NAMES[] = {"kvi", "kvg", "kvd", "pvi", "pvd", "dor", "kal", "other"};
+static const size_t N_CMDS = sizeof(CMD_NAMES) / sizeof(CMD_NAMES[0]);
+
+/** What the workers count.  Every request already costs a recv() and a send(), so shared counters do. */
+static std::atomic<uint64_t> requests[N_CMDS];
+static std::atomic<uint64_t> errors_key, errors_invalid;
+static std::atomic<uint64_t> conns_opened, conns_closed;
+
+/**
+ * @brief Frame a response for a persistent connection: a status byte, then
+ * the length of the payload and the payload.  Only a value is sent as
+ * payload, since the status byte already says TRUE, FALSE or INVALID.
+ * 
+ * @param response The response to frame
+ * @return The framed response
+ */
+static vec frame(const vec &response) {
+    std::string text(response.begin(), response.end());
+    unsigned char status = ST_OK;
+    if (text == RES_ERR_KEY)
+        status = ST_ERR_KEY;
+    else if (text == RES_ERR_INVALID)
+        status = ST_ERR_INVALID;
+    bool payload = status == ST_OK && text != RES_OK;
+
+    vec framed;
+    framed.push_back(status);
+    vec_append(framed, payload ? (int)response.size() : 0);
+    if (payload)
+        vec_append(framed, response);
+    return framed;
+}
 
 /**
- * @brief Serve client connection and execute requested API
+ * @brief Serve client connection and execute requested API.  A connection
+ * serves one request, unless its first request is KAL, in which case it
+ * serves requests until the client closes it.  Requests are read through a
+ * buffer and answered one at a time, so a client that pipelines them gets the
+ * responses in order, and a burst of them costs one recv().
  * 
  * @param sd      The socket on which communication with the client takes place
  * @param storage The Storage object with which clients interact
  * @return true if the server should halt immediately, false otherwise 
  */
 bool serve_client(int sd, Storage &storage) {
-    /* request block */
-    vec res(LEN_RKBLOCK);
-
-    /* get request from socket */
-    reliable_get_to_eof_or_n(sd, res.begin(), LEN_RKBLOCK);
-
-    /* recognize API command */
-    std::string cmd = "";
-    unsigned int j = 0;
-    unsigned char alen[4];
-    for (unsigned i=0; i < LEN_RKBLOCK; i++) {
-        if (i < 3) {
-            cmd += res[i];
-        } else if (i >= 3 && i < 7) {
-            alen[j] = res[i];
-            j++;
+    conns_opened.fetch_add(1, std::memory_order_relaxed);
+    struct closed_t {
+        ~closed_t() { conns_closed.fetch_add(1, std::memory_order_relaxed); }
+    } closed;
+    bool persistent = false;
+    RequestReader reader(sd);
+    std::string cmd;
+    vec msg;
+    while (true) {
+        /* get the next request, the client may close between requests */
+        if (!reader.next(cmd, msg)) {
+            return false;
         }
-    }
 
-    /* parse content */
-    int alen_int = *(int*) alen;
-    vec msg(alen_int);
-    reliable_get_to_eof_or_n(sd, msg.begin(), alen_int);
-
-    /* execute a command */
-    std::vector<std::string> s = {REQ_KVI, REQ_KVG, REQ_KVD, REQ_PVI, REQ_PVD, REQ_DOR};
-    decltype(server_cmd_kvi) *cmds[] = {server_cmd_kvi, server_cmd_kvg, server_cmd_kvd, server_cmd_pvi, server_cmd_pvd, server_cmd_dor};
-    for (size_t i = 0; i < s.size(); ++i) {
-        if (cmd == s[i]) {
-            return cmds[i](sd, msg, storage);
+        /* execute a command */
+        vec response;
+        bool halt = true;
+        size_t counted = N_CMDS - 1;
+        if (cmd == REQ_KAL) {
+            persistent = true;
+            response = vec_from_string(RES_OK);
+            halt = false;
+            counted = N_CMDS - 2;
+        }
+        std::vector<std::string> s = {REQ_KVI, REQ_KVG, REQ_KVD, REQ_PVI, REQ_PVD, REQ_DOR};
+        decltype(server_cmd_kvi) *cmds[] = {server_cmd_kvi, server_cmd_kvg, server_cmd_kvd, server_cmd_pvi, server_cmd_pvd, server_cmd_dor};
+        for (size_t i = 0; i < s.size(); ++i) {
+            if (cmd == s[i]) {
+                halt = cmds[i](response, msg, storage);
+                counted = i;
+            }
+        }
+        requests[counted].fetch_add(1, std::memory_order_relaxed);
+        std::string text(response.begin(), response.end());
+        if (text == RES_ERR_KEY)
+            errors_key.fetch_add(1, std::memory_order_relaxed);
+        else if (text == RES_ERR_INVALID)
+            errors_invalid.fetch_add(1, std::memory_order_relaxed);
+
+        /* on a persistent connection, frame the response so the client can pipeline */
+        if (persistent) {
+            response = frame(response);
+        }
+        if (!send_reliably(sd, response) || !persistent || halt) {
+            return halt;
         }
     }
-    return true;
+}
+
+/**
+ * @brief Add what the workers have counted to a Prometheus page: requests
+ * per command, error responses and connections
+ *
+ * @param out The page
+ */
+void serve_metrics(MetricsText &out) {
+    out.family("kv_requests_total", "counter", "Requests answered, by command");
+    for (size_t i = 0; i < N_CMDS; i++)
+        out.sample("kv_requests_total", requests[i].load(), std::string("cmd=\"") + CMD_NAMES[i] + "\"");
+
+    out.family("kv_errors_total", "counter", "Error responses");
+    out.sample("kv_errors_total", errors_key.load(), "kind=\"key\"");
+    out.sample("kv_errors_total", errors_invalid.load(), "kind=\"invalid\"");
+
+    /* read closed first, so a connection that closes meanwhile is not counted as closed but never opened */
+    uint64_t closed = conns_closed.load(), opened = conns_opened.load();
+    out.family("kv_connections_opened_total", "counter", "Client connections a worker has served");
+    out.sample("kv_connections_opened_total", opened);
+    out.family("kv_connections_closed_total", "counter", "Client connections a worker has finished with");
+    out.sample("kv_connections_closed_total", closed);
+    out.family("kv_connections", "gauge", "Client connections being served now");
+    out.sample("kv_connections", opened - closed);
 }
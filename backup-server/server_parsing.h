@@ -16,4 +16,14 @@
  */
 bool serve_client(int sd, Storage &storage);
 
+class MetricsText;
+
+/**
+ * @brief Add what the workers have counted to a Prometheus page: requests
+ * per command, error responses and connections
+ *
+ * @param out The page
+ */
+void serve_metrics(MetricsText &out);
+
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
  * @file server_storage.cc 
  */
 
+#include <atomic>
 #include <iostream>
 #include <unordered_map>
 #include <utility>
@@ -13,6 +14,7 @@
 #include "../lazy-list/concurrent_lazy_list.h"
 #include "file.h"
 #include "gateway.h"
+#include "log.h"
 
 
 using namespace std;
@@ -38,6 +40,12 @@ struct Storage::Internal {
     /* is backup server? */
     bool is_backup = true;
 
+    /** Keeps a snapshot from walking the lazy list while load() rebuilds it */
+    mutex reload_lock;
+
+    /** Keys in the lazy list; workers update it concurrently, so it may be off while load() rebuilds */
+    atomic<int64_t> keys{0};
+
     /* API commands in file as an unique 8-byte code */
     inline static const string KVINSERT = "KVINSERT";
     inline static const string KVDELETE = "KVDELETE";
@@ -98,14 +106,16 @@ bool Storage::load(const vec &disk) {
     unsigned int total = disk.size();
     if (total == 0) return false;
     unsigned int n = 0;
-    cout << "received a log file!" << endl;
+    LOG_INFO << "received a log file!";
+    lock_guard<mutex> guard(fields->reload_lock);
     /* reset a lazy list */
     fields->lazylist.set_delete_l();
     fields->lazylist.initialize();
-    cout << "deleted all nodes..." << endl;
+    fields->keys = 0;
+    LOG_DEBUG << "deleted all nodes...";
     while (n < total) {
         std::string prefix(disk.begin()+n, disk.begin()+n+8);
-        cout << "prefix: " << prefix << endl;
+        LOG_DEBUG << "prefix: " << prefix;
 
         /* Read INSERT command */
         if (prefix == fields->KVINSERT) {
@@ -120,7 +130,7 @@ bool Storage::load(const vec &disk) {
             int val = *(int*) vstr;
             n += 4;
             /* execute a command */
-            fields->lazylist.parse_insert(key, val);
+            if (fields->lazylist.parse_insert(key, val)) fields->keys++;
         }
 
         /* Read DELETE command */
@@ -132,18 +142,47 @@ bool Storage::load(const vec &disk) {
             int key = *(int*) kstr;
             n += 8;
             /* execute a command */
-            fields->lazylist.parse_delete(key);
+            if (fields->lazylist.parse_delete(key)) fields->keys--;
         }
 
         else {
-            cout << "something wrong!" << endl;
+            LOG_WARN << "something wrong!";
             n += 16;
         }
 
         /* break condition */
-        cout << "n: " << n << endl;
-        cout << "total: " << total << endl;
+        LOG_DEBUG << "n: " << n;
+        LOG_DEBUG << "total: " << total;
+    }
+    return true;
+}
+
+/**
+ * @brief Write a point-in-time image of the lazy list to this.filename, as a
+ * log of KVINSERT records that load() can replay.  Inserts and deletes keep
+ * running while the image is taken.  The image is written to a temporary file
+ * and renamed into place, so a crash never leaves a partial image behind.
+ * 
+ * @return false if there is no file name or the image could not be written
+ */
+bool Storage::snapshot() {
+    if (fields->filename.empty()) return false;
+    vector<pair<intptr_t, intptr_t>> image;
+    {
+        lock_guard<mutex> guard(fields->reload_lock);
+        image = fields->lazylist.snapshot();
     }
+    vec disk;
+    disk.reserve(image.size() * 16);
+    for (auto &kv : image) {
+        vec_append(disk, fields->KVINSERT);
+        vec_append(disk, (int)kv.first);
+        vec_append(disk, (int)kv.second);
+    }
+    string tmpname = fields->filename + ".tmp";
+    if (!write_file(tmpname, (const char *)disk.data(), disk.size())) return false;
+    if (rename(tmpname.c_str(), fields->filename.c_str()) != 0) return false;
+    LOG_INFO << "Wrote snapshot of " << image.size() << " keys";
     return true;
 }
 
@@ -158,7 +197,7 @@ void Storage::persist(string prefix, const int &key, const int &val) {
     fwrite (&key, sizeof(int), 1, fields->fp);
     fwrite (&val, sizeof(int), 1, fields->fp);
     fflush(fields->fp);
-    cout << "persisted data!" << endl;
+    LOG_DEBUG << "persisted data!";
 }
 
 /**
@@ -181,9 +220,10 @@ vec Storage::kv_insert(const int &key, const int &val, bool from_primer) {
     val_t key_ptr = (val_t)key;
     val_t val_ptr = (val_t)val;
 
-    cout << "kv_insert function!" << endl;
-    cout << "is from PVI? " << from_primer << endl;
+    LOG_DEBUG << "kv_insert function!";
+    LOG_DEBUG << "is from PVI? " << from_primer;
     if (fields->lazylist.parse_insert(key_ptr, val_ptr)) {
+        fields->keys++;
         if (!fields->is_backup) {
             persist(fields->KVINSERT, key, val);
             fields->gateway.send_message(REQ_PVI, key, val);
@@ -223,6 +263,7 @@ pair<bool, vec> Storage::kv_delete(const int &key, bool from_primer) {
     val_t key_ptr = (val_t)key;
     
     if (fields->lazylist.parse_delete(key_ptr)) {
+        fields->keys--;
         if (!fields->is_backup) {
             persist(fields->KVDELETE, key, 0);
             fields->gateway.send_message(REQ_PVD, key);
@@ -233,5 +274,11 @@ pair<bool, vec> Storage::kv_delete(const int &key, bool from_primer) {
     return {false, vec_from_string(RES_ERR_KEY)};
 };
 
+/** Keys in the lazy list, for the admin listener */
+uint64_t Storage::key_count() {
+    int64_t n = fields->keys.load();
+    return n > 0 ? n : 0;
+}
+
 /** Send request to primary server to retrieve log file if backup server crashes/restarts */
 
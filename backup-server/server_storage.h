@@ -56,6 +56,9 @@ public:
     /* is it backup server? */
     bool is_backup();
 
+    /** Keys in the lazy list, for the admin listener */
+    uint64_t key_count();
+
     /** Request log from primary seerver */
     bool do_request();
 
@@ -66,6 +69,13 @@ public:
      */
     bool load(const vec &disk);
 
+    /**
+     * @brief Write a point-in-time image of the lazy list to this.filename
+     * without stopping inserts and deletes.
+     * @return false if there is no file name or the image could not be written
+     */
+    bool snapshot();
+
     /**
      * @brief Write the entire Storage object to the file specified by this.filename.
      * To ensure durability, Storage must be persisted in two steps.  First, it
@@ -12,6 +12,7 @@
 #include "net.h"
 #include "protocols.h"
 #include "client_commands.h"
+#include "kv_client.h"
 
 using namespace std;
 
@@ -22,13 +23,21 @@ using namespace std;
 void usage() {
     cout << "  -s [string]  Name of the server (probably 'localhost')" << endl;
     cout << "  -p [int]     Port number of the server" << endl;
+    cout << "  -U [string]  Connect to the server's Unix domain socket at this path instead" << endl;
     cout << "  -w [int]     Time to wait between messages" << endl;
     cout << "  -C [string]  API Command" << endl;
     cout << "                   KVI (insert)" << endl;
     cout << "                   KVG (contains)" << endl;
     cout << "                   KVD (remove)" << endl;
+    cout << "                   STA (server latency statistics)" << endl;
     cout << "  -k [string]   Key" << endl;
     cout << "  -v [string]   Value" << endl;
+    cout << "  -N [int]      Pipeline N requests for keys key..key+N-1" << endl;
+    cout << "  -2            Speak the binary protocol v2" << endl;
+    cout << "  -m            Send requests through shared memory (server on the same host)" << endl;
+    cout << "  -B [int]      With -m, spin this many times before sleeping (busy-poll)" << endl;
+    cout << "  -b [int]      Batch up to this many requests into one (implies -2)" << endl;
+    cout << "  -L [int]      With -b, microseconds a batch waits for more requests (default 100)" << endl;
     cout << "  -h            Print help (this message)" << endl;
 }
 
@@ -42,15 +51,23 @@ void usage() {
  */
 void parseargs(int argc, char** argv, config_t& config) {
     long opt;
-    while ((opt = getopt(argc, argv, "s:p:w:C:k:v:h")) != -1) {
+    while ((opt = getopt(argc, argv, "s:p:U:w:C:k:v:PN:2mB:b:L:h")) != -1) {
         switch (opt) {
             case 's': config.server_name = std::string(optarg); break;
             case 'p': config.port = atoi(optarg); break;  
+            case 'U': config.unix_path = std::string(optarg); break;
             case 'w': config.wait = atoi(optarg); break;
             case 'h': usage(); break;
             case 'C': config.command = std::string(optarg); break;
             case 'k': config.key = std::string(optarg); break;
             case 'v': config.value = std::string(optarg); break;
+            case 'P': cerr << "-P is obsolete and ignored: connections are always persistent now" << endl; break;
+            case 'N': config.count = atoi(optarg); break;
+            case '2': config.v2 = true; break;
+            case 'm': config.shm = true; break;
+            case 'B': config.spin = atoi(optarg); break;
+            case 'b': config.batch_ops = atoi(optarg); break;
+            case 'L': config.batch_us = atoi(optarg); break;
         }
     }
 }
@@ -70,22 +87,50 @@ int main(int argc, char **argv) {
     /** Identify client by its unique PID */
     cout << "Starting client is: " << getpid() << endl;
 
-    /** Client socket for communication */
-    int sd = connect_to_server(args.server_name, args.port);
+    /** Statistics come back as text on a one-shot connection of their own */
+    if (args.command == REQ_STA) {
+        int sd = args.unix_path.empty() ? connect_to_server(args.server_name, args.port) : connect_to_unix(args.unix_path);
+        bool ok = client_stats(sd);
+        close(sd);
+        exit(ok ? 0 : 1);
+    }
+
+    /** Connection to the server, persistent and pipelined */
+    kv_options_t opts;
+    opts.server_name = args.server_name;
+    opts.port = args.port;
+    opts.unix_path = args.unix_path;
+    opts.v2 = args.v2;
+    opts.shm = args.shm;
+    opts.spin = args.spin;
+    opts.batch_ops = args.batch_ops;
+    opts.batch_us = args.batch_us;
+    KVClient kv;
+    if (!kv.connect(opts)) {
+        cout << "Server refused the connection" << (args.v2 ? " (does it speak protocol v2?)" : "") << endl;
+        exit(1);
+    }
 
     /** Send message to server */
-    if (args.command.length() > 0) {
+    if (args.command.length() > 0 && args.count > 1) {
+        if (!client_pipeline(kv, args.command, args.key, args.value, args.count)) {
+            cout << "Connection failed" << endl;
+            exit(1);
+        }
+    }
+    else if (args.command.length() > 0) {
         vector<string> cmds = {REQ_KVI, REQ_KVD, REQ_KVG};
         decltype(client_insert) *funcs[] = {client_insert, client_remove, client_contains};
         for (size_t i = 0; i < cmds.size(); ++i) {
             if (args.command == cmds[i]) {
-                funcs[i](sd, args.key, args.value);
+                funcs[i](kv, args.key, args.value);
             }
         }
     } 
     else {
         usage();
     }
+    kv.close();
 
     cout << "Closing client: " << getpid() << endl;
 
@@ -2,98 +2,122 @@
  * @file client_commands.cc
  */
 
+#include <chrono>
+#include <deque>
 #include <iostream>
 #include <string>
 
+#include "kv_client.h"
 #include "net.h"
 #include "protocols.h"
-#include "vec.h"
 
 #include "client_commands.h"
 
 using namespace std;
 
+/** Most requests client_pipeline() keeps in flight */
+static const int PIPELINE_DEPTH = 256;
+
 /**
- * @brief Send vector representation of key/value pair to server
- * 
- * @param sd  socket descriptor
- * @param cmd API command (insert/remove/contains)
- * @param msg key/value pair
- * @return    vec 
+ * @brief Print a result as the text a one-shot v1 connection would have
+ * received: the value of a found key, or the response code
+ *
+ * @param res       the result of the request
+ * @param has_value was the request a lookup, whose payload is a value?
  */
-vec client_send_cmd(int sd, const string &cmd, const vec &msg) {
-    /** Append cmd and msg to vec */
-    vec req;
-    vec_append(req, cmd);
-    vec_append(req, msg.size());
-    vec_append(req, msg);
+static void print_result(const kv_result_t &res, bool has_value) {
+    if (res.status == ST_OK && has_value) cout << res.value << endl;
+    else if (res.status == ST_OK) cout << RES_OK << endl;
+    else if (res.status == ST_ERR_KEY) cout << RES_ERR_KEY << endl;
+    else if (res.status == ST_ERR_INVALID) cout << RES_ERR_INVALID << endl;
+    else cout << endl;
+}
 
-    /** Send vector packet to server on specified socket descriptor */
-    send_reliably(sd, req);
-    vec res = reliable_get_to_eof(sd);
-    return res;
+/** Make the request for cmd on kv, for one key */
+static future<kv_result_t> request(KVClient &kv, const string &cmd, int key, int val) {
+    if (cmd == REQ_KVI) return kv.insert(key, val);
+    if (cmd == REQ_KVD) return kv.remove(key);
+    return kv.get(key);
 }
 
 /**
  * @brief Insert API command instructing server to insert key/value pair into lazy linked-list
- * 
- * @param sd  socket descriptor
+ *
+ * @param kv  connection to the server
  * @param key key
  * @param val value
  */
-void client_insert(int sd, const string &key, const string &val) {
-    /** Key/Value pair */
-
-    /** Append key/value to msg vector */
-    vec msg;
-    vec_append(msg, key.length());
-    vec_append(msg, key);
-    vec_append(msg, val.length());
-    vec_append(msg, val);
-    auto res = client_send_cmd(sd, REQ_KVI, msg);
-    string res_str = "";
-    for (unsigned int i = 0; i < res.size(); i++) {
-        res_str += res.at(i);
-    }
-    cout << res_str << endl;
+void client_insert(KVClient &kv, const string &key, const string &val) {
+    print_result(kv.insert(atoi(key.c_str()), atoi(val.c_str())).get(), false);
 }
 
 /**
  * @brief Remove API command instructing server to remove key/value pair from lazy linked-list
- * 
- * @param sd  socket descriptor
+ *
+ * @param kv  connection to the server
  * @param key key
  * @param val value
  */
-void client_remove(int sd, const string &key, const string &val) {
-    /** Append key to msg vector */   
-    vec msg;
-    vec_append(msg, key.length());
-    vec_append(msg, key);
-    auto res = client_send_cmd(sd, REQ_KVD, msg);
-    string res_str = "";
-    for (unsigned int i = 0; i < res.size(); i++) {
-        res_str += res.at(i);
-    }
-    cout << res_str << endl;
+void client_remove(KVClient &kv, const string &key, const string &) {
+    print_result(kv.remove(atoi(key.c_str())).get(), false);
 }
 
 /**
  * @brief Contains API command instructing server to check if key/value pair exists in lazy linked-list
- * 
- * @param sd  socket descriptor
+ *
+ * @param kv  connection to the server
  * @param key key
  * @param val value
  */
-void client_contains(int sd, const string &key, const string &val) {
-    /** Append key to msg vector */   
-    vec msg;
-    vec_append(msg, key.length());
-    vec_append(msg, key);
-    auto res = client_send_cmd(sd, REQ_KVG, msg);
-    string res_str = "";
-    for (unsigned int i = 0; i < res.size(); i++) {
-        res_str += res.at(i);
+void client_contains(KVClient &kv, const string &key, const string &) {
+    print_result(kv.get(atoi(key.c_str())).get(), true);
+}
+
+/**
+ * @brief Pipeline a run of requests for the keys key, key+1, ...,
+ * key+count-1.  Up to PIPELINE_DEPTH requests are in flight at once.  Prints
+ * how many requests got each kind of response, and the rate.
+ *
+ * @param kv    connection to the server
+ * @param cmd   API command (insert/remove/contains)
+ * @param key   first key
+ * @param val   value, only used for inserts
+ * @param count number of requests
+ * @return      false if the connection failed
+ */
+bool client_pipeline(KVClient &kv, const string &cmd, const string &key, const string &val, int count) {
+    int first = atoi(key.c_str()), v = atoi(val.c_str());
+    int counts[3] = {0, 0, 0};
+    deque<future<kv_result_t>> window;
+    auto start = chrono::steady_clock::now();
+    for (int sent = 0, done = 0; done < count; done++) {
+        for (; sent < count && sent - done < PIPELINE_DEPTH; sent++)
+            window.push_back(request(kv, cmd, first + sent, v));
+        kv_result_t res = window.front().get();
+        window.pop_front();
+        if (res.status > ST_ERR_INVALID) return false;
+        counts[res.status]++;
     }
-    cout << res_str << endl;
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << RES_OK << " " << counts[ST_OK] << " | " << RES_ERR_KEY << " " << counts[ST_ERR_KEY] << " | "
+         << RES_ERR_INVALID << " " << counts[ST_ERR_INVALID] << endl;
+    cout << count << " requests in " << secs * 1000 << " ms, " << (secs > 0 ? count / secs : 0) << " ops/s" << endl;
+    return true;
+}
+
+/**
+ * @brief Ask the server for its latency statistics, on a connection of their
+ * own, and print them
+ *
+ * @param sd a new connection to the server
+ * @return   false if the connection failed
+ */
+bool client_stats(int sd) {
+    vec req;
+    vec_append(req, REQ_STA);
+    vec_append(req, 0);
+    if (!send_reliably(sd, req)) return false;
+    vec res = reliable_get_to_eof(sd);
+    cout << string(res.begin(), res.end());
+    return !res.empty();
 }
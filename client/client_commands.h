@@ -1,5 +1,5 @@
 /**
- * @file client_commands.h 
+ * @file client_commands.h
  */
 
 #ifndef CLIENT_COMMANDS_DEF
@@ -9,41 +9,55 @@
 
 #include <string>
 
-/**
- * @brief Send vector representation of key/value pair to server
- * 
- * @param sd  socket descriptor
- * @param cmd API command (insert/remove/contains)
- * @param msg key/value pair
- * @return    vec 
- */
-vec client_send_cmd(int sd, const string &cmd, const vec &msg);
+#include "kv_client.h"
 
 /**
  * @brief Insert API command instructing server to insert key/value pair into lazy linked-list
- * 
- * @param sd  socket descriptor
+ *
+ * @param kv  connection to the server
  * @param key key
  * @param val value
  */
-void client_insert(int sd, const string &key, const string &val);
+void client_insert(KVClient &kv, const string &key, const string &val);
 
 /**
  * @brief Remove API command instructing server to remove key/value pair from lazy linked-list
- * 
- * @param sd  socket descriptor
+ *
+ * @param kv  connection to the server
  * @param key key
  * @param val value
  */
-void client_remove(int sd, const string &key, const string &val);
+void client_remove(KVClient &kv, const string &key, const string &val);
 
 /**
  * @brief Contains API command instructing server to check if key/value pair exists in lazy linked-list
- * 
- * @param sd  socket descriptor
+ *
+ * @param kv  connection to the server
  * @param key key
  * @param val value
  */
-void client_contains(int sd, const string &key, const string &val);
+void client_contains(KVClient &kv, const string &key, const string &val);
+
+/**
+ * @brief Pipeline a run of requests for the keys key, key+1, ...,
+ * key+count-1, and print a summary of the responses
+ *
+ * @param kv    connection to the server
+ * @param cmd   API command (insert/remove/contains)
+ * @param key   first key
+ * @param val   value, only used for inserts
+ * @param count number of requests
+ * @return      false if the connection failed
+ */
+bool client_pipeline(KVClient &kv, const string &cmd, const string &key, const string &val, int count);
+
+/**
+ * @brief Ask the server for its latency statistics, on a connection of their
+ * own, and print them
+ *
+ * @param sd a new connection to the server
+ * @return   false if the connection failed
+ */
+bool client_stats(int sd);
 
-#endif
\ No newline at end of file
+#endif
@@ -18,6 +18,9 @@ struct config_t {
   /** The port on which the program will connect to the above server */
   size_t port = 0;
 
+  /** Connect to the server's Unix domain socket at this path instead of TCP */
+  std::string unix_path = "";
+
   /** The time to wait between sending the first and second message */
   int wait = 0;
 
@@ -32,6 +35,24 @@ struct config_t {
 
   /** Value */
   std::string value = "";
+
+  /** Number of requests to pipeline, for consecutive keys starting at key */
+  int count = 1;
+
+  /** Speak protocol v2 instead of v1 */
+  bool v2 = false;
+
+  /** Send requests through a shared memory channel instead of the socket */
+  bool shm = false;
+
+  /** Spins before waiting on the shared memory channel sleeps (0 = sleep at once) */
+  unsigned spin = 0;
+
+  /** Batch up to this many requests into one (0 = do not batch) */
+  size_t batch_ops = 0;
+
+  /** Microseconds a batch stays open for more requests */
+  int batch_us = 100;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,122 @@
+/**
+ * @file hdr_histogram.cc
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+#include "hdr_histogram.h"
+
+using namespace std;
+
+/**
+ * @brief Construct an empty histogram.  Values below twice 10^digits each get
+ * a bucket of their own; above that, every power of two is cut into the same
+ * number of buckets, so each bucket is narrower than 10^-digits of its value.
+ *
+ * @param highest The highest value to track; larger values count as this
+ * @param digits  Significant decimal digits to keep, 1 to 5
+ */
+HdrHistogram::HdrHistogram(uint64_t highest, int digits) : highest(std::max<uint64_t>(highest, 2)) {
+    digits = min(std::max(digits, 1), 5);
+    half_magnitude = (int)ceil(log2(2 * pow(10.0, digits))) - 1;
+    half_count = 1ull << half_magnitude;
+    counts.resize(index_of(this->highest) + 1);
+}
+
+/** The index of the bucket that counts v */
+size_t HdrHistogram::index_of(uint64_t v) const {
+    /* which power of two (beyond the first 2 * half_count values), then where in it */
+    int bucket = 63 - __builtin_clzll(v | (2 * half_count - 1)) - half_magnitude;
+    uint64_t sub = v >> bucket;
+    return ((size_t)(bucket + 1) << half_magnitude) + (sub - half_count);
+}
+
+/** The lowest value that bucket index i counts */
+uint64_t HdrHistogram::value_at_index(size_t i) const {
+    int bucket = (int)(i >> half_magnitude) - 1;
+    uint64_t sub = (i & (half_count - 1)) + half_count;
+    if (bucket < 0) {
+        bucket = 0;
+        sub -= half_count;
+    }
+    return sub << bucket;
+}
+
+/** The highest value that bucket index i counts */
+uint64_t HdrHistogram::highest_equivalent(size_t i) const {
+    int bucket = std::max((int)(i >> half_magnitude) - 1, 0);
+    return value_at_index(i) + (1ull << bucket) - 1;
+}
+
+/** Count one value */
+void HdrHistogram::record(uint64_t v) {
+    v = min(v, highest);
+    counts[index_of(v)]++;
+    total++;
+    max_value = std::max(max_value, v);
+}
+
+/** Add another histogram with the same settings into this one */
+void HdrHistogram::add(const HdrHistogram &other) {
+    for (size_t i = 0; i < counts.size() && i < other.counts.size(); i++) counts[i] += other.counts[i];
+    total += other.total;
+    max_value = std::max(max_value, other.max_value);
+}
+
+/** The mean of the values counted, to the histogram's precision */
+double HdrHistogram::mean() const {
+    if (total == 0) return 0;
+    double sum = 0;
+    for (size_t i = 0; i < counts.size(); i++)
+        if (counts[i]) sum += counts[i] * (value_at_index(i) + highest_equivalent(i)) / 2.0;
+    return sum / total;
+}
+
+/**
+ * @brief The value that pct percent of the values are at or below, to the
+ * histogram's precision
+ */
+uint64_t HdrHistogram::value_at_percentile(double pct) const {
+    if (total == 0) return 0;
+    uint64_t want = std::max<uint64_t>(1, (uint64_t)ceil(min(pct, 100.0) / 100 * total));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+        seen += counts[i];
+        if (seen >= want) return min(highest_equivalent(i), max_value);
+    }
+    return max_value;
+}
+
+/**
+ * @brief Print the percentile distribution in the text format of
+ * HdrHistogram's tools (.hgrm), which its plotter reads
+ *
+ * @param out   Where to print
+ * @param scale Divide values by this to print them (1000 for ns as us)
+ * @param ticks Lines per halving of the distance to 100%
+ */
+void HdrHistogram::print_percentiles(ostream &out, double scale, int ticks) const {
+    out << fixed << setw(12) << "Value" << " " << setw(14) << "Percentile" << " " << setw(10) << "TotalCount" << " "
+        << setw(14) << "1/(1-Percentile)" << "\n\n";
+    if (total > 0) {
+        /* step towards 100% in ever smaller steps, ticks of them per halving of the distance */
+        uint64_t seen = 0;
+        size_t i = 0;
+        for (double pct = 0; pct < 100;) {
+            uint64_t v = value_at_percentile(pct);
+            for (; i < counts.size() && value_at_index(i) <= v; i++) seen += counts[i];
+            double frac = (double)seen / total;
+            if (frac >= 1) break;
+            out << setprecision(3) << setw(12) << v / scale << " " << setprecision(12) << setw(14) << frac << " "
+                << setw(10) << seen << " " << setprecision(2) << setw(14) << 1 / (1 - frac) << "\n";
+            pct += 100 / (ticks * pow(2.0, floor(log2(100 / (100 - pct))) + 1));
+        }
+        out << setprecision(3) << setw(12) << max_value / scale << " " << setprecision(12) << setw(14) << 1.0
+            << " " << setw(10) << total << "\n";
+    }
+    out << setprecision(3) << "#[Mean    = " << setw(12) << mean() / scale << ", Max            = " << setw(12)
+        << max_value / scale << "]\n";
+    out << "#[Total count    = " << setw(12) << total << ", SubBuckets     = " << setw(12) << 2 * half_count << "]\n";
+}
@@ -0,0 +1,86 @@
+/**
+ * @file hdr_histogram.h
+ */
+
+#ifndef HDR_HISTOGRAM_DEF
+#define HDR_HISTOGRAM_DEF
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/**
+ * @brief HdrHistogram counts values (such as latencies in nanoseconds) in
+ * buckets whose width grows with the value, as in Gil Tene's HdrHistogram:
+ * every value up to the highest trackable one is kept to a fixed number of
+ * significant digits, in a fixed amount of memory, with O(1) work per value.
+ * Histograms with the same settings can be added together, so each thread can
+ * keep its own and merge them at the end.
+ */
+class HdrHistogram {
+public:
+  /**
+   * @brief Construct an empty histogram
+   *
+   * @param highest The highest value to track; larger values count as this
+   * @param digits  Significant decimal digits to keep, 1 to 5
+   */
+  HdrHistogram(uint64_t highest = 3600ull * 1000 * 1000 * 1000, int digits = 3);
+
+  /** Count one value */
+  void record(uint64_t v);
+
+  /** Add another histogram with the same settings into this one */
+  void add(const HdrHistogram &other);
+
+  /** How many values have been counted */
+  uint64_t count() const { return total; }
+
+  /** The largest value counted */
+  uint64_t max() const { return max_value; }
+
+  /** The mean of the values counted, to the histogram's precision */
+  double mean() const;
+
+  /**
+   * @brief The value that pct percent of the values are at or below, to the
+   * histogram's precision
+   */
+  uint64_t value_at_percentile(double pct) const;
+
+  /**
+   * @brief Print the percentile distribution in the text format of
+   * HdrHistogram's tools (.hgrm), which its plotter reads
+   *
+   * @param out   Where to print
+   * @param scale Divide values by this to print them (1000 for ns as us)
+   * @param ticks Lines per halving of the distance to 100%
+   */
+  void print_percentiles(std::ostream &out, double scale, int ticks = 5) const;
+
+private:
+  /** The range of values that bucket index i counts */
+  uint64_t value_at_index(size_t i) const;
+  uint64_t highest_equivalent(size_t i) const;
+
+  /** The index of the bucket that counts v */
+  size_t index_of(uint64_t v) const;
+
+  /** The highest value tracked */
+  uint64_t highest;
+
+  /** log2 of half the buckets per power of two, and half the buckets */
+  int half_magnitude;
+  uint64_t half_count;
+
+  /** The counts themselves */
+  std::vector<uint64_t> counts;
+
+  /** How many values, and the largest */
+  uint64_t total = 0;
+  uint64_t max_value = 0;
+};
+
+#endif
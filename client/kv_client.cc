@@ -0,0 +1,530 @@
+/**
+ * @file kv_client.cc
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <endian.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "kv_client.h"
+#include "net.h"
+#include "protocols.h"
+#include "shm_channel.h"
+#include "vec.h"
+
+using namespace std;
+
+/** How long to wait on the channel before checking that the server is still there */
+static const int SHM_CHECK_MS = 1000;
+
+/** How many bytes the reader asks the socket for at once */
+static const size_t READ_CHUNK = 64 * 1024;
+
+/**
+ * @brief Append a v1 request: the command, the length of the body, then the
+ * key and the value as length-prefixed decimal strings
+ */
+static void append_v1(vec &out, const string &cmd, int key, const int *val) {
+    string k = to_string(key), v = val ? to_string(*val) : "";
+    vec_append(out, cmd);
+    vec_append(out, (int)(sizeof(int) + k.size() + (val ? sizeof(int) + v.size() : 0)));
+    vec_append(out, (int)k.size());
+    vec_append(out, k);
+    if (val) {
+        vec_append(out, (int)v.size());
+        vec_append(out, v);
+    }
+}
+
+/**
+ * @brief Append a v2 request: the magic byte, the opcode, and the key and
+ * value as little-endian ints
+ */
+static void append_v2(vec &out, unsigned char op, int key, int val) {
+    uint32_t k = htole32((uint32_t)key), v = htole32((uint32_t)val);
+    size_t off = out.size();
+    out.resize(off + LEN_V2_REQ);
+    out[off] = PROTO_V2;
+    out[off + 1] = op;
+    memcpy(out.data() + off + 2, &k, sizeof(k));
+    memcpy(out.data() + off + 6, &v, sizeof(v));
+}
+
+/**
+ * @brief KVClient::Internal is the private struct that holds all of the fields
+ * of the KVClient object.  Organizing the fields as an Internal is part of the
+ * PIMPL pattern.
+ */
+struct KVClient::Internal {
+    /** The socket, or -1 once the connection has moved to shared memory */
+    int sd = -1;
+
+    /** The shared memory channel that replaces the socket, or nullptr */
+    unique_ptr<ShmChannel> shm;
+
+    /** The protocol version the connection speaks */
+    int version = 1;
+
+    /** Is the connection up, with its threads running? */
+    bool open = false;
+
+    /** Most requests to batch into one OP_MULTI, or 0 not to batch */
+    size_t batch_ops = 0;
+
+    /** How long the first request of a batch waits for others to join it */
+    chrono::microseconds batch_linger{0};
+
+    /** Guards everything below that the threads share */
+    mutex lock;
+
+    /** Wakes the writer when out has requests, and the reader when frames does */
+    condition_variable to_send, to_read;
+
+    /** Requests that are queued but not sent yet */
+    vec out;
+
+    /** The promises of the requests that have no response yet, in order */
+    deque<promise<kv_result_t>> pending;
+
+    /**
+     * The responses to expect, in order: 0 for the response of one request,
+     * or how many requests an OP_MULTI response answers
+     */
+    deque<size_t> frames;
+
+    /** The requests of the batch that is still open, their promises, and when it closes */
+    vec batch_reqs;
+    deque<promise<kv_result_t>> batch_promises;
+    chrono::steady_clock::time_point batch_due;
+
+    /** Set when the connection fails; every request after that gets ST_FAILED */
+    bool failed = false;
+
+    /** Set by close(), so the threads stop once everything queued is done */
+    bool closing = false;
+
+    /** The threads that send requests and read responses */
+    thread writer, reader;
+
+    /** Bytes the reader has received, of which in[in_off, in_len) are not parsed yet */
+    vec in;
+    size_t in_off = 0, in_len = 0;
+
+    /** Send bytes over the socket, or into the channel */
+    bool send_bytes(const vec &req) {
+        if (!shm) return send_reliably(sd, req);
+        ShmRing ring(&shm->get()->requests);
+        for (size_t off = 0; off < req.size();) {
+            size_t n = ring.put(req.data() + off, req.size() - off);
+            off += n;
+            if (n == 0 && !ring.wait_space(shm->get()->spin, SHM_CHECK_MS) && !shm->peer_alive(false))
+                return false;
+        }
+        return true;
+    }
+
+    /** Receive at least one more byte into in, after in_len */
+    bool fill() {
+        if (!shm) {
+            while (true) {
+                ssize_t n = recv(sd, in.data() + in_len, in.size() - in_len, 0);
+                if (n > 0) {
+                    in_len += n;
+                    return true;
+                }
+                if (n == 0 || errno != EINTR) return false;
+            }
+        }
+        ShmRing ring(&shm->get()->responses);
+        while (true) {
+            const unsigned char *data;
+            size_t n = min(ring.peek(data), in.size() - in_len);
+            if (n > 0) {
+                memcpy(in.data() + in_len, data, n);
+                ring.consume(n);
+                in_len += n;
+                return true;
+            }
+            if (!ring.wait_data(shm->get()->spin, SHM_CHECK_MS) && !shm->peer_alive(false)) return false;
+        }
+    }
+
+    /** Make sure at least n unparsed bytes are in in */
+    bool need(size_t n) {
+        while (in_len - in_off < n) {
+            if (in_off > 0) {
+                memmove(in.data(), in.data() + in_off, in_len - in_off);
+                in_len -= in_off;
+                in_off = 0;
+            }
+            if (in.size() < max(n, READ_CHUNK)) in.resize(max(n, READ_CHUNK));
+            if (!fill()) return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Read one framed response
+     *
+     * @param status  Set to the status byte
+     * @param payload Set to the payload, which stays valid until the next read
+     * @param len     Set to the length of the payload
+     * @return false if the connection failed first
+     */
+    bool read_frame(unsigned char &status, const unsigned char *&payload, int &len) {
+        if (!need(LEN_FRAME)) return false;
+        memcpy(&len, in.data() + in_off + 1, sizeof(int));
+        if (len < 0 || !need(LEN_FRAME + len)) return false;
+        status = in[in_off];
+        payload = in.data() + in_off + LEN_FRAME;
+        in_off += LEN_FRAME + len;
+        return true;
+    }
+
+    /** Read the next response as a result */
+    bool read_result(kv_result_t &res) {
+        const unsigned char *payload;
+        int len;
+        if (!read_frame(res.status, payload, len)) return false;
+        /* only a found key has a payload: an int in v2, and a decimal string in v1 */
+        if (len > 0 && version == 2 && len == sizeof(uint32_t)) {
+            uint32_t v;
+            memcpy(&v, payload, sizeof(v));
+            res.value = (int32_t)le32toh(v);
+        } else if (len > 0) {
+            res.value = atoi(string(payload, payload + len).c_str());
+        }
+        return true;
+    }
+
+    /**
+     * @brief Queue a request, which encode appends to a buffer, and get the
+     * future of its response.  When batching, the request joins the open
+     * batch, which is queued once it is full or its time is up.
+     */
+    template <typename F> future<kv_result_t> submit(F encode) {
+        promise<kv_result_t> done;
+        auto res = done.get_future();
+        bool wake_writer = true, wake_reader = false;
+        {
+            lock_guard<mutex> guard(lock);
+            if (!open || failed || closing) {
+                done.set_value(kv_result_t());
+                return res;
+            }
+            if (batch_ops > 1) {
+                encode(batch_reqs);
+                batch_promises.push_back(move(done));
+                /* the writer only needs to hear about the first request (to start the clock) and the last */
+                if (batch_promises.size() == 1) batch_due = chrono::steady_clock::now() + batch_linger;
+                wake_writer = batch_promises.size() == 1 || batch_promises.size() >= batch_ops;
+                if (batch_promises.size() >= batch_ops) wake_reader = seal();
+            } else {
+                // NB: queued and pending in the same order, which is the order of the responses
+                encode(out);
+                pending.push_back(move(done));
+                frames.push_back(0);
+                wake_reader = true;
+            }
+        }
+        if (wake_writer) to_send.notify_one();
+        if (wake_reader) to_read.notify_one();
+        return res;
+    }
+
+    /**
+     * @brief Queue the open batch: as one OP_MULTI, or as a plain request if
+     * nothing joined the first one.  Call with lock held.
+     *
+     * @return true if there was a batch
+     */
+    bool seal() {
+        size_t n = batch_promises.size();
+        if (n == 0) return false;
+        if (n > 1) append_v2(out, OP_MULTI, n, 0);
+        vec_append(out, batch_reqs);
+        frames.push_back(n > 1 ? n : 0);
+        for (auto &p : batch_promises) pending.push_back(move(p));
+        batch_reqs.clear();
+        batch_promises.clear();
+        return true;
+    }
+
+    /** Mark the connection failed, and wake both threads so they stop */
+    void fail() {
+        {
+            lock_guard<mutex> guard(lock);
+            failed = true;
+        }
+        to_send.notify_one();
+        to_read.notify_one();
+        if (sd >= 0) shutdown(sd, SHUT_RDWR);
+    }
+
+    /**
+     * @brief Send whatever has been queued since the last send, and close
+     * batches whose time is up, until closed
+     */
+    void write_loop() {
+        vec sending;
+        while (true) {
+            {
+                unique_lock<mutex> guard(lock);
+                while (!failed) {
+                    bool sealed = !batch_promises.empty() && (closing || chrono::steady_clock::now() >= batch_due);
+                    if (sealed && seal()) to_read.notify_one();
+                    if (!out.empty() || (closing && batch_promises.empty())) break;
+                    if (batch_promises.empty()) to_send.wait(guard);
+                    else to_send.wait_until(guard, batch_due);
+                }
+                if (failed || out.empty()) return;
+                sending.swap(out);
+            }
+            if (!send_bytes(sending)) {
+                fail();
+                return;
+            }
+            sending.clear();
+        }
+    }
+
+    /**
+     * @brief Read the response of an OP_MULTI of n requests, and fulfil their
+     * promises, which are the first n of batch
+     */
+    bool read_multi(deque<promise<kv_result_t>> &batch, size_t n) {
+        unsigned char status;
+        const unsigned char *payload;
+        int len;
+        if (!read_frame(status, payload, len)) return false;
+        for (size_t i = 0; i < n; i++, batch.pop_front()) {
+            kv_result_t res;
+            /* a batch the server refused as a whole fails each of its requests the same way */
+            res.status = status;
+            if (status == ST_OK && (size_t)len == n * LEN_MULTI_RES) {
+                uint32_t v;
+                res.status = payload[i * LEN_MULTI_RES];
+                memcpy(&v, payload + i * LEN_MULTI_RES + 1, sizeof(v));
+                res.value = (int32_t)le32toh(v);
+            } else if (status == ST_OK) {
+                res.status = ST_ERR_INVALID;
+            }
+            batch.front().set_value(res);
+        }
+        return true;
+    }
+
+    /** Match responses to pending requests, until closed, then fail the rest */
+    void read_loop() {
+        deque<promise<kv_result_t>> batch;
+        deque<size_t> sizes;
+        bool ok = true;
+        while (ok) {
+            {
+                unique_lock<mutex> guard(lock);
+                to_read.wait(guard, [&]() { return !frames.empty() || failed || (closing && batch_promises.empty()); });
+                if (failed || frames.empty()) break;
+                batch.swap(pending);
+                sizes.swap(frames);
+            }
+            for (; ok && !sizes.empty(); sizes.pop_front()) {
+                kv_result_t res;
+                if (sizes.front() > 0) {
+                    ok = read_multi(batch, sizes.front());
+                } else if ((ok = read_result(res))) {
+                    batch.front().set_value(res);
+                    batch.pop_front();
+                }
+            }
+        }
+        if (!ok) fail();
+        {
+            lock_guard<mutex> guard(lock);
+            failed = true;
+            for (auto &p : pending) batch.push_back(move(p));
+            for (auto &p : batch_promises) batch.push_back(move(p));
+            pending.clear();
+            frames.clear();
+            batch_promises.clear();
+            batch_reqs.clear();
+        }
+        for (auto &p : batch) p.set_value(kv_result_t());
+    }
+
+    /** Send one request and read its response, before the threads start */
+    bool call(const vec &req, unsigned char &status, const unsigned char *&payload, int &len) {
+        return send_bytes(req) && read_frame(status, payload, len);
+    }
+
+    /**
+     * @brief Move to a shared memory channel.  The socket only names the
+     * channel to the server, which closes it after answering.
+     */
+    bool move_to_shm(unsigned spin) {
+        /* a process may have several clients, each with its own segment */
+        static atomic<int> next_id(0);
+        string name = "/kv-" + to_string(getpid()) + "-" + to_string(next_id++);
+        auto chan = make_unique<ShmChannel>();
+        if (!chan->create(name, spin)) return false;
+        vec req;
+        vec_append(req, REQ_SHM);
+        vec_append(req, (int)name.size());
+        vec_append(req, name);
+        bool ok = send_reliably(sd, req);
+        vec res = ok ? reliable_get_to_eof(sd) : vec();
+        // NB: the server removes the name when it attaches, this is for when it did not
+        shm_unlink(name.c_str());
+        if (res != vec_from_string(RES_OK)) return false;
+        ::close(sd);
+        sd = -1;
+        shm = move(chan);
+        return true;
+    }
+};
+
+/** Construct a client that is not connected yet */
+KVClient::KVClient() : fields(new Internal()) {}
+
+/** Close the connection, if it is open */
+KVClient::~KVClient() { close(); }
+
+/**
+ * @brief Connect to a server and switch the connection to persistent mode,
+ * moving to shared memory first if asked to
+ *
+ * @param opts Where the server is, and how to talk to it
+ * @return false if the server refused any of the steps
+ */
+bool KVClient::connect(const kv_options_t &opts) {
+    return attach(opts.unix_path.empty() ? connect_to_server(opts.server_name, opts.port)
+                                         : connect_to_unix(opts.unix_path),
+                  opts);
+}
+
+/**
+ * @brief Set up a socket that is already connected to the server, as
+ * connect() would
+ *
+ * @param sd   The connected socket
+ * @param opts How to talk to the server
+ * @return false if the server refused any of the steps
+ */
+bool KVClient::attach(int sd, const kv_options_t &opts) {
+    close();
+    Internal &f = *fields;
+    f.failed = f.closing = false;
+    f.in_off = f.in_len = 0;
+    f.version = 1;
+    f.sd = sd;
+    f.batch_ops = opts.batch_ops > 1 ? min(opts.batch_ops, (size_t)MAX_MULTI_OPS) : 0;
+    f.batch_linger = chrono::microseconds(max(opts.batch_us, 0));
+
+    bool ok = !opts.shm || f.move_to_shm(opts.spin);
+    unsigned char status;
+    const unsigned char *payload;
+    int len;
+    if (ok && (opts.v2 || f.batch_ops > 0)) {
+        /* the handshake: the version we want as the key, the one the server speaks back */
+        vec req;
+        append_v2(req, OP_HELLO, 2, 0);
+        uint32_t version = 0;
+        ok = f.call(req, status, payload, len);
+        if (ok && status == ST_OK && len == sizeof(version)) memcpy(&version, payload, sizeof(version));
+        ok = le32toh(version) >= 2;
+        f.version = 2;
+    } else if (ok && !opts.shm) {
+        /* a shared memory channel is always persistent, a socket has to ask */
+        vec req;
+        vec_append(req, REQ_KAL);
+        vec_append(req, 0);
+        ok = f.call(req, status, payload, len) && status == ST_OK;
+    }
+    if (!ok) {
+        f.shm.reset();
+        if (f.sd >= 0) ::close(f.sd);
+        f.sd = -1;
+        return false;
+    }
+
+    {
+        lock_guard<mutex> guard(f.lock);
+        f.open = true;
+    }
+    f.writer = thread(&Internal::write_loop, &f);
+    f.reader = thread(&Internal::read_loop, &f);
+    return true;
+}
+
+/**
+ * @brief Can the connection still carry requests?  This notices a server that
+ * has closed an idle connection without sending anything on it.
+ */
+bool KVClient::healthy() const {
+    Internal &f = *fields;
+    lock_guard<mutex> guard(f.lock);
+    if (!f.open || f.failed || f.closing) return false;
+    if (f.shm) return f.shm->peer_alive(false);
+    /* a closed socket reads as EOF at once; a live one has nothing, or the next response */
+    char c;
+    ssize_t n = recv(f.sd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+/**
+ * @brief Wait for the results of every request made so far, then close the
+ * connection
+ */
+void KVClient::close() {
+    Internal &f = *fields;
+    if (!f.open) return;
+    {
+        lock_guard<mutex> guard(f.lock);
+        f.closing = true;
+    }
+    f.to_send.notify_one();
+    f.to_read.notify_one();
+    f.writer.join();
+    f.reader.join();
+    {
+        lock_guard<mutex> guard(f.lock);
+        f.open = false;
+    }
+    f.shm.reset();
+    if (f.sd >= 0) ::close(f.sd);
+    f.sd = -1;
+}
+
+/** Insert a key/value pair: ST_OK, or ST_ERR_KEY if the key was there */
+future<kv_result_t> KVClient::insert(int key, int val) {
+    int version = fields->version;
+    return fields->submit([&](vec &out) {
+        if (version == 2) append_v2(out, OP_KVI, key, val);
+        else append_v1(out, REQ_KVI, key, &val);
+    });
+}
+
+/** Look up a key: ST_OK and its value, or ST_ERR_KEY */
+future<kv_result_t> KVClient::get(int key) {
+    int version = fields->version;
+    return fields->submit([&](vec &out) {
+        if (version == 2) append_v2(out, OP_KVG, key, 0);
+        else append_v1(out, REQ_KVG, key, nullptr);
+    });
+}
+
+/** Remove a key: ST_OK, or ST_ERR_KEY if it was not there */
+future<kv_result_t> KVClient::remove(int key) {
+    int version = fields->version;
+    return fields->submit([&](vec &out) {
+        if (version == 2) append_v2(out, OP_KVD, key, 0);
+        else append_v1(out, REQ_KVD, key, nullptr);
+    });
+}
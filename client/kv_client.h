@@ -0,0 +1,140 @@
+/**
+ * @file kv_client.h
+ */
+
+#ifndef KV_CLIENT_DEF
+#define KV_CLIENT_DEF
+
+#pragma once
+
+#include <future>
+#include <memory>
+#include <string>
+
+/**
+ * Status of a kv_result_t whose request got no response, because the
+ * connection failed or was closed first
+ */
+const unsigned char ST_FAILED = 0xff;
+
+/** The outcome of one request */
+struct kv_result_t {
+  /** ST_OK, ST_ERR_KEY, ST_ERR_INVALID, or ST_FAILED */
+  unsigned char status = ST_FAILED;
+
+  /** The value, for a get that found its key */
+  int value = 0;
+};
+
+/** How a KVClient reaches its server */
+struct kv_options_t {
+  /** The name of the server (ip or DNS) */
+  std::string server_name = "";
+
+  /** The server's port */
+  size_t port = 0;
+
+  /** Connect to the server's Unix domain socket at this path instead of TCP */
+  std::string unix_path = "";
+
+  /** Speak protocol v2 instead of v1 */
+  bool v2 = false;
+
+  /** Move to a shared memory channel once connected (server on the same host) */
+  bool shm = false;
+
+  /** Spins before waiting on the shared memory channel sleeps (0 = sleep at once) */
+  unsigned spin = 0;
+
+  /**
+   * Batch up to this many requests into one OP_MULTI (0 or 1 = do not batch).
+   * Batching needs protocol v2, so it implies v2.
+   */
+  size_t batch_ops = 0;
+
+  /** How long, in microseconds, a batch stays open for more requests */
+  int batch_us = 100;
+};
+
+/**
+ * @brief KVClient is a connection to a server that many requests can share.
+ * Each request returns at once with a future for its result.  Underneath, the
+ * connection is persistent and pipelined: a writer thread sends whatever
+ * requests have been queued since its last send in one go, and a reader
+ * thread matches the responses, which come back in order, to the futures.
+ *
+ * Batching is opt-in (see kv_options_t::batch_ops).  Requests made within
+ * batch_us of the first one in a batch then go out together as one OP_MULTI,
+ * and its response is split back among their futures.  This cuts the work per
+ * request on both sides, at the cost of up to batch_us of latency.
+ *
+ * Any number of threads may make requests on one KVClient.  Nothing bounds
+ * how many are in flight, so a caller that makes many should wait for some of
+ * the results before it makes more.
+ */
+class KVClient {
+  /**
+   * @brief Internal is the class that stores all the members of a KVClient
+   * object.  To avoid pulling too much into the .h file, we are using the
+   * PIMPL pattern
+   */
+  struct Internal;
+
+  /** A reference to the internal fields of the KVClient object */
+  std::unique_ptr<Internal> fields;
+
+public:
+  /** Construct a client that is not connected yet */
+  KVClient();
+
+  /** Close the connection, if it is open */
+  ~KVClient();
+
+  KVClient(const KVClient &) = delete;
+  KVClient &operator=(const KVClient &) = delete;
+
+  /**
+   * @brief Connect to a server and switch the connection to persistent mode
+   * (KAL for v1, the handshake for v2), moving to shared memory first if asked
+   * to.  To avoid errors in the constructor, connecting is separate from
+   * construction.
+   *
+   * @param opts Where the server is, and how to talk to it
+   * @return false if the server refused any of the steps
+   */
+  bool connect(const kv_options_t &opts);
+
+  /**
+   * @brief Set up a socket that is already connected to the server, as
+   * connect() would.  The client owns the socket from then on, even if this
+   * fails.
+   *
+   * @param sd   The connected socket
+   * @param opts How to talk to the server (where it is does not matter)
+   * @return false if the server refused any of the steps
+   */
+  bool attach(int sd, const kv_options_t &opts);
+
+  /**
+   * @brief Can the connection still carry requests?  This notices a server
+   * that has closed an idle connection without sending anything on it.
+   */
+  bool healthy() const;
+
+  /**
+   * @brief Wait for the results of every request made so far, then close the
+   * connection.  Requests made after this get ST_FAILED.
+   */
+  void close();
+
+  /** Insert a key/value pair: ST_OK, or ST_ERR_KEY if the key was there */
+  std::future<kv_result_t> insert(int key, int val);
+
+  /** Look up a key: ST_OK and its value, or ST_ERR_KEY */
+  std::future<kv_result_t> get(int key);
+
+  /** Remove a key: ST_OK, or ST_ERR_KEY if it was not there */
+  std::future<kv_result_t> remove(int key);
+};
+
+#endif
@@ -0,0 +1,196 @@
+/**
+ * @file kv_pool.cc
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "kv_pool.h"
+#include "net.h"
+
+using namespace std;
+
+/**
+ * @brief KVPool::Internal is the private struct that holds all of the fields of
+ * the KVPool object.  Organizing the fields as an Internal is part of the
+ * PIMPL pattern.
+ */
+struct KVPool::Internal {
+    /** Where the server is, and how to talk to it */
+    kv_options_t opts;
+
+    /** How many connections to keep, and for how long */
+    kv_pool_options_t limits;
+
+    /** Guards everything below */
+    mutex lock;
+
+    /** Wakes acquire() when a lease comes back */
+    condition_variable returned;
+
+    /** The server's address, once it has been resolved (addr_len > 0) */
+    sockaddr_storage addr;
+    socklen_t addr_len = 0;
+
+    /** A connection that nobody has, and when it was given back */
+    struct idle_t {
+        unique_ptr<KVClient> kv;
+        chrono::steady_clock::time_point since;
+    };
+
+    /** The idle connections, most recently returned last */
+    vector<idle_t> idle;
+
+    /** How many connections are leased out */
+    size_t active = 0;
+
+    /** Construct the fields of a pool */
+    Internal(const kv_options_t &opts, const kv_pool_options_t &limits) : opts(opts), limits(limits) {}
+
+    /** Resolve the server's address, and keep it for the next connect */
+    bool resolve(sockaddr_storage &a, socklen_t &len) {
+        bool ok = opts.unix_path.empty() ? resolve_server(opts.server_name, opts.port, a, len)
+                                         : resolve_unix(opts.unix_path, a, len);
+        if (ok) {
+            lock_guard<mutex> guard(lock);
+            addr = a;
+            addr_len = len;
+        }
+        return ok;
+    }
+
+    /**
+     * @brief Make a new connection, from the cached address if there is one.
+     * If that fails, the server may have moved, so resolve it again and retry
+     * once.
+     */
+    unique_ptr<KVClient> open_client() {
+        for (int attempt = 0; attempt < 2; attempt++) {
+            sockaddr_storage a;
+            socklen_t len;
+            {
+                lock_guard<mutex> guard(lock);
+                a = addr;
+                len = attempt == 0 ? addr_len : 0;
+            }
+            if (len == 0 && !resolve(a, len)) return nullptr;
+            int sd = connect_to_addr(a, len);
+            auto kv = make_unique<KVClient>();
+            if (sd >= 0 && kv->attach(sd, opts)) return kv;
+        }
+        return nullptr;
+    }
+};
+
+/** Take over another lease, after giving this one's connection back */
+KVPool::Lease &KVPool::Lease::operator=(Lease &&other) {
+    release();
+    pool = other.pool;
+    kv = move(other.kv);
+    return *this;
+}
+
+/** Give the connection back to the pool, which keeps it if it is healthy */
+void KVPool::Lease::release() {
+    if (kv) pool->give_back(move(kv));
+}
+
+/**
+ * @brief Construct a pool.  No connection is made until one is needed.
+ *
+ * @param opts   Where the server is, and how to talk to it
+ * @param limits How many connections to keep, and for how long
+ */
+KVPool::KVPool(const kv_options_t &opts, const kv_pool_options_t &limits) : fields(new Internal(opts, limits)) {}
+
+/** Close the idle connections */
+KVPool::~KVPool() {}
+
+/**
+ * @brief Take a connection: an idle one that is still healthy, or else a new
+ * one.  Waits while max_active connections are leased out.
+ *
+ * @return The lease, which is empty if a new connection could not be made
+ */
+KVPool::Lease KVPool::acquire() {
+    Internal &f = *fields;
+    Lease lease;
+    lease.pool = this;
+    auto max_idle = chrono::milliseconds(f.limits.idle_ms);
+    unique_lock<mutex> guard(f.lock);
+    f.returned.wait(guard, [&]() { return f.active < max(f.limits.max_active, (size_t)1); });
+    f.active++;
+
+    /* reuse the most recent idle connection that passes its check; the rest wait for later */
+    while (!f.idle.empty()) {
+        Internal::idle_t c = move(f.idle.back());
+        f.idle.pop_back();
+        guard.unlock();
+        bool fresh = chrono::steady_clock::now() - c.since < max_idle;
+        if (fresh && c.kv->healthy()) {
+            lease.kv = move(c.kv);
+            return lease;
+        }
+        // NB: closing joins the connection's threads, so not under the lock
+        c.kv.reset();
+        guard.lock();
+    }
+    guard.unlock();
+
+    lease.kv = f.open_client();
+    if (!lease.kv) {
+        guard.lock();
+        f.active--;
+        f.returned.notify_one();
+    }
+    return lease;
+}
+
+/** Take back a leased connection */
+void KVPool::give_back(unique_ptr<KVClient> kv) {
+    Internal &f = *fields;
+    bool keep = kv->healthy();
+    {
+        lock_guard<mutex> guard(f.lock);
+        f.active--;
+        if (keep && f.idle.size() < f.limits.max_idle) f.idle.push_back({move(kv), chrono::steady_clock::now()});
+    }
+    f.returned.notify_one();
+}
+
+/**
+ * @brief Run one request on a pooled connection and wait for its result,
+ * retrying on a fresh connection if the connection failed
+ *
+ * @param pool    The pool
+ * @param retries How many times to retry
+ * @param op      Makes the request on a connection
+ */
+template <typename F> static kv_result_t run(KVPool &pool, int retries, F op) {
+    kv_result_t res;
+    for (int attempt = 0; attempt <= retries; attempt++) {
+        auto lease = pool.acquire();
+        if (!lease) continue;
+        res = op(*lease).get();
+        if (res.status != ST_FAILED) break;
+        // NB: the failed connection is not healthy, so giving it back drops it
+    }
+    return res;
+}
+
+/** Insert a key/value pair on a pooled connection, and wait for the result */
+kv_result_t KVPool::insert(int key, int val) {
+    return run(*this, fields->limits.retries, [&](KVClient &kv) { return kv.insert(key, val); });
+}
+
+/** Look up a key on a pooled connection, and wait for the result */
+kv_result_t KVPool::get(int key) {
+    return run(*this, fields->limits.retries, [&](KVClient &kv) { return kv.get(key); });
+}
+
+/** Remove a key on a pooled connection, and wait for the result */
+kv_result_t KVPool::remove(int key) {
+    return run(*this, fields->limits.retries, [&](KVClient &kv) { return kv.remove(key); });
+}
@@ -0,0 +1,128 @@
+/**
+ * @file kv_pool.h
+ */
+
+#ifndef KV_POOL_DEF
+#define KV_POOL_DEF
+
+#pragma once
+
+#include <memory>
+
+#include "kv_client.h"
+
+/** Limits of a KVPool */
+struct kv_pool_options_t {
+  /** Most connections leased out at once; acquire() waits beyond that */
+  size_t max_active = 16;
+
+  /** Most connections kept open while nobody has them */
+  size_t max_idle = 4;
+
+  /**
+   * Milliseconds a connection may sit idle before it is closed instead of
+   * reused.  Keep this below the server's idle timeout (-T).
+   */
+  int idle_ms = 30000;
+
+  /** How many times a request that failed with its connection is retried on a new one */
+  int retries = 1;
+};
+
+/**
+ * @brief KVPool shares connections to one server among the threads of an
+ * application.  The server's address is resolved once, so a new connection
+ * costs a connect but no DNS lookup, and is resolved again only when a
+ * connect fails.  Returned connections stay open for the next caller, up to
+ * max_idle of them, so requests in the steady state pay for neither.
+ *
+ * Before a connection is handed out it is checked: one that has been idle too
+ * long, or that the server has closed, is replaced.  insert(), get() and
+ * remove() also retry a request whose connection failed on a fresh one.  A
+ * retried insert or remove may report ST_ERR_KEY, if the first try reached
+ * the server.
+ */
+class KVPool {
+  /**
+   * @brief Internal is the class that stores all the members of a KVPool
+   * object.  To avoid pulling too much into the .h file, we are using the
+   * PIMPL pattern
+   */
+  struct Internal;
+
+  /** A reference to the internal fields of the KVPool object */
+  std::unique_ptr<Internal> fields;
+
+public:
+  /**
+   * @brief Lease is one connection taken from the pool.  It goes back to the
+   * pool when the Lease is destroyed or released.
+   */
+  class Lease {
+  public:
+    /** Construct a lease of nothing */
+    Lease() {}
+
+    Lease(Lease &&other) = default;
+    Lease &operator=(Lease &&other);
+
+    /** Give the connection back to the pool */
+    ~Lease() { release(); }
+
+    /** Is there a connection? */
+    explicit operator bool() const { return kv != nullptr; }
+
+    /** The connection */
+    KVClient &operator*() const { return *kv; }
+    KVClient *operator->() const { return kv.get(); }
+
+    /** Give the connection back to the pool, which keeps it if it is healthy */
+    void release();
+
+  private:
+    friend class KVPool;
+
+    /** The pool the connection goes back to */
+    KVPool *pool = nullptr;
+
+    /** The connection, or nullptr */
+    std::unique_ptr<KVClient> kv;
+  };
+
+  /**
+   * @brief Construct a pool.  No connection is made until one is needed.
+   *
+   * @param opts   Where the server is, and how to talk to it
+   * @param limits How many connections to keep, and for how long
+   */
+  KVPool(const kv_options_t &opts, const kv_pool_options_t &limits = kv_pool_options_t());
+
+  /** Close the idle connections.  Every Lease must be gone by now. */
+  ~KVPool();
+
+  KVPool(const KVPool &) = delete;
+  KVPool &operator=(const KVPool &) = delete;
+
+  /**
+   * @brief Take a connection: an idle one that is still healthy, or else a new
+   * one.  Waits while max_active connections are leased out.
+   *
+   * @return The lease, which is empty if a new connection could not be made
+   */
+  Lease acquire();
+
+  /** Insert a key/value pair on a pooled connection, and wait for the result */
+  kv_result_t insert(int key, int val);
+
+  /** Look up a key on a pooled connection, and wait for the result */
+  kv_result_t get(int key);
+
+  /** Remove a key on a pooled connection, and wait for the result */
+  kv_result_t remove(int key);
+
+private:
+  /** Take back a leased connection */
+  void give_back(std::unique_ptr<KVClient> kv);
+};
+
+#endif
@@ -0,0 +1,434 @@
+/**
+ * @file kvbench.cc
+ *
+ * kvbench is a load generator for the servers, in the style of YCSB: a number
+ * of connections, each driven by a thread of its own with up to depth
+ * requests in flight, issue a mix of reads, inserts and deletes over a key
+ * space, with keys drawn from a uniform, zipfian or sequential distribution.
+ * At the end it reports the throughput, how each kind of request fared, and
+ * the latency percentiles of all requests.
+ *
+ * By default the load is closed-loop: a connection makes its next request as
+ * soon as one of its requests completes.  When the server stalls, so does the
+ * load, and the requests that would have queued up during the stall are never
+ * made, so their latency is never measured (coordinated omission).  With a
+ * rate (-R) the load is open-loop instead: requests are due on a fixed
+ * schedule, whether or not the server keeps up, and latency is measured from
+ * when each was due, so time spent waiting to be sent counts too.
+ *
+ * With a pool (-P) the threads share a KVPool of fewer connections instead of
+ * owning one each: every request leases a connection, waits for its result
+ * and gives the connection back, so its latency includes the wait for a free
+ * connection.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "hdr_histogram.h"
+#include "kv_client.h"
+#include "kv_pool.h"
+#include "protocols.h"
+
+using namespace std;
+
+/**
+ * Configuration information for command-line parameters of the program
+ */
+struct bench_config_t {
+    /** Where the server is, and how to talk to it */
+    kv_options_t server;
+
+    /** Number of connections, each with a thread of its own */
+    int conns = 1;
+
+    /** Requests each connection keeps in flight */
+    int depth = 1;
+
+    /** Connections in a pool shared by the threads, instead of one per thread (0 = no pool) */
+    int pool = 0;
+
+    /** Requests to make in all, unless secs is set */
+    long ops = 100000;
+
+    /** Run for this many seconds instead of a number of requests */
+    double secs = 0;
+
+    /** Requests per second over all connections, for an open-loop run (0 = closed loop) */
+    double rate = 0;
+
+    /** Write the latency distribution to this file, in HdrHistogram's .hgrm format */
+    string hgrm = "";
+
+    /** Percent of requests that are reads and inserts; the rest are deletes */
+    int read_pct = 90;
+    int insert_pct = 5;
+
+    /** The key space: keys key_base .. key_base+keys-1 */
+    int keys = 1000;
+    int key_base = 0;
+
+    /** Key distribution: uniform, zipfian or sequential */
+    string dist = "uniform";
+
+    /** Skew of the zipfian distribution */
+    double theta = 0.99;
+
+    /** Insert every key of the key space before the run */
+    bool load = false;
+
+    /** Is the user requesting a usage message? */
+    bool usage = false;
+};
+
+/** The kinds of request */
+enum op_t { OP_READ, OP_INSERT, OP_DELETE, NUM_OPS };
+
+/** Names of the kinds of request, for the report */
+static const char *OP_NAMES[NUM_OPS] = {"read", "insert", "delete"};
+
+/**
+ * @brief KeyChooser draws keys from the configured distribution.  The zipfian
+ * constants are computed once and shared; each thread draws with its own
+ * random engine.
+ */
+class KeyChooser {
+public:
+    /** Set up the distribution for a configuration */
+    KeyChooser(const bench_config_t &cfg) : n(max(cfg.keys, 1)), base(cfg.key_base), theta(cfg.theta) {
+        kind = cfg.dist == "zipfian" ? ZIPFIAN : cfg.dist == "sequential" ? SEQUENTIAL : UNIFORM;
+        if (kind == ZIPFIAN) {
+            /* Gray et al., "Quickly generating billion-record synthetic databases", as YCSB does */
+            for (long i = 1; i <= n; i++) zetan += 1 / pow((double)i, theta);
+            double zeta2 = 1 + 1 / pow(2.0, theta);
+            alpha = 1 / (1 - theta);
+            eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+        }
+    }
+
+    /** Draw the next key */
+    int next(mt19937_64 &rng) {
+        if (kind == SEQUENTIAL) return base + (int)(seq++ % n);
+        if (kind == UNIFORM) return base + (int)(rng() % n);
+        double u = uniform_real_distribution<double>(0, 1)(rng), uz = u * zetan;
+        long rank = uz < 1 ? 0 : uz < 1 + pow(0.5, theta) ? 1 : (long)(n * pow(eta * u - eta + 1, alpha));
+        /* scramble the ranks, so the hot keys are spread over the key space rather than at its start */
+        uint64_t h = 14695981039346656037ull;
+        for (int i = 0; i < 8; i++, rank >>= 8) h = (h ^ (rank & 0xff)) * 1099511628211ull;
+        return base + (int)(h % n);
+    }
+
+private:
+    /** The distributions */
+    enum { UNIFORM, ZIPFIAN, SEQUENTIAL } kind;
+
+    /** Size and start of the key space */
+    long n;
+    int base;
+
+    /** The zipfian skew and its constants */
+    double theta, zetan = 0, alpha = 0, eta = 0;
+
+    /** The next sequential key, shared by all threads */
+    atomic<long> seq{0};
+};
+
+/** What one connection's thread did */
+struct worker_t {
+    /** The connection, unless the threads share a pool */
+    KVClient kv;
+
+    /** Requests made of each kind, and their statuses (ST_OK, ST_ERR_KEY, ST_ERR_INVALID, failed) */
+    long counts[NUM_OPS][4] = {};
+
+    /** The latencies of the requests, in nanoseconds */
+    HdrHistogram latencies;
+};
+
+/**
+ * Display a help message to explain how the command-line parameters for this
+ * program work
+ */
+void usage() {
+    cout << "  -s [string]  Name of the server (default 'localhost')" << endl;
+    cout << "  -p [int]     Port number of the server" << endl;
+    cout << "  -U [string]  Connect to the server's Unix domain socket at this path instead" << endl;
+    cout << "  -2           Speak the binary protocol v2" << endl;
+    cout << "  -m           Send requests through shared memory (server on the same host)" << endl;
+    cout << "  -b [int]     Batch up to this many requests into one (implies -2)" << endl;
+    cout << "  -c [int]     Number of connections, each with its own thread (default 1)" << endl;
+    cout << "  -d [int]     Requests each connection keeps in flight (default 1)" << endl;
+    cout << "  -P [int]     Share a pool of this many connections among the -c threads, one request at a time each" << endl;
+    cout << "  -n [int]     Requests to make in all (default 100000)" << endl;
+    cout << "  -D [float]   Run for this many seconds instead of -n" << endl;
+    cout << "  -R [float]   Open loop: make this many requests per second in all, on a fixed schedule" << endl;
+    cout << "  -H [string]  Write the latency distribution (.hgrm, in us) to this file" << endl;
+    cout << "  -r [int]     Percent of requests that are reads (default 90)" << endl;
+    cout << "  -i [int]     Percent of requests that are inserts (default 5); the rest are deletes" << endl;
+    cout << "  -k [int]     Number of keys (default 1000)" << endl;
+    cout << "  -K [int]     First key (default 0)" << endl;
+    cout << "  -z [string]  Key distribution: uniform, zipfian or sequential (default uniform)" << endl;
+    cout << "  -Z [float]   Skew of the zipfian distribution (default 0.99)" << endl;
+    cout << "  -l           Insert every key before the run" << endl;
+    cout << "  -h           Print help (this message)" << endl;
+}
+
+/**
+ * Parse the command-line arguments, and use them to populate the provided args
+ * object.
+ *
+ * @param argc The number of command-line arguments passed to the program
+ * @param argv The list of command-line arguments
+ * @param cfg  The struct into which the parsed args should go
+ */
+void parseargs(int argc, char **argv, bench_config_t &cfg) {
+    cfg.server.server_name = "localhost";
+    long opt;
+    while ((opt = getopt(argc, argv, "s:p:U:2mb:c:d:P:n:D:R:H:r:i:k:K:z:Z:lh")) != -1) {
+        switch (opt) {
+            case 's': cfg.server.server_name = string(optarg); break;
+            case 'p': cfg.server.port = atoi(optarg); break;
+            case 'U': cfg.server.unix_path = string(optarg); break;
+            case '2': cfg.server.v2 = true; break;
+            case 'm': cfg.server.shm = true; break;
+            case 'b': cfg.server.batch_ops = atoi(optarg); break;
+            case 'c': cfg.conns = max(1, atoi(optarg)); break;
+            case 'd': cfg.depth = max(1, atoi(optarg)); break;
+            case 'P': cfg.pool = max(0, atoi(optarg)); break;
+            case 'n': cfg.ops = atol(optarg); break;
+            case 'D': cfg.secs = atof(optarg); break;
+            case 'R': cfg.rate = atof(optarg); break;
+            case 'H': cfg.hgrm = string(optarg); break;
+            case 'r': cfg.read_pct = atoi(optarg); break;
+            case 'i': cfg.insert_pct = atoi(optarg); break;
+            case 'k': cfg.keys = max(1, atoi(optarg)); break;
+            case 'K': cfg.key_base = atoi(optarg); break;
+            case 'z': cfg.dist = string(optarg); break;
+            case 'Z': cfg.theta = atof(optarg); break;
+            case 'l': cfg.load = true; break;
+            case 'h': cfg.usage = true; break;
+        }
+    }
+}
+
+/** Pick the kind of the next request from the configured mix */
+static op_t choose_op(const bench_config_t &cfg, mt19937_64 &rng) {
+    int pct = (int)(rng() % 100);
+    return pct < cfg.read_pct ? OP_READ : pct < cfg.read_pct + cfg.insert_pct ? OP_INSERT : OP_DELETE;
+}
+
+/** Make one request of a kind */
+static future<kv_result_t> request(KVClient &kv, op_t op, int key) {
+    if (op == OP_READ) return kv.get(key);
+    if (op == OP_INSERT) return kv.insert(key, key);
+    return kv.remove(key);
+}
+
+/**
+ * @brief Drive one connection until its share of the requests is made, or
+ * the time is up.  Closed-loop, a request is made whenever fewer than depth
+ * are in flight, and its latency runs from then.  Open-loop, request i is due
+ * at start + i * interval; it is made then (or as soon after as depth allows)
+ * and its latency runs from when it was due.
+ *
+ * @param cfg      The configuration
+ * @param keys     The key distribution
+ * @param w        The connection, and where its results go
+ * @param quota    How many requests to make, if the run is not timed
+ * @param interval Time between requests, open-loop (0 = closed loop)
+ * @param seed     Seed for the thread's random engine
+ */
+static void run_worker(const bench_config_t &cfg, KeyChooser &keys, worker_t &w, long quota,
+                       chrono::nanoseconds interval, uint64_t seed) {
+    using clock = chrono::steady_clock;
+    struct inflight_t {
+        op_t op;
+        clock::time_point start;
+        future<kv_result_t> res;
+    };
+    mt19937_64 rng(seed);
+    deque<inflight_t> window;
+    auto begin = clock::now();
+    auto end = begin + chrono::duration_cast<clock::duration>(chrono::duration<double>(cfg.secs));
+    clock::time_point due = begin;
+    long issued = 0;
+    while (true) {
+        clock::time_point now = clock::now();
+        bool more = cfg.secs > 0 ? (interval.count() > 0 ? due : now) < end : issued < quota;
+        bool is_due = interval.count() == 0 || now >= due;
+        /* make every request that is due, as far as depth allows */
+        if (more && is_due && (int)window.size() < cfg.depth) {
+            op_t op = choose_op(cfg, rng);
+            window.push_back({op, interval.count() > 0 ? due : now, request(w.kv, op, keys.next(rng))});
+            due += interval;
+            issued++;
+            continue;
+        }
+        if (window.empty() && !more) break;
+        if (window.empty()) {
+            this_thread::sleep_until(due);
+            continue;
+        }
+        /* wait for the oldest request, but no longer than until the next is due */
+        if (more && (int)window.size() < cfg.depth && interval.count() > 0 &&
+            window.front().res.wait_until(due) != future_status::ready)
+            continue;
+        kv_result_t res = window.front().res.get();
+        w.latencies.record(chrono::duration_cast<chrono::nanoseconds>(clock::now() - window.front().start).count());
+        w.counts[window.front().op][min<int>(res.status, 3)]++;
+        window.pop_front();
+    }
+}
+
+/**
+ * @brief Drive one thread's share of the requests through a pool shared by all
+ * the threads.  Each request waits for a connection and then for its result,
+ * and its latency runs from when it was made (or was due, open-loop) until
+ * the result, so waiting for a connection counts.
+ *
+ * @param cfg      The configuration
+ * @param keys     The key distribution
+ * @param pool     The shared pool
+ * @param w        Where the thread's results go
+ * @param quota    How many requests to make, if the run is not timed
+ * @param interval Time between requests, open-loop (0 = closed loop)
+ * @param seed     Seed for the thread's random engine
+ */
+static void run_pooled_worker(const bench_config_t &cfg, KeyChooser &keys, KVPool &pool, worker_t &w, long quota,
+                              chrono::nanoseconds interval, uint64_t seed) {
+    using clock = chrono::steady_clock;
+    mt19937_64 rng(seed);
+    auto begin = clock::now();
+    auto end = begin + chrono::duration_cast<clock::duration>(chrono::duration<double>(cfg.secs));
+    clock::time_point due = begin;
+    for (long issued = 0; cfg.secs > 0 ? (interval.count() > 0 ? due : clock::now()) < end : issued < quota;
+         issued++) {
+        if (interval.count() > 0) this_thread::sleep_until(due);
+        clock::time_point start = interval.count() > 0 ? due : clock::now();
+        due += interval;
+        op_t op = choose_op(cfg, rng);
+        int key = keys.next(rng);
+        kv_result_t res = op == OP_READ ? pool.get(key) : op == OP_INSERT ? pool.insert(key, key) : pool.remove(key);
+        w.latencies.record(chrono::duration_cast<chrono::nanoseconds>(clock::now() - start).count());
+        w.counts[op][min<int>(res.status, 3)]++;
+    }
+}
+
+/** Insert every key of the key space, pipelined on one connection */
+static void load_keys(const bench_config_t &cfg, KVClient &kv) {
+    deque<future<kv_result_t>> window;
+    for (int i = 0; i < cfg.keys; i++) {
+        window.push_back(kv.insert(cfg.key_base + i, cfg.key_base + i));
+        if (window.size() >= 256) {
+            window.front().get();
+            window.pop_front();
+        }
+    }
+    for (auto &f : window) f.get();
+}
+
+/**
+ * Main function
+ */
+int main(int argc, char **argv) {
+    bench_config_t cfg;
+    parseargs(argc, argv, cfg);
+    if (cfg.usage || (cfg.server.port == 0 && cfg.server.unix_path.empty())) {
+        usage();
+        exit(0);
+    }
+
+    /* connect everything first, so that connecting is not part of the run */
+    vector<worker_t> workers(cfg.conns);
+    unique_ptr<KVPool> pool;
+    if (cfg.pool > 0) {
+        kv_pool_options_t limits;
+        limits.max_active = limits.max_idle = cfg.pool;
+        pool = make_unique<KVPool>(cfg.server, limits);
+        /* fill the pool: take every connection at once, then give them all back */
+        vector<KVPool::Lease> leases;
+        for (int i = 0; i < cfg.pool; i++) {
+            leases.push_back(pool->acquire());
+            if (!leases.back()) {
+                cout << "Server refused the connection" << endl;
+                exit(1);
+            }
+        }
+        if (cfg.load) load_keys(cfg, *leases[0]);
+    } else {
+        for (auto &w : workers) {
+            if (!w.kv.connect(cfg.server)) {
+                cout << "Server refused the connection" << endl;
+                exit(1);
+            }
+        }
+        if (cfg.load) load_keys(cfg, workers[0].kv);
+    }
+
+    KeyChooser keys(cfg);
+    vector<thread> threads;
+    /* each connection takes an equal share of the rate */
+    chrono::nanoseconds interval(cfg.rate > 0 ? (long)(1e9 * cfg.conns / cfg.rate) : 0);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < cfg.conns; i++) {
+        long quota = cfg.ops / cfg.conns + (i < cfg.ops % cfg.conns ? 1 : 0);
+        uint64_t seed = (uint64_t)getpid() * 7919 + i;
+        if (pool)
+            threads.emplace_back(run_pooled_worker, cref(cfg), ref(keys), ref(*pool), ref(workers[i]), quota,
+                                 interval, seed);
+        else
+            threads.emplace_back(run_worker, cref(cfg), ref(keys), ref(workers[i]), quota, interval, seed);
+    }
+    for (auto &t : threads) t.join();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    /* merge what the connections did */
+    long counts[NUM_OPS][4] = {};
+    HdrHistogram all;
+    for (auto &w : workers) {
+        for (int op = 0; op < NUM_OPS; op++)
+            for (int s = 0; s < 4; s++) counts[op][s] += w.counts[op][s];
+        all.add(w.latencies);
+        w.kv.close();
+    }
+
+    if (pool)
+        cout << "kvbench: " << cfg.conns << " threads sharing " << cfg.pool << " pooled connections, ";
+    else
+        cout << "kvbench: " << cfg.conns << " connections x depth " << cfg.depth << ", ";
+    cout << cfg.read_pct << "/"
+         << cfg.insert_pct << "/" << 100 - cfg.read_pct - cfg.insert_pct << " read/insert/delete, " << cfg.keys
+         << " keys " << cfg.dist << endl;
+    cout << fixed << setprecision(1);
+    if (cfg.rate > 0) cout << "open loop at " << cfg.rate << " ops/s, latency from when each request was due" << endl;
+    cout << "ops " << all.count() << " in " << secs << " s: " << (secs > 0 ? all.count() / secs : 0) << " ops/s"
+         << endl;
+    long failed = 0;
+    for (int op = 0; op < NUM_OPS; op++) {
+        long total = counts[op][0] + counts[op][1] + counts[op][2] + counts[op][3];
+        cout << "  " << setw(6) << left << OP_NAMES[op] << right << " " << total << ": " << RES_OK << " "
+             << counts[op][ST_OK] << ", " << RES_ERR_KEY << " " << counts[op][ST_ERR_KEY] << ", "
+             << RES_ERR_INVALID << " " << counts[op][ST_ERR_INVALID] << endl;
+        failed += counts[op][3];
+    }
+    if (failed > 0) cout << "  failed " << failed << endl;
+    cout << "latency us: p50 " << all.value_at_percentile(50) / 1000.0 << " p99 "
+         << all.value_at_percentile(99) / 1000.0 << " p999 " << all.value_at_percentile(99.9) / 1000.0 << " max "
+         << all.max() / 1000.0 << " mean " << all.mean() / 1000 << endl;
+    if (!cfg.hgrm.empty()) {
+        ofstream out(cfg.hgrm);
+        all.print_percentiles(out, 1000);
+    }
+    return failed > 0 ? 1 : 0;
+}
@@ -3,7 +3,10 @@
  * @file net.cc
  */
 
+#include <sys/un.h>
+
 #include "net.h"
+#include "protocols.h"
 #include "vec.h"
 
 /**
@@ -56,6 +59,103 @@ int connect_to_server(std::string hostname, std::size_t port) {
   return sd;
 }
 
+/**
+ * @brief Connect to a server's Unix domain socket, which is cheaper than TCP
+ * for a server on the same host
+ * 
+ * @param path The file system path of the server's socket
+ * @return     int 
+ */
+int connect_to_unix(const string &path) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    error_message_and_exit(0, ENAMETOOLONG, "Error making client socket: ");
+  }
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+  int sd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sd < 0) {
+    error_message_and_exit(0, errno, "Error making client socket: ");
+  }
+  if (connect(sd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(sd);
+    error_message_and_exit(0, errno, "Error connecting socket to address: ");
+  }
+  return sd;
+}
+
+/**
+ * @brief Look up a server's address, so that it can be connected to later
+ * without another DNS lookup
+ * 
+ * @param name The name of the server (ip or DNS)
+ * @param port The server's port
+ * @param addr Set to the server's address
+ * @param len  Set to the length of the address
+ * @return     false if the name could not be resolved
+ */
+bool resolve_server(const string &name, size_t port, sockaddr_storage &addr, socklen_t &len) {
+  // NB: getaddrinfo() rather than gethostbyname(), because a pool may resolve
+  //     from several threads at once
+  addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  int err = getaddrinfo(name.c_str(), to_string(port).c_str(), &hints, &res);
+  if (err != 0) {
+    cerr << "resolve_server(): DNS error: " << gai_strerror(err) << endl;
+    return false;
+  }
+  memcpy(&addr, res->ai_addr, res->ai_addrlen);
+  len = res->ai_addrlen;
+  freeaddrinfo(res);
+  return true;
+}
+
+/**
+ * @brief Make the address of a server's Unix domain socket, for
+ * connect_to_addr()
+ * 
+ * @param path The file system path of the server's socket
+ * @param addr Set to the socket's address
+ * @param len  Set to the length of the address
+ * @return     false if the path is too long
+ */
+bool resolve_unix(const string &path, sockaddr_storage &addr, socklen_t &len) {
+  sockaddr_un *un = (sockaddr_un *)&addr;
+  if (path.size() >= sizeof(un->sun_path)) {
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  un->sun_family = AF_UNIX;
+  strncpy(un->sun_path, path.c_str(), sizeof(un->sun_path) - 1);
+  len = sizeof(sockaddr_un);
+  return true;
+}
+
+/**
+ * @brief Connect to an address from resolve_server() or resolve_unix()
+ * 
+ * @param addr The server's address
+ * @param len  The length of the address
+ * @return     The socket, or -1 on error
+ */
+int connect_to_addr(const sockaddr_storage &addr, socklen_t len) {
+  int sd = socket(addr.ss_family, SOCK_STREAM, 0);
+  if (sd < 0) {
+    sys_error(errno, "Error making client socket:");
+    return -1;
+  }
+  if (connect(sd, (const sockaddr *)&addr, len) < 0) {
+    sys_error(errno, "Error connecting socket to address:");
+    close(sd);
+    return -1;
+  }
+  return sd;
+}
+
 /**
  * @brief Print an error message that combines some application-specific text with 
  * the standard unix error message that accompanies errno.
@@ -82,9 +182,10 @@ bool reliable_send(int sd, const unsigned char *bytes, int len) {
   const unsigned char *next_byte = bytes;
   int remain = len;
   while (remain) {
-    int sent = send(sd, next_byte, remain, 0);
+    int sent = send(sd, next_byte, remain, MSG_NOSIGNAL);
     // NB: Sending 0 bytes means the server closed the socket, and we should
-    //     fail, so it's only EINTR that is recoverable.
+    //     fail, so it's only EINTR that is recoverable.  MSG_NOSIGNAL makes a
+    //     closed socket an error instead of a SIGPIPE that kills the client.
     if (sent <= 0) {
       if (errno != EINTR) {
         sys_error(errno, "Error in send():");
@@ -116,7 +217,8 @@ bool send_reliably(int sd, const vec &msg) {
  * @return A vector with the data that was read, or an empty vector on error 
  */
 vec reliable_get_to_eof(int sd) {
-  vec res(16);
+  // big enough that most responses need one recv()
+  vec res(4096);
   int recd = 0;
   while (true) {
     int remain = res.size() - recd;
@@ -139,3 +241,57 @@ vec reliable_get_to_eof(int sd) {
     }
   }
 }
+
+/**
+ * @brief Read exactly len bytes, so that whatever follows them stays in the
+ * socket
+ * 
+ * @param sd  The socket from which to read
+ * @param buf Where the bytes should go
+ * @param len The number of bytes to read
+ * @return false if the socket closed or failed first, true otherwise
+ */
+static bool recv_exactly(int sd, unsigned char *buf, size_t len) {
+  size_t got = 0;
+  while (got < len) {
+    int rcd = recv(sd, buf + got, len - got, 0);
+    if (rcd == 0) {
+      return false;
+    }
+    else if (rcd < 0) {
+      if (errno != EINTR) {
+        sys_error(errno, "Error in recv():");
+        return false;
+      }
+    }
+    else {
+      got += rcd;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Read one response from a persistent connection: a status byte, a
+ * 4-byte length, then that many bytes of payload
+ * 
+ * @param sd     The socket from which to read
+ * @param status Set to the status byte of the response
+ * @param res    The vector into which the payload should go
+ * @return false if the socket closed or failed before a whole response
+ *         arrived, true otherwise
+ */
+bool reliable_get_framed(int sd, unsigned char &status, vec &res) {
+  unsigned char head[LEN_FRAME];
+  if (!recv_exactly(sd, head, LEN_FRAME)) {
+    return false;
+  }
+  status = head[0];
+  int n;
+  memcpy(&n, head + 1, sizeof(int));
+  if (n < 0) {
+    return false;
+  }
+  res.resize(n);
+  return recv_exactly(sd, res.data(), n);
+}
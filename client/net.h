@@ -48,6 +48,48 @@ void sys_error(int err, const char *prefix);
  */
 int connect_to_server(string name, size_t port);
 
+/**
+ * @brief Connect to a server's Unix domain socket, which is cheaper than TCP
+ * for a server on the same host
+ * 
+ * @param path The file system path of the server's socket
+ * @return     int 
+ */
+int connect_to_unix(const string &path);
+
+/**
+ * @brief Look up a server's address, so that it can be connected to later
+ * without another DNS lookup.  Unlike connect_to_server(), errors are returned
+ * rather than ending the program.
+ * 
+ * @param name The name of the server (ip or DNS)
+ * @param port The server's port
+ * @param addr Set to the server's address
+ * @param len  Set to the length of the address
+ * @return     false if the name could not be resolved
+ */
+bool resolve_server(const string &name, size_t port, sockaddr_storage &addr, socklen_t &len);
+
+/**
+ * @brief Make the address of a server's Unix domain socket, for
+ * connect_to_addr()
+ * 
+ * @param path The file system path of the server's socket
+ * @param addr Set to the socket's address
+ * @param len  Set to the length of the address
+ * @return     false if the path is too long
+ */
+bool resolve_unix(const string &path, sockaddr_storage &addr, socklen_t &len);
+
+/**
+ * @brief Connect to an address from resolve_server() or resolve_unix()
+ * 
+ * @param addr The server's address
+ * @param len  The length of the address
+ * @return     The socket, or -1 on error
+ */
+int connect_to_addr(const sockaddr_storage &addr, socklen_t len);
+
 /**
  * @brief Send a vector of data over a socket
  * 
@@ -75,4 +117,16 @@ bool reliable_send(int sd, const unsigned char *bytes, int len);
  */
 vec reliable_get_to_eof(int sd);
 
+/**
+ * @brief Read one response from a persistent connection: a status byte, a
+ * 4-byte length, then that many bytes of payload
+ * 
+ * @param sd     The socket from which to read
+ * @param status Set to the status byte of the response
+ * @param res    The vector into which the payload should go
+ * @return false if the socket closed or failed before a whole response
+ *         arrived, true otherwise
+ */
+bool reliable_get_framed(int sd, unsigned char &status, vec &res);
+
 #endif
\ No newline at end of file
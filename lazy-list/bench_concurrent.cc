@@ -0,0 +1,14 @@
+/**
+ * @file bench_concurrent.cc
+ *
+ * Micro-benchmark of the concurrent lazy list, which the backup server uses.
+ */
+
+#include <iostream>
+
+#include "concurrent_lazy_list.h"
+#include "lazy_list_bench.h"
+
+int main(int argc, char **argv) {
+    return bench_main<lazyList<int, int>>(argc, argv, "concurrent", true);
+}
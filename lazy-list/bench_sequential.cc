@@ -0,0 +1,16 @@
+/**
+ * @file bench_sequential.cc
+ *
+ * Micro-benchmark of the sequential lazy list, which the primary server uses.
+ * It is not thread-safe, so with more than one thread it runs under a
+ * reader/writer lock, as it does in the primary.
+ */
+
+#include <iostream>
+
+#include "sequential_lazy_list.h"
+#include "lazy_list_bench.h"
+
+int main(int argc, char **argv) {
+    return bench_main<lazyList<int, int>>(argc, argv, "sequential", false);
+}
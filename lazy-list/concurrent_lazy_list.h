@@ -17,6 +17,9 @@
 #include <sys/time.h>
 #include <time.h>
 #include <stdint.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
 
 #define VAL_MIN INT_MIN
 #define VAL_MAX INT_MAX
@@ -29,6 +32,12 @@ typedef pthread_mutex_t ptlock_t;
 #  define LOCK(lock)					pthread_mutex_lock((pthread_mutex_t *) lock)
 #  define UNLOCK(lock)					pthread_mutex_unlock((pthread_mutex_t *) lock)
 
+#  define EPOCH_LOAD(e)					__atomic_load_n(e, __ATOMIC_SEQ_CST)
+#  define EPOCH_STORE(e, v)				__atomic_store_n(e, v, __ATOMIC_SEQ_CST)
+
+/** Epoch of a node whose insert or delete is in the middle of being tagged */
+#define EPOCH_PENDING UINT64_MAX
+
 
 template <typename K, typename V>
 class lazyList {
@@ -41,6 +50,9 @@ class lazyList {
         val_t val;
         struct node_l *next;
         volatile ptlock_t lock;
+        /** epoch in which the node was inserted, and deleted (0 if live) */
+        volatile uint64_t ins_epoch;
+        volatile uint64_t del_epoch;
     } node_l_t;
 
     /** intset_l struct represents head of lazy list */
@@ -51,10 +63,26 @@ class lazyList {
     /** Pointer to intset_l struct */
     intset_l_t *set;
 
+    /** Current epoch.  Each snapshot moves it forward by one. */
+    volatile uint64_t epoch = 1;
+
+    /** Epoch of the snapshot in progress, or 0 if there is none */
+    volatile uint64_t snap_epoch = 0;
+
+    /** Only one snapshot is taken at a time */
+    ptlock_t snap_lock;
+
+    /** Nodes unlinked while a snapshot was running, and the lock protecting them */
+    std::vector<node_l_t *> snap_dead;
+    ptlock_t dead_lock;
+
 public: 
 
 /** Default constructor */
-lazyList() {}
+lazyList() {
+    INIT_LOCK(&snap_lock);
+    INIT_LOCK(&dead_lock);
+}
 
 /** Initialize lazy list */
 void initialize() {
@@ -72,6 +100,8 @@ node_l_t *new_node_l(val_t key, val_t val, node_l_t *next, int transactional) {
     node_l->key = key;
     node_l->val = val;
     node_l->next = next;
+    node_l->ins_epoch = 0;
+    node_l->del_epoch = 0;
     INIT_LOCK(&node_l->lock);	
 
     return node_l;
@@ -181,7 +211,9 @@ int parse_insert(val_t key, val_t val) {
         result = (validated && notVal);
         if (result) {
             newnode = new_node_l(key, val, curr, 0);
+            newnode->ins_epoch = EPOCH_PENDING;
             pred->next = newnode;
+            EPOCH_STORE(&newnode->ins_epoch, EPOCH_LOAD(&epoch));
         } 
         UNLOCK(&curr->lock);
 		UNLOCK(&pred->lock);
@@ -215,6 +247,7 @@ int parse_delete(val_t key) {
         isVal = key == curr->key;
         result = validated && isVal;
         if (result) {
+            tag_delete(curr);
             curr->next = get_marked_ref(curr->next);
             pred->next = get_unmarked_ref(curr->next);
         }
@@ -224,6 +257,91 @@ int parse_delete(val_t key) {
             return result;
     }
 }
+
+/*
+* Wait out the short window in which an insert or delete has linked or
+* marked a node but not yet stamped its epoch.
+*/
+inline uint64_t wait_epoch(volatile uint64_t *e) {
+    uint64_t v;
+    while ((v = EPOCH_LOAD(e)) == EPOCH_PENDING)
+        ;
+    return v;
+}
+
+/*
+* A node belongs to the snapshot taken at epoch e if it was inserted no later
+* than e, and was not deleted by then.
+*/
+inline int visible_at(node_l_t *node, uint64_t e) {
+    if (wait_epoch(&node->ins_epoch) > e)
+        return 0;
+    uint64_t del = wait_epoch(&node->del_epoch);
+    return del == 0 || del > e;
+}
+
+/*
+* Stamp the delete epoch of a node, with both its lock and its predecessor's
+* held.  If a snapshot is running that still needs the node, remember it
+* before it is unlinked, since the snapshot's traversal may not reach it.
+*/
+void tag_delete(node_l_t *node) {
+    EPOCH_STORE(&node->del_epoch, EPOCH_PENDING);
+    uint64_t d = EPOCH_LOAD(&epoch);
+    EPOCH_STORE(&node->del_epoch, d);
+    uint64_t s = EPOCH_LOAD(&snap_epoch);
+    if (s != 0 && d > s && node->ins_epoch <= s) {
+        LOCK(&dead_lock);
+        snap_dead.push_back(node);
+        UNLOCK(&dead_lock);
+    }
+}
+
+/*
+* Take a point-in-time image of the list without stopping writers.  The
+* snapshot closes the current epoch, then walks the list keeping the nodes
+* that were live at that epoch.  Nodes deleted while the walk is running are
+* handed over by tag_delete().  Deleted nodes are never freed (see
+* parse_delete()), so the walk can safely pass over them.
+*
+* Returns the key/value pairs in key order.
+*/
+std::vector<std::pair<val_t, val_t>> snapshot() {
+    LOCK(&snap_lock);
+    LOCK(&dead_lock);
+    snap_dead.clear();
+    UNLOCK(&dead_lock);
+    uint64_t e = EPOCH_LOAD(&epoch);
+    EPOCH_STORE(&snap_epoch, e);
+    EPOCH_STORE(&epoch, e + 1);
+
+    std::vector<node_l_t *> nodes;
+    node_l_t *node = get_unmarked_ref(set->head->next);
+    while (node->next != NULL) {
+        if (visible_at(node, e))
+            nodes.push_back(node);
+        node = get_unmarked_ref(node->next);
+    }
+    LOCK(&dead_lock);
+    for (node_l_t *dead : snap_dead) {
+        if (visible_at(dead, e))
+            nodes.push_back(dead);
+    }
+    snap_dead.clear();
+    UNLOCK(&dead_lock);
+    EPOCH_STORE(&snap_epoch, 0);
+    UNLOCK(&snap_lock);
+
+    /* a node can be both walked and handed over, so drop duplicates */
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+    std::vector<std::pair<val_t, val_t>> image;
+    image.reserve(nodes.size());
+    for (node_l_t *n : nodes)
+        image.push_back({n->key, n->val});
+    std::sort(image.begin(), image.end());
+    return image;
+}
 };
 
 #endif
\ No newline at end of file
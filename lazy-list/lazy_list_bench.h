@@ -0,0 +1,232 @@
+/**
+ * @file lazy_list_bench.h
+ *
+ * The body of the lazy list micro-benchmarks.  Both lazy list headers define
+ * the same class, so each benchmark is its own program: it includes one of
+ * them, then this file, and calls bench_main() with the class.
+ */
+
+#ifndef LAZY_LIST_BENCH_DEF
+#define LAZY_LIST_BENCH_DEF
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <libgen.h>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/** The settings of one benchmark run */
+struct bench_config_t {
+    /** The key-set sizes to sweep */
+    std::vector<int> sizes = {100, 1000, 10000};
+
+    /** The percentages of finds to sweep; the rest are inserts and deletes */
+    std::vector<int> read_pcts = {100, 90, 50};
+
+    /** Sweep 1, 2, 4, ... up to this many threads */
+    int max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    /** How long to measure each point, in milliseconds */
+    int duration_ms = 1000;
+
+    /** Print JSON instead of CSV */
+    bool json = false;
+};
+
+/** The outcome of one point of the sweep */
+struct bench_result_t {
+    int size, read_pct, threads;
+    uint64_t finds = 0, inserts = 0, deletes = 0;
+    double secs = 0;
+};
+
+/** Print the help message */
+inline void bench_usage(const char *progname) {
+    std::cout << progname << ": micro-benchmark of one lazy list implementation" << std::endl;
+    std::cout << "  -k [list]  Comma-separated key-set sizes (default 100,1000,10000)" << std::endl;
+    std::cout << "  -r [list]  Comma-separated percentages of finds (default 100,90,50)" << std::endl;
+    std::cout << "  -t [int]   Sweep 1, 2, 4, ... up to this many threads (default: #cores)" << std::endl;
+    std::cout << "  -d [int]   Milliseconds to measure each point (default 1000)" << std::endl;
+    std::cout << "  -j         Print JSON instead of CSV" << std::endl;
+    std::cout << "  -h         Print help (this message)" << std::endl;
+}
+
+/** Parse a comma-separated list of non-negative ints, or return an empty list if it is bad */
+inline std::vector<int> bench_parse_list(const char *arg) {
+    std::vector<int> out;
+    std::stringstream ss(arg);
+    std::string item;
+    while (getline(ss, item, ',')) {
+        int v = atoi(item.c_str());
+        if (v <= 0 && item != "0") return {};
+        out.push_back(v);
+    }
+    return out;
+}
+
+/**
+ * @brief Run one point of the sweep on a fresh list: fill it with size keys,
+ * then have each thread do random operations until the time is up.
+ *
+ * The keys come from [0, 2 * size), and updates are half inserts and half
+ * deletes, so the list stays near size keys and about half the finds hit.  A
+ * list that is not thread-safe is guarded the way the primary guards its
+ * store, with a reader/writer lock.
+ */
+template <typename List>
+bench_result_t bench_point(const bench_config_t &cfg, bool thread_safe, int size, int read_pct, int threads) {
+    List list;
+    {
+        /* initialize() announces itself on cout, which would break the CSV */
+        std::streambuf *out = std::cout.rdbuf(nullptr);
+        list.initialize();
+        std::cout.rdbuf(out);
+    }
+    /* insert from the largest key down, so each insert is at the head */
+    for (int k = 2 * (size - 1); k >= 0; k -= 2) list.parse_insert(k, k);
+
+    std::shared_mutex lock;
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false), stop(false);
+    std::vector<bench_result_t> counts(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            std::mt19937 rng(t * 7919 + size);
+            std::uniform_int_distribution<int> key_of(0, 2 * size - 1), pct_of(0, 99);
+            bench_result_t &c = counts[t];
+            ready++;
+            while (!go) std::this_thread::yield();
+            while (!stop.load(std::memory_order_relaxed)) {
+                int key = key_of(rng);
+                if (pct_of(rng) < read_pct) {
+                    if (thread_safe) {
+                        list.parse_find(key);
+                    } else {
+                        std::shared_lock<std::shared_mutex> guard(lock);
+                        list.parse_find(key);
+                    }
+                    c.finds++;
+                } else if (key & 1) {
+                    if (thread_safe) {
+                        list.parse_insert(key, key);
+                    } else {
+                        std::unique_lock<std::shared_mutex> guard(lock);
+                        list.parse_insert(key, key);
+                    }
+                    c.inserts++;
+                } else {
+                    if (thread_safe) {
+                        list.parse_delete(key);
+                    } else {
+                        std::unique_lock<std::shared_mutex> guard(lock);
+                        list.parse_delete(key);
+                    }
+                    c.deletes++;
+                }
+            }
+        });
+    }
+    while (ready < threads) std::this_thread::yield();
+    auto start = std::chrono::steady_clock::now();
+    go = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(cfg.duration_ms));
+    stop = true;
+    for (auto &w : workers) w.join();
+    auto end = std::chrono::steady_clock::now();
+    list.set_delete_l();
+
+    bench_result_t res{size, read_pct, threads};
+    for (auto &c : counts) {
+        res.finds += c.finds;
+        res.inserts += c.inserts;
+        res.deletes += c.deletes;
+    }
+    res.secs = std::chrono::duration<double>(end - start).count();
+    return res;
+}
+
+/** Print one result, as a CSV line or a JSON object */
+inline void bench_print(const bench_config_t &cfg, const char *impl, const bench_result_t &r, bool first) {
+    uint64_t ops = r.finds + r.inserts + r.deletes;
+    double rate = r.secs > 0 ? ops / r.secs : 0;
+    double ns = ops > 0 ? r.secs * 1e9 * r.threads / ops : 0;
+    if (cfg.json) {
+        std::cout << (first ? "[\n" : ",\n") << "  {\"impl\": \"" << impl << "\", \"keys\": " << r.size
+                  << ", \"read_pct\": " << r.read_pct << ", \"threads\": " << r.threads << ", \"ops\": " << ops
+                  << ", \"finds\": " << r.finds << ", \"inserts\": " << r.inserts << ", \"deletes\": " << r.deletes
+                  << ", \"secs\": " << r.secs << ", \"ops_per_sec\": " << (uint64_t)rate
+                  << ", \"ns_per_op\": " << ns << "}";
+    } else {
+        if (first) std::cout << "impl,keys,read_pct,threads,ops,finds,inserts,deletes,secs,ops_per_sec,ns_per_op\n";
+        std::cout << impl << "," << r.size << "," << r.read_pct << "," << r.threads << "," << ops << ","
+                  << r.finds << "," << r.inserts << "," << r.deletes << "," << r.secs << ","
+                  << (uint64_t)rate << "," << ns << "\n";
+    }
+    std::cout.flush();
+}
+
+/**
+ * @brief Parse the command line, then sweep key-set size, read percentage and
+ * thread count, printing one result per point
+ *
+ * @param impl        The name of the implementation, for the output
+ * @param thread_safe True if the list may be used by many threads at once
+ */
+template <typename List> int bench_main(int argc, char **argv, const char *impl, bool thread_safe) {
+    bench_config_t cfg;
+    long opt;
+    while ((opt = getopt(argc, argv, "k:r:t:d:jh")) != -1) {
+        switch (opt) {
+        case 'k':
+            cfg.sizes = bench_parse_list(optarg);
+            break;
+        case 'r':
+            cfg.read_pcts = bench_parse_list(optarg);
+            break;
+        case 't':
+            cfg.max_threads = atoi(optarg);
+            break;
+        case 'd':
+            cfg.duration_ms = atoi(optarg);
+            break;
+        case 'j':
+            cfg.json = true;
+            break;
+        default:
+            bench_usage(basename(argv[0]));
+            exit(0);
+        }
+    }
+    bool bad = cfg.sizes.empty() || cfg.read_pcts.empty() || cfg.max_threads < 1 || cfg.duration_ms < 1;
+    for (int size : cfg.sizes) bad = bad || size < 1;
+    for (int pct : cfg.read_pcts) bad = bad || pct > 100;
+    if (bad) {
+        bench_usage(basename(argv[0]));
+        exit(1);
+    }
+
+    std::vector<int> thread_counts;
+    for (int t = 1; t < cfg.max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(cfg.max_threads);
+
+    bool first = true;
+    for (int size : cfg.sizes)
+        for (int pct : cfg.read_pcts)
+            for (int threads : thread_counts) {
+                bench_print(cfg, impl, bench_point<List>(cfg, thread_safe, size, pct, threads), first);
+                first = false;
+            }
+    if (cfg.json) std::cout << (first ? "[]\n" : "\n]\n");
+    return 0;
+}
+
+#endif
@@ -25,6 +25,36 @@ struct config_t {
      * Datafile persisting the lazy list
      */
     std::string datafile = "";
+
+    /**
+     * Optional memory-mapped index file served in place of the lazy list
+     */
+    std::string indexfile = "";
+
+    /**
+     * Number of reactor threads, each with its own listening socket.  With a
+     * backup attached, an update holds its reactor's thread for a round trip
+     * to the backup, and those round trips go one at a time in log order, so
+     * more reactors raise read throughput but not update throughput.
+     */
+    int reactors = 1;
+
+    /** Pin each reactor thread to its own core */
+    bool pin = false;
+
+    /** Serve clients with io_uring instead of epoll */
+    bool uring = false;
+
+    /** Also listen on a Unix domain socket at this path, for local clients */
+    std::string unix_path = "";
+
+    /** Serve Prometheus metrics on this port, or on a Unix domain socket at this path (0 and "" = not at all) */
+    size_t admin_port = 0;
+    std::string admin_path = "";
+
+    /** Seconds a client may wait between requests, or stall part way through one (0 = forever) */
+    int idle_timeout = 60;
+    int io_timeout = 10;
 };
 
 #endif
\ No newline at end of file
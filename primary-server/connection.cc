@@ -0,0 +1,493 @@
+/**
+ * @file connection.cc
+ */
+
+#include <cstring>
+#include <endian.h>
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "connection.h"
+#include "net.h"
+#include "protocol.h"
+
+using namespace std;
+
+/** Most segments to gather into one sendmsg() */
+const int MAX_IOV = 256;
+
+/** The frame of a response without a payload, for each status */
+static const unsigned char STATUS_FRAMES[][LEN_FRAME] = {
+    {ST_OK, 0, 0, 0, 0}, {ST_ERR_KEY, 0, 0, 0, 0}, {ST_ERR_INVALID, 0, 0, 0, 0}};
+
+/** The text of a response without a payload on a one-shot connection, for each status */
+static const string *STATUS_TEXT[] = {&RES_OK, &RES_ERR_KEY, &RES_ERR_INVALID};
+
+/** Does a response hold exactly the given text? */
+static bool same(const vec &res, const string &text) {
+    return res.size() == text.size() && memcmp(res.data(), text.data(), text.size()) == 0;
+}
+
+/**
+ * @brief Construct a connection for a socket.  The connection owns the
+ * socket, and closes it when destroyed.
+ *
+ * @param sd The socket, which should already be non-blocking
+ */
+Connection::Connection(int sd) : sd(sd) {
+    timer.id = sd;
+    stat_add(STAT_CONN_OPENED);
+}
+
+/** Close the socket, and any file still being sent */
+Connection::~Connection() {
+    stat_add(STAT_CONN_CLOSED);
+    // NB: ignore errors in close()
+    if (file_fd >= 0)
+        close(file_fd);
+    close(sd);
+}
+
+/**
+ * @brief Read as much of the request as the socket has available.  Bytes are
+ * received a chunk at a time into the connection's input buffer, and requests
+ * are parsed from there, so a burst of pipelined requests costs one recv().
+ * Stops as soon as one request is READY; call again for the next one, which
+ * may already be buffered.
+ *
+ * @return false if the peer closed the socket or sent a bad header, or on
+ *         an error, true otherwise
+ */
+bool Connection::on_readable() {
+    while (reading()) {
+        /* parse what is already buffered */
+        if (in_off < in_len) {
+            ssize_t used = feed(inbuf.data() + in_off, in_len - in_off);
+            if (used < 0)
+                return false;
+            in_off += used;
+            continue;
+        }
+
+        /* a large body goes straight to its place, anything else through the buffer */
+        unsigned char *next_byte;
+        size_t remain;
+        if (state == READ_BODY && body.size() - got >= READ_CHUNK) {
+            next_byte = body.data() + got;
+            remain = body.size() - got;
+        } else {
+            inbuf.resize(READ_CHUNK);
+            in_off = in_len = 0;
+            next_byte = inbuf.data();
+            remain = READ_CHUNK;
+        }
+        ssize_t rcd = recv(sd, next_byte, remain, 0);
+        if (rcd <= 0) {
+            if (rcd < 0 && errno == EINTR)
+                continue;
+            if (rcd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return true;
+            // a persistent client may close between requests
+            if (rcd == 0 && state == READ_HEADER && got == 0 && persistent) {
+                state = DONE;
+                return true;
+            }
+            // EOF before the request was complete, or an error
+            if (rcd < 0)
+                sys_error(errno, "Error in recv():");
+            return false;
+        }
+        if (next_byte == inbuf.data()) {
+            in_len = rcd;
+        } else {
+            got += rcd;
+            if (got == body.size())
+                body_done(lat_now());
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Write as much of the response as the socket will take
+ *
+ * @return false on an error, true otherwise
+ */
+bool Connection::on_writable() {
+    while (pending()) {
+        ssize_t sent;
+        if (seg_idx < segs.size()) {
+            /* gather every queued segment into one call */
+            iovec iov[MAX_IOV];
+            int n = 0;
+            for (size_t i = seg_idx; i < segs.size() && n < MAX_IOV; i++, n++) {
+                const segment_t &seg = segs[i];
+                const unsigned char *base = seg.base ? seg.base : arena.data() + seg.off;
+                size_t skip = i == seg_idx ? seg_off : 0;
+                iov[n].iov_base = (void *)(base + skip);
+                iov[n].iov_len = seg.len - skip;
+            }
+            msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = n;
+            sent = sendmsg(sd, &msg, MSG_NOSIGNAL);
+        } else {
+            sent = sendfile(sd, file_fd, &file_off, file_remain);
+        }
+        if (sent <= 0) {
+            if (sent < 0 && errno == EINTR)
+                continue;
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                /* the queue may never drain all the way, so drop what has gone out */
+                compact();
+                return true;
+            }
+            if (sent < 0)
+                sys_error(errno, "Error in send():");
+            return false;
+        }
+        if (seg_idx < segs.size()) {
+            queued -= sent;
+            size_t left = sent;
+            while (left > 0) {
+                size_t rest = segs[seg_idx].len - seg_off;
+                if (left < rest) {
+                    seg_off += left;
+                    break;
+                }
+                left -= rest;
+                seg_idx++;
+                seg_off = 0;
+            }
+        } else {
+            file_remain -= sent;
+        }
+    }
+    segs.clear();
+    seg_idx = seg_off = 0;
+    arena.clear();
+    queued = 0;
+    finish_write();
+    return true;
+}
+
+/** The response has been sent: get ready for the next request, or finish */
+void Connection::finish_write() {
+    if (file_fd >= 0) {
+        close(file_fd);
+        file_fd = -1;
+    }
+    if (!unsent.empty()) {
+        uint64_t now = lat_now();
+        lat_record(LAT_SEND, now - queued_ns);
+        for (auto &u : unsent)
+            lat_record(u.first, now - u.second);
+        unsent.clear();
+    }
+    /* a pipelining client may already be part way into its next request */
+    if (state == WRITE) {
+        if (persistent) {
+            got = 0;
+            state = READ_HEADER;
+        } else {
+            state = DONE;
+        }
+    }
+}
+
+/**
+ * @brief Take request bytes that a backend has already received, instead of
+ * reading them from the socket.  Stops once a request is READY.
+ *
+ * @return The number of bytes consumed, or -1 if the header was bad
+ */
+ssize_t Connection::feed(const unsigned char *data, size_t len) {
+    size_t used = 0;
+
+    /* the common case: a whole request is here, so parse it in place */
+    if (state == READ_HEADER && got == 0 && len > 0 && data[0] == PROTO_V2) {
+        if (len >= (size_t)LEN_V2_REQ) {
+            start_ns = lat_now();
+            parse_v2(data);
+            header_done(start_ns);
+            return LEN_V2_REQ;
+        }
+    } else if (state == READ_HEADER && got == 0 && len >= (size_t)LEN_RKBLOCK) {
+        int alen;
+        memcpy(&alen, data + 3, sizeof(int));
+        if (alen < 0) {
+            stat_add(STAT_BAD_REQUEST);
+            return -1;
+        }
+        if (len - LEN_RKBLOCK >= (size_t)alen) {
+            cmd.assign((const char *)data, 3);
+            version = 1;
+            body.assign(data + LEN_RKBLOCK, data + LEN_RKBLOCK + alen);
+            start_ns = lat_now();
+            header_done(start_ns);
+            body_done(start_ns);
+            return LEN_RKBLOCK + alen;
+        }
+    }
+
+    while (reading() && (used < len || (state == READ_BODY && got == body.size()))) {
+        if (state == READ_HEADER && got == 0)
+            start_ns = lat_now();
+        unsigned char *next_byte = state == READ_HEADER ? header + got : body.data() + got;
+        /* the first byte of a header tells which version it is, and so how long */
+        bool v2 = state == READ_HEADER && (got > 0 ? header[0] : data[used]) == PROTO_V2;
+        size_t hlen = v2 ? LEN_V2_REQ : LEN_RKBLOCK;
+        size_t want = state == READ_HEADER ? hlen - got : body.size() - got;
+        size_t n = min(want, len - used);
+        if (n)
+            memcpy(next_byte, data + used, n);
+        used += n;
+        got += n;
+        if (v2 && got == hlen) {
+            parse_v2(header);
+            header_done(lat_now());
+        } else if (state == READ_HEADER && got == hlen) {
+            cmd.assign((char *)header, 3);
+            version = 1;
+            int alen;
+            memcpy(&alen, header + 3, sizeof(int));
+            if (alen < 0) {
+                stat_add(STAT_BAD_REQUEST);
+                return -1;
+            }
+            body.resize(alen);
+            got = 0;
+            state = READ_BODY;
+            header_done(lat_now());
+        } else if (state == READ_BODY && got == body.size()) {
+            body_done(lat_now());
+        }
+    }
+    return used;
+}
+
+/**
+ * @brief Take a v2 request from its LEN_V2_REQ bytes.  A v2 client always
+ * gets framed responses, so this also makes the connection persistent.  An
+ * OP_MULTI goes on to read its requests as the body.
+ */
+void Connection::parse_v2(const unsigned char *req) {
+    uint32_t k, v;
+    memcpy(&k, req + 2, sizeof(k));
+    memcpy(&v, req + 6, sizeof(v));
+    cmd.clear();
+    op = req[1];
+    key = (int32_t)le32toh(k);
+    val = (int32_t)le32toh(v);
+    version = 2;
+    persistent = true;
+    body.clear();
+    got = 0;
+    state = READY;
+    if (op == OP_MULTI && key > 0 && key <= MAX_MULTI_OPS) {
+        body.resize((size_t)key * LEN_V2_REQ);
+        state = READ_BODY;
+    }
+}
+
+/** The header of the request is complete: record how long it took to arrive */
+void Connection::header_done(uint64_t now) {
+    lat_record(LAT_HEADER, now - start_ns);
+    header_ns = now;
+}
+
+/** The body of the request is complete: record how long it took to arrive */
+void Connection::body_done(uint64_t now) {
+    lat_record(LAT_BODY, now - header_ns);
+    state = READY;
+}
+
+/** A response has been queued: remember its request, to time it once it is sent */
+void Connection::track() {
+    if (unsent.empty())
+        queued_ns = lat_now();
+    unsent.push_back({series, start_ns});
+}
+
+/**
+ * @brief Move the queued bytes (but not a queued file) into buf, for a
+ * backend that sends them itself.  Call drained() once they are sent.
+ */
+void Connection::take_queued(vec &buf) {
+    buf.clear();
+    for (size_t i = seg_idx; i < segs.size(); i++) {
+        const unsigned char *base = segs[i].base ? segs[i].base : arena.data() + segs[i].off;
+        size_t skip = i == seg_idx ? seg_off : 0;
+        buf.insert(buf.end(), base + skip, base + segs[i].len);
+    }
+    segs.clear();
+    seg_idx = seg_off = 0;
+    arena.clear();
+    queued = 0;
+}
+
+/** Everything taken by take_queued() has been sent */
+void Connection::drained() {
+    if (!pending())
+        finish_write();
+}
+
+/**
+ * @brief The peer closed its side of a socket that a backend reads itself
+ *
+ * @return true if this was a clean close between requests of a persistent
+ *         connection, which is then DONE once its queue drains
+ */
+bool Connection::on_eof() {
+    if (state != READ_HEADER || got != 0 || !persistent)
+        return false;
+    state = DONE;
+    return true;
+}
+
+/**
+ * @brief Drop the segments already sent, and the part of the arena only they
+ * used, so that a client that pipelines enough to keep the queue from ever
+ * draining does not grow the arena without limit.  The arena is only moved
+ * once the sent part is at least as big as the rest, so each byte is moved
+ * a bounded number of times.
+ */
+void Connection::compact() {
+    /* the first arena byte still to send; arena segments are queued in arena
+     * order, and contiguous ones merge, so it may be part way into the current one */
+    size_t cut = arena.size();
+    for (size_t i = seg_idx; i < segs.size(); i++) {
+        if (segs[i].base == nullptr) {
+            cut = segs[i].off + (i == seg_idx ? seg_off : 0);
+            break;
+        }
+    }
+    if (2 * seg_idx < segs.size() && 2 * cut < arena.size())
+        return;
+    segs.erase(segs.begin(), segs.begin() + seg_idx);
+    seg_idx = 0;
+    if (!segs.empty() && segs[0].base == nullptr) {
+        segs[0].off += seg_off;
+        segs[0].len -= seg_off;
+        seg_off = 0;
+    }
+    if (cut > 0) {
+        arena.erase(arena.begin(), arena.begin() + cut);
+        for (segment_t &seg : segs)
+            if (seg.base == nullptr)
+                seg.off -= cut;
+    }
+}
+
+/** Queue a segment, merging it into the last one if they are contiguous */
+void Connection::push(const unsigned char *base, size_t off, size_t len) {
+    queued += len;
+    if (!segs.empty() && seg_idx < segs.size()) {
+        segment_t &last = segs.back();
+        if (last.base == nullptr && base == nullptr && last.off + last.len == off) {
+            last.len += len;
+            return;
+        }
+    }
+    segs.push_back({base, off, len});
+}
+
+/**
+ * @brief Queue a response with a payload.  On a persistent connection the
+ * response is framed by a status byte and the length of its payload.  The
+ * frame and payload are copied into the arena.
+ */
+void Connection::queue(unsigned char status, const unsigned char *payload, size_t len) {
+    size_t off = arena.size();
+    if (persistent) {
+        arena.push_back(status);
+        vec_append(arena, (int)len);
+    }
+    arena.insert(arena.end(), payload, payload + len);
+    push(nullptr, off, arena.size() - off);
+}
+
+/** Queue a response without a payload, which is always static bytes */
+void Connection::queue_status(unsigned char status) {
+    if (status == ST_ERR_KEY)
+        stat_add(STAT_ERR_KEY);
+    else if (status == ST_ERR_INVALID)
+        stat_add(STAT_ERR_INVALID);
+    if (persistent) {
+        push(STATUS_FRAMES[status], 0, LEN_FRAME);
+    } else {
+        const string &text = *STATUS_TEXT[status];
+        push((const unsigned char *)text.data(), 0, text.size());
+    }
+}
+
+/**
+ * @brief Queue bytes to send.  On a persistent connection the connection is
+ * ready for the next request right away, unless the queue is too long.
+ */
+void Connection::reply(const vec &res) {
+    /* the status byte (or the static text) carries the outcome, so only a value is copied */
+    if (same(res, RES_OK))
+        queue_status(ST_OK);
+    else if (same(res, RES_ERR_KEY))
+        queue_status(ST_ERR_KEY);
+    else if (same(res, RES_ERR_INVALID))
+        queue_status(ST_ERR_INVALID);
+    else
+        queue(ST_OK, res.data(), res.size());
+    replied();
+}
+
+/** Queue a response that is only a status, such as ST_ERR_KEY */
+void Connection::reply_status(unsigned char status) {
+    queue_status(status);
+    replied();
+}
+
+/** Queue an OK response whose payload is a 4-byte little-endian int */
+void Connection::reply_int(int32_t v) {
+    uint32_t le = htole32((uint32_t)v);
+    queue(ST_OK, (const unsigned char *)&le, sizeof(le));
+    replied();
+}
+
+/**
+ * @brief A response has been queued.  On a persistent connection the
+ * connection is ready for the next request right away, unless the queue is
+ * too long.
+ */
+void Connection::replied() {
+    track();
+    if (!persistent) {
+        state = WRITE;
+        return;
+    }
+    got = 0;
+    state = queued < MAX_QUEUED ? READ_HEADER : WRITE;
+}
+
+/**
+ * @brief Queue the first len bytes of a file to send after the bytes that
+ * are already queued.  The connection takes ownership of fd.
+ */
+void Connection::reply_file(int fd, size_t len) {
+    track();
+    if (persistent) {
+        size_t off = arena.size();
+        arena.push_back(ST_OK);
+        vec_append(arena, (int)len);
+        push(nullptr, off, LEN_FRAME);
+    }
+    file_fd = fd;
+    file_off = 0;
+    file_remain = len;
+    state = WRITE;
+}
+
+/** Is there still something queued to send? */
+bool Connection::pending() const {
+    return seg_idx < segs.size() || file_remain > 0;
+}
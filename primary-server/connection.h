@@ -0,0 +1,267 @@
+/**
+ * @file connection.h
+ */
+
+#ifndef CONNECTION_DEF
+#define CONNECTION_DEF
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include "latency.h"
+#include "timer_wheel.h"
+#include "vec.h"
+
+/**
+ * How long a connection may go without progress before the server closes it,
+ * in milliseconds, or 0 to wait forever
+ */
+struct timeouts_t {
+  /** Waiting for the first byte of a request */
+  int idle_ms = 0;
+
+  /** Part way through reading a request or writing a response */
+  int io_ms = 0;
+};
+
+/**
+ * @brief Connection holds the state of one client socket while the event loop
+ * serves it.  The socket is non-blocking, so every call does as much work as
+ * the socket allows and remembers where it stopped.
+ *
+ * Reading moves through READ_HEADER (the 3-byte command and 4-byte body
+ * length) and READ_BODY, until a complete request is READY.  A v2 request
+ * (see PROTO_V2) is all header, and is READY as soon as its fixed fields
+ * arrive, except OP_MULTI, whose requests follow as its body.  Bytes arrive a
+ * chunk at a time in an input buffer, from which requests are parsed in
+ * place.  The server then queues a response, which is written in the WRITE
+ * state.  The response may end with a range of a file, which is sent with
+ * sendfile().  Once the response is flushed the connection is DONE, since
+ * clients read the response until the server closes the socket.
+ *
+ * A persistent connection (see REQ_KAL) instead frames each response with a
+ * status byte and its length, and goes straight back to READ_HEADER while the
+ * response is still queued, so that a client can pipeline requests: responses
+ * pile up in order behind each other and are flushed together, with a single
+ * sendmsg() that gathers static status frames and values from a reused
+ * arena.  Reading only pauses while a file is being sent or too many bytes
+ * are queued.  A clean close between requests makes the connection DONE once
+ * the queue drains.
+ */
+class Connection {
+public:
+  /** The states of a connection */
+  enum state_t { READ_HEADER, READ_BODY, READY, WRITE, DONE };
+
+  /** The socket of this connection */
+  int sd;
+
+  /** Where the connection is in serving its request */
+  state_t state = READ_HEADER;
+
+  /** The command of the request, once the header has been read */
+  std::string cmd = "";
+
+  /** The body of the request, once it has been read */
+  vec body;
+
+  /** Does the connection stay open for more requests? */
+  bool persistent = false;
+
+  /** The protocol version of the request, 2 if it came in the v2 format (see PROTO_V2) */
+  int version = 1;
+
+  /** The opcode, key and value of a v2 request, once it has been read */
+  unsigned char op = 0;
+  int32_t key = 0;
+  int32_t val = 0;
+
+  /** The end-to-end latency series of the request being served (see latency.h) */
+  lat_series_t series = LAT_OTHER;
+
+  /** The readiness (EPOLLIN and/or EPOLLOUT) the event loop is waiting for */
+  uint32_t events = 0;
+
+  /** The deadline the event loop evicts the connection at, id is the socket */
+  TimerWheel::Timer timer;
+
+  /**
+   * @brief Construct a connection for a socket.  The connection owns the
+   * socket, and closes it when destroyed.
+   *
+   * @param sd The socket, which should already be non-blocking
+   */
+  Connection(int sd);
+
+  /** Close the socket, and any file still being sent */
+  ~Connection();
+
+  Connection(const Connection &) = delete;
+  Connection &operator=(const Connection &) = delete;
+
+  /**
+   * @brief Read as much of the request as the socket has available.  Stops
+   * as soon as one request is READY; the next may already be buffered.
+   *
+   * @return false if the peer closed the socket or sent a bad header, or on
+   *         an error, true otherwise
+   */
+  bool on_readable();
+
+  /**
+   * @brief Write as much of the response as the socket will take
+   *
+   * @return false on an error, true otherwise
+   */
+  bool on_writable();
+
+  /** Queue bytes to send */
+  void reply(const vec &res);
+
+  /** Queue a response that is only a status, such as ST_ERR_KEY */
+  void reply_status(unsigned char status);
+
+  /** Queue an OK response whose payload is a 4-byte little-endian int */
+  void reply_int(int32_t v);
+
+  /**
+   * @brief Queue the first len bytes of a file to send after the bytes that
+   * are already queued.  The connection takes ownership of fd.
+   */
+  void reply_file(int fd, size_t len);
+
+  /** Is there still something queued to send? */
+  bool pending() const;
+
+  /**
+   * @brief Take request bytes that a backend has already received, instead
+   * of reading them from the socket.  Stops once a request is READY.
+   *
+   * @return The number of bytes consumed, or -1 if the header was bad
+   */
+  ssize_t feed(const unsigned char *data, size_t len);
+
+  /**
+   * @brief Move the queued bytes (but not a queued file) into buf, for a
+   * backend that sends them itself.  Call drained() once they are sent.
+   */
+  void take_queued(vec &buf);
+
+  /** Everything taken by take_queued() has been sent */
+  void drained();
+
+  /**
+   * @brief The peer closed its side of a socket that a backend reads itself
+   *
+   * @return true if this was a clean close between requests of a persistent
+   *         connection, which is then DONE once its queue drains
+   */
+  bool on_eof();
+
+  /** Is a file still queued to send, after the queued bytes? */
+  bool file_pending() const { return file_remain > 0; }
+
+  /** Is the connection waiting for more of a request? */
+  bool reading() const { return state == READ_HEADER || state == READ_BODY; }
+
+  /** Are received bytes waiting to be parsed? */
+  bool buffered() const { return in_off < in_len; }
+
+  /**
+   * @brief How long the connection may now go without progress: the idle
+   * timeout between requests, the I/O timeout in the middle of one
+   *
+   * @return Milliseconds, or 0 to wait forever
+   */
+  int timeout(const timeouts_t &timeouts) const {
+    bool idle = state == READ_HEADER && got == 0 && !buffered() && !pending();
+    return idle ? timeouts.idle_ms : timeouts.io_ms;
+  }
+
+  /** Stop reading pipelined requests while this many bytes are queued */
+  static const size_t MAX_QUEUED = 1 << 20;
+
+private:
+
+  /** How much to ask recv() for at a time */
+  static const size_t READ_CHUNK = 16 * 1024;
+
+  /** The response has been sent: get ready for the next request, or finish */
+  void finish_write();
+
+  /** Queue a response, framed if the connection is persistent */
+  void queue(unsigned char status, const unsigned char *payload, size_t len);
+
+  /** Queue a response without a payload, which is always static bytes */
+  void queue_status(unsigned char status);
+
+  /** A response has been queued: get ready for the next request, or write */
+  void replied();
+
+  /** Take a v2 request from its LEN_V2_REQ bytes */
+  void parse_v2(const unsigned char *req);
+
+  /** The header of the request is complete: record how long it took to arrive */
+  void header_done(uint64_t now);
+
+  /** The body of the request is complete: record how long it took to arrive */
+  void body_done(uint64_t now);
+
+  /** A response has been queued: remember its request, to time it once it is sent */
+  void track();
+
+  /** The request header (long enough for a v2 request), and how much of it (or of the body) has arrived */
+  unsigned char header[10];
+  size_t got = 0;
+
+  /** Received bytes, and the range of them that has not been parsed yet */
+  vec inbuf;
+  size_t in_off = 0;
+  size_t in_len = 0;
+
+  /**
+   * A run of queued bytes: either static bytes that live as long as the
+   * program (a status frame or status text), or a range of the arena
+   */
+  struct segment_t {
+    const unsigned char *base;
+    size_t off;
+    size_t len;
+  };
+
+  /** Queue a segment, merging it into the last one if they are contiguous */
+  void push(const unsigned char *base, size_t off, size_t len);
+
+  /** Drop the segments already sent, and the part of the arena only they used */
+  void compact();
+
+  /** The queued segments, which one is being sent, and how much of it is sent */
+  std::vector<segment_t> segs;
+  size_t seg_idx = 0;
+  size_t seg_off = 0;
+
+  /** Values and frame headers of queued responses, reused from turn to turn */
+  vec arena;
+
+  /** Bytes queued and not yet sent */
+  size_t queued = 0;
+
+  /** When the first byte of the request being read arrived, and when the last of its header did */
+  uint64_t start_ns = 0;
+  uint64_t header_ns = 0;
+
+  /** The series and start of each request whose response is queued, and when the first was queued */
+  std::vector<std::pair<lat_series_t, uint64_t>> unsent;
+  uint64_t queued_ns = 0;
+
+  /** File queued to send after the segments, where to continue in it, and how much is left */
+  int file_fd = -1;
+  off_t file_off = 0;
+  size_t file_remain = 0;
+};
+
+#endif
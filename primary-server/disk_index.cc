@@ -0,0 +1,253 @@
+/**
+ * @file disk_index.cc
+ */
+
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "disk_index.h"
+#include "log.h"
+
+using namespace std;
+
+/** Magic bytes at the start of every index file */
+static const char INDEX_MAGIC[8] = {'K', 'V', 'I', 'N', 'D', 'E', 'X', '1'};
+
+/** Capacity of a freshly created index.  Must be a power of two. */
+static const uint64_t INITIAL_CAPACITY = 1024;
+
+/** Slot states.  A zero-filled file is an index of empty slots. */
+static const uint32_t SLOT_EMPTY = 0;
+static const uint32_t SLOT_FULL = 1;
+static const uint32_t SLOT_DELETED = 2;
+
+/**
+ * @brief DiskIndex::header_t is the first thing in the file.  It only holds
+ * fixed-width fields, so the layout is the same every time the file is mapped.
+ */
+struct DiskIndex::header_t {
+  char magic[8];
+  uint64_t capacity;
+  uint64_t count;
+  uint64_t tombstones;
+  uint64_t log_bytes;
+};
+
+/** DiskIndex::slot_t is one entry of the open-addressing table */
+struct DiskIndex::slot_t {
+  int32_t key;
+  int32_t val;
+  uint32_t state;
+  uint32_t pad;
+};
+
+/** Destructor, flushes and unmaps the file */
+DiskIndex::~DiskIndex() { unmap(); }
+
+DiskIndex::header_t *DiskIndex::header() { return (header_t *)base; }
+
+DiskIndex::slot_t *DiskIndex::slots() {
+  return (slot_t *)(base + sizeof(header_t));
+}
+
+/** Map a file of the given capacity, creating or resizing it as needed */
+bool DiskIndex::map(const string &fname, uint64_t capacity, bool fresh) {
+  int nfd = ::open(fname.c_str(), O_RDWR | O_CREAT, 0644);
+  if (nfd < 0) {
+    LOG_ERROR << "Unable to open index " << fname;
+    return false;
+  }
+  size_t len = sizeof(header_t) + capacity * sizeof(slot_t);
+  // NB: truncating to 0 first means every slot reads back as SLOT_EMPTY
+  if (fresh && (ftruncate(nfd, 0) != 0 || ftruncate(nfd, len) != 0)) {
+    LOG_ERROR << "Unable to size index " << fname;
+    ::close(nfd);
+    return false;
+  }
+  void *addr = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, nfd, 0);
+  if (addr == MAP_FAILED) {
+    LOG_ERROR << "Unable to map index " << fname;
+    ::close(nfd);
+    return false;
+  }
+  filename = fname;
+  fd = nfd;
+  base = (unsigned char *)addr;
+  length = len;
+  if (fresh) {
+    memcpy(header()->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header()->capacity = capacity;
+  }
+  return true;
+}
+
+/** Unmap and close the backing file */
+void DiskIndex::unmap() {
+  if (base != nullptr) {
+    msync(base, length, MS_SYNC);
+    munmap(base, length);
+  }
+  if (fd >= 0)
+    ::close(fd);
+  base = nullptr;
+  length = 0;
+  fd = -1;
+}
+
+/**
+ * @brief Open the index file, creating an empty index if it does not exist
+ * or is not a valid index.
+ *
+ * @param fname The name of the index file
+ * @return false if the file could not be created or mapped, true otherwise
+ */
+bool DiskIndex::open(const string &fname) {
+  unmap();
+  // Only trust the file if its header is intact and its size matches the
+  // capacity the header claims
+  header_t h;
+  struct stat stat_buf;
+  bool valid = false;
+  int rfd = ::open(fname.c_str(), O_RDONLY);
+  if (rfd >= 0) {
+    valid = fstat(rfd, &stat_buf) == 0 &&
+            pread(rfd, &h, sizeof(h), 0) == (ssize_t)sizeof(h) &&
+            memcmp(h.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+            h.capacity > 0 && (h.capacity & (h.capacity - 1)) == 0 &&
+            (size_t)stat_buf.st_size ==
+                sizeof(header_t) + h.capacity * sizeof(slot_t);
+    ::close(rfd);
+  }
+  if (valid)
+    return map(fname, h.capacity, false);
+  LOG_INFO << "Creating index " << fname;
+  return map(fname, INITIAL_CAPACITY, true);
+}
+
+/** Drop every mapping, leaving an empty index */
+void DiskIndex::reset() {
+  string fname = filename;
+  unmap();
+  map(fname, INITIAL_CAPACITY, true);
+}
+
+/** Flush and unmap the file, leaving the index closed */
+void DiskIndex::close() {
+  unmap();
+}
+
+/** Find the slot holding key, or the slot where it should be inserted */
+DiskIndex::slot_t *DiskIndex::probe(int key, bool for_insert) {
+  uint64_t mask = header()->capacity - 1;
+  uint64_t i = ((uint32_t)key * 2654435761u) & mask;
+  slot_t *table = slots();
+  slot_t *first_free = nullptr;
+  while (true) {
+    slot_t *s = &table[i];
+    if (s->state == SLOT_EMPTY) {
+      if (!for_insert)
+        return nullptr;
+      return first_free ? first_free : s;
+    }
+    if (s->state == SLOT_FULL && s->key == key)
+      return s;
+    if (s->state == SLOT_DELETED && first_free == nullptr)
+      first_free = s;
+    i = (i + 1) & mask;
+  }
+}
+
+/** Rehash into a new file, and rename it over the old one */
+bool DiskIndex::grow() {
+  // If most of the load is tombstones, rehashing at the same size is enough
+  uint64_t capacity = header()->capacity;
+  if ((header()->count + 1) * 20 > capacity * 7)
+    capacity *= 2;
+  DiskIndex bigger;
+  string tmpname = filename + ".tmp";
+  if (!bigger.map(tmpname, capacity, true))
+    return false;
+  slot_t *table = slots();
+  for (uint64_t i = 0; i < header()->capacity; i++) {
+    if (table[i].state == SLOT_FULL)
+      bigger.insert(table[i].key, table[i].val);
+  }
+  bigger.set_log_bytes(log_bytes());
+  msync(bigger.base, bigger.length, MS_SYNC);
+  if (rename(tmpname.c_str(), filename.c_str()) != 0) {
+    LOG_ERROR << "Unable to replace index " << filename;
+    return false;
+  }
+  // Take over the new mapping, and let bigger clean up the old one
+  bigger.filename = filename;
+  std::swap(fd, bigger.fd);
+  std::swap(base, bigger.base);
+  std::swap(length, bigger.length);
+  return true;
+}
+
+/**
+ * @brief Insert a key/value mapping
+ *
+ * @return false if the key was already present or the index could not
+ *         grow, true otherwise
+ */
+bool DiskIndex::insert(int key, int val) {
+  // Keep the load factor (including tombstones) under 70%
+  header_t *h = header();
+  if ((h->count + h->tombstones + 1) * 10 > h->capacity * 7) {
+    if (!grow())
+      return false;
+    h = header();
+  }
+  slot_t *s = probe(key, true);
+  if (s->state == SLOT_FULL)
+    return false;
+  if (s->state == SLOT_DELETED)
+    h->tombstones--;
+  s->key = key;
+  s->val = val;
+  s->state = SLOT_FULL;
+  h->count++;
+  return true;
+}
+
+/**
+ * @brief Look up a key
+ *
+ * @return The value and true if the key is present, {0, false} otherwise
+ */
+pair<int, bool> DiskIndex::find(int key) {
+  slot_t *s = probe(key, false);
+  if (s == nullptr)
+    return {0, false};
+  return {s->val, true};
+}
+
+/**
+ * @brief Remove a key/value mapping
+ *
+ * @return false if the key was not present, true otherwise
+ */
+bool DiskIndex::remove(int key) {
+  slot_t *s = probe(key, false);
+  if (s == nullptr)
+    return false;
+  s->state = SLOT_DELETED;
+  header()->count--;
+  header()->tombstones++;
+  return true;
+}
+
+/** The number of log bytes that have been applied to the index */
+uint64_t DiskIndex::log_bytes() { return header()->log_bytes; }
+
+/** Record that the first n bytes of the log have been applied */
+void DiskIndex::set_log_bytes(uint64_t n) { header()->log_bytes = n; }
+
+/** Number of keys in the index */
+uint64_t DiskIndex::size() { return header()->count; }
@@ -0,0 +1,114 @@
+/**
+ * @file disk_index.h
+ */
+
+#ifndef DISK_INDEX_DEF
+#define DISK_INDEX_DEF
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+/**
+ * @brief DiskIndex is a persistent hash table that lives in a memory-mapped
+ * file.  Every slot is addressed by its offset from the start of the mapping,
+ * so the file can be mapped at any address and used as soon as it is opened:
+ * pages are faulted in lazily as keys are touched, instead of the whole store
+ * being rebuilt by replaying the log.
+ *
+ * The header records how many bytes of the log the index reflects, so that a
+ * restart only has to replay the tail of the log that the index has not seen.
+ */
+class DiskIndex {
+  /** On-disk header at offset 0 of the file */
+  struct header_t;
+
+  /** On-disk slot, stored in an array right after the header */
+  struct slot_t;
+
+  /** The name of the backing file */
+  std::string filename = "";
+
+  /** File descriptor of the backing file, or -1 if the index is closed */
+  int fd = -1;
+
+  /** Start of the mapping, and its length in bytes */
+  unsigned char *base = nullptr;
+  size_t length = 0;
+
+  /** Typed views into the mapping */
+  header_t *header();
+  slot_t *slots();
+
+  /** Map a file of the given capacity, creating or resizing it as needed */
+  bool map(const std::string &fname, uint64_t capacity, bool fresh);
+
+  /** Unmap and close the backing file */
+  void unmap();
+
+  /** Find the slot holding key, or the slot where it should be inserted */
+  slot_t *probe(int key, bool for_insert);
+
+  /** Rehash into a new file, and rename it over the old one */
+  bool grow();
+
+public:
+  /** Default constructor, the index is closed until open() is called */
+  DiskIndex() {}
+
+  /** Destructor, flushes and unmaps the file */
+  ~DiskIndex();
+
+  /**
+   * @brief Open the index file, creating an empty index if it does not exist
+   * or is not a valid index.
+   *
+   * @param fname The name of the index file
+   * @return false if the file could not be created or mapped, true otherwise
+   */
+  bool open(const std::string &fname);
+
+  /** Is the index open? */
+  bool is_open() const { return base != nullptr; }
+
+  /** Drop every mapping, leaving an empty index */
+  void reset();
+
+  /** Flush and unmap the file, leaving the index closed */
+  void close();
+
+  /**
+   * @brief Insert a key/value mapping
+   *
+   * @return false if the key was already present or the index could not
+   *         grow, true otherwise
+   */
+  bool insert(int key, int val);
+
+  /**
+   * @brief Look up a key
+   *
+   * @return The value and true if the key is present, {0, false} otherwise
+   */
+  std::pair<int, bool> find(int key);
+
+  /**
+   * @brief Remove a key/value mapping
+   *
+   * @return false if the key was not present, true otherwise
+   */
+  bool remove(int key);
+
+  /** The number of log bytes that have been applied to the index */
+  uint64_t log_bytes();
+
+  /** Record that the first n bytes of the log have been applied */
+  void set_log_bytes(uint64_t n);
+
+  /** Number of keys in the index */
+  uint64_t size();
+};
+
+#endif
@@ -0,0 +1,212 @@
+/**
+ * @file event_loop.cc
+ */
+
+#include <fcntl.h>
+#include <memory>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unordered_map>
+
+#include "event_loop.h"
+#include "net.h"
+
+using namespace std;
+
+/** The most events to take from epoll_wait() at once */
+const int MAX_EVENTS = 256;
+
+/**
+ * @brief Put a socket into non-blocking mode
+ * 
+ * @param sd The socket
+ * @return false on error, true otherwise
+ */
+static bool set_nonblocking(int sd) {
+    int flags = fcntl(sd, F_GETFL, 0);
+    return flags >= 0 && fcntl(sd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+/**
+ * @brief Serve every client from one thread with epoll.  The listening socket
+ * and every client socket are non-blocking, and each client is tracked by a
+ * Connection that remembers how far it got in reading its request and writing
+ * its response.  A slow client only holds on to its own Connection, never the
+ * thread, so one thread can keep thousands of clients moving.  A client that
+ * makes no progress for too long is closed when its timer in a TimerWheel
+ * expires, so dead and stalled peers do not pile up.
+ * 
+ * @param sd       The listening socket
+ * @param handler  Called once a connection holds a complete request.  It
+ *                 should queue a response on the connection, and return true
+ *                 if the server should halt.
+ * @param stop_fd  The loop also halts once this descriptor is readable, or -1
+ * @param timeouts How long a connection may go without progress
+ */
+void event_loop(int sd, function<bool(Connection &)> handler, int stop_fd, timeouts_t timeouts) {
+    int ep = epoll_create1(0);
+    if (ep < 0 || !set_nonblocking(sd)) {
+        error_message_and_exit(0, errno, "Error setting up event loop: ");
+    }
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = sd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, sd, &ev);
+    if (stop_fd >= 0) {
+        ev.data.fd = stop_fd;
+        epoll_ctl(ep, EPOLL_CTL_ADD, stop_fd, &ev);
+    }
+
+    /* the deadline of every client; it goes first, so it outlives their timers */
+    TimerWheel wheel;
+
+    /* every open client, by socket */
+    unordered_map<int, unique_ptr<Connection>> conns;
+
+    /* start the clock again on a connection that made progress */
+    auto rearm = [&](Connection &conn) {
+        int ms = conn.timeout(timeouts);
+        if (ms > 0)
+            wheel.arm(conn.timer, ms);
+        else
+            conn.timer.cancel();
+    };
+
+    /* switch which readiness a connection is waiting for */
+    auto watch = [&](Connection &conn, uint32_t events) {
+        epoll_event cev = {};
+        cev.events = events;
+        cev.data.fd = conn.sd;
+        epoll_ctl(ep, EPOLL_CTL_MOD, conn.sd, &cev);
+    };
+
+    bool halt = false;
+    epoll_event events[MAX_EVENTS];
+    while (!halt) {
+        int n = epoll_wait(ep, events, MAX_EVENTS, wheel.next_wait());
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            sys_error(errno, "Error in epoll_wait():");
+            break;
+        }
+        for (int i = 0; i < n && !halt; i++) {
+            int fd = events[i].data.fd;
+            if (fd == stop_fd) {
+                halt = true;
+                break;
+            }
+
+            /* new clients: accept all of them until the backlog is empty */
+            if (fd == sd) {
+                while (true) {
+                    int connSd = accept4(sd, nullptr, nullptr, SOCK_NONBLOCK);
+                    if (connSd < 0) {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                            sys_error(errno, "Error accepting request from client: ");
+                        break;
+                    }
+                    epoll_event cev = {};
+                    cev.events = EPOLLIN;
+                    cev.data.fd = connSd;
+                    epoll_ctl(ep, EPOLL_CTL_ADD, connSd, &cev);
+                    auto conn = make_unique<Connection>(connSd);
+                    conn->events = EPOLLIN;
+                    rearm(*conn);
+                    conns[connSd] = move(conn);
+                }
+                continue;
+            }
+
+            auto it = conns.find(fd);
+            if (it == conns.end())
+                continue;
+            Connection &conn = *it->second;
+            bool ok = true;
+            if (events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN))
+                ok = false;
+
+            do {
+                /* serve every request that has arrived, a persistent client may have pipelined many */
+                while (ok && !halt && conn.reading()) {
+                    ok = conn.on_readable();
+                    if (!ok || conn.state != Connection::READY)
+                        break;
+                    halt = handler(conn);
+                }
+
+                /* most responses fit in the socket buffer right away */
+                if (ok && conn.pending())
+                    ok = conn.on_writable();
+
+                /* requests buffered while the queue was full get no new EPOLLIN */
+            } while (ok && !halt && conn.reading() && conn.buffered());
+            if (ok) {
+                uint32_t want = (conn.reading() ? EPOLLIN : 0) | (conn.pending() ? EPOLLOUT : 0);
+                if (want && want != conn.events) {
+                    watch(conn, want);
+                    conn.events = want;
+                }
+                rearm(conn);
+            }
+
+            /* unless it is persistent, a connection serves one request: the client reads until we close */
+            if (!ok || (conn.state == Connection::DONE && !conn.pending())) {
+                epoll_ctl(ep, EPOLL_CTL_DEL, fd, nullptr);
+                conns.erase(it);
+            }
+        }
+
+        /* evict every client whose deadline passed; its timer leaves the wheel with it */
+        wheel.advance([&](TimerWheel::Timer &timer) {
+            epoll_ctl(ep, EPOLL_CTL_DEL, timer.id, nullptr);
+            conns.erase(timer.id);
+        });
+    }
+    conns.clear();
+    close(ep);
+}
+
+/**
+ * @brief Serve clients from several reactor threads.  Each thread runs its own
+ * event_loop() on its own listening socket; the sockets share a port through
+ * SO_REUSEPORT, so the kernel spreads new connections across the threads and
+ * no thread hands connections to another.  When any reactor halts, it wakes
+ * the others through an eventfd, and all of them stop.
+ * 
+ * @param sds      One listening socket per reactor
+ * @param pin      Pin reactor i to core i (modulo the number of cores)
+ * @param handler  As for event_loop(), called from every reactor thread
+ * @param timeouts As for event_loop()
+ * @param loop     The loop each reactor runs: event_loop() or uring_loop()
+ */
+void run_reactors(const vector<int> &sds, bool pin, function<bool(Connection &)> handler,
+                  timeouts_t timeouts, decltype(&event_loop) loop) {
+    int stop_fd = eventfd(0, EFD_NONBLOCK);
+    if (stop_fd < 0) {
+        error_message_and_exit(0, errno, "Error creating eventfd: ");
+    }
+    unsigned cores = thread::hardware_concurrency();
+    vector<thread> reactors;
+    for (size_t i = 0; i < sds.size(); i++) {
+        reactors.emplace_back([&, sd = sds[i]]() {
+            loop(sd, handler, stop_fd, timeouts);
+            uint64_t one = 1;
+            if (write(stop_fd, &one, sizeof(one)) < 0)
+                sys_error(errno, "Error stopping reactors:");
+        });
+        if (pin && cores > 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % cores, &cpus);
+            int err = pthread_setaffinity_np(reactors.back().native_handle(), sizeof(cpus), &cpus);
+            if (err != 0)
+                sys_error(err, "Error pinning reactor thread:");
+        }
+    }
+    for (auto &reactor : reactors)
+        reactor.join();
+    close(stop_fd);
+}
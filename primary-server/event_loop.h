@@ -0,0 +1,50 @@
+/**
+ * @file event_loop.h
+ */
+
+#ifndef EVENT_LOOP_DEF
+#define EVENT_LOOP_DEF
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "connection.h"
+
+/**
+ * @brief Serve every client from one thread with epoll.  The listening socket
+ * and every client socket are non-blocking, and each client is tracked by a
+ * Connection that remembers how far it got in reading its request and writing
+ * its response.  A slow client only holds on to its own Connection, never the
+ * thread, so one thread can keep thousands of clients moving.  A client that
+ * makes no progress for too long is closed when its timer in a TimerWheel
+ * expires, so dead and stalled peers do not pile up.
+ * 
+ * @param sd       The listening socket
+ * @param handler  Called once a connection holds a complete request.  It
+ *                 should queue a response on the connection, and return true
+ *                 if the server should halt.
+ * @param stop_fd  The loop also halts once this descriptor is readable, or -1
+ * @param timeouts How long a connection may go without progress
+ */
+void event_loop(int sd, std::function<bool(Connection &)> handler, int stop_fd = -1,
+                timeouts_t timeouts = {});
+
+/**
+ * @brief Serve clients from several reactor threads.  Each thread runs its own
+ * event_loop() on its own listening socket; the sockets share a port through
+ * SO_REUSEPORT, so the kernel spreads new connections across the threads and
+ * no thread hands connections to another.  When any reactor halts, it wakes
+ * the others through an eventfd, and all of them stop.
+ * 
+ * @param sds      One listening socket per reactor
+ * @param pin      Pin reactor i to core i (modulo the number of cores)
+ * @param handler  As for event_loop(), called from every reactor thread
+ * @param timeouts As for event_loop()
+ * @param loop     The loop each reactor runs: event_loop() or uring_loop()
+ */
+void run_reactors(const std::vector<int> &sds, bool pin, std::function<bool(Connection &)> handler,
+                  timeouts_t timeouts = {}, decltype(&event_loop) loop = event_loop);
+
+#endif
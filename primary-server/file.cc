@@ -46,6 +46,33 @@ vec load_entire_file(const string &filename) {
   return res;
 }
 
+/// Load a file from the given offset to its end
+/// @param filename The name of the file to open
+/// @param offset   The offset at which to start reading
+/// @returns A vector with the file contents after offset.  On error, returns an
+///          empty vector
+vec load_file_from(const string &filename, size_t offset) {
+  FILE *f = fopen(filename.c_str(), "rb");
+  if (!f) {
+    cerr << "File " << filename << " not found\n";
+    return {};
+  }
+  ContextManager closer([&]() { fclose(f); }); // close file when we return
+
+  struct stat stat_buf;
+  if (fstat(fileno(f), &stat_buf) != 0 || (size_t)stat_buf.st_size < offset ||
+      fseek(f, offset, SEEK_SET) != 0) {
+    cerr << "Unable to seek to " << offset << " in " << filename << endl;
+    return {};
+  }
+  vec res(stat_buf.st_size - offset);
+  if (fread(res.data(), sizeof(char), res.size(), f) != res.size()) {
+    cerr << "Wrong # bytes reading " << filename << endl;
+    return {};
+  }
+  return res;
+}
+
 /// Create or truncate a file and populate it with the provided data
 /// @param filename The name of the file to create/truncate
 /// @param data     The data to write
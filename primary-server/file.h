@@ -15,6 +15,13 @@ bool file_exists(const std::string &filename);
 /// @returns A vector with the file contents.  On error, returns an empty vector
 vec load_entire_file(const std::string &filename);
 
+/// Load a file from the given offset to its end
+/// @param filename The name of the file to open
+/// @param offset   The offset at which to start reading
+/// @returns A vector with the file contents after offset.  On error, returns an
+///          empty vector
+vec load_file_from(const std::string &filename, size_t offset);
+
 /// Create or truncate a file and populate it with the provided data
 /// @param filename The name of the file to create/truncate
 /// @param data     The data to write
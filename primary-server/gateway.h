@@ -3,48 +3,95 @@
  * 
  *
  */
+#include <fcntl.h>
+#include <sys/stat.h>
+
 #include "net.h"
+#include "protocol.h"
+#include "contextmanager.h"
+#include "latency.h"
+#include "log.h"
 
 using namespace std;
 
 class Gateway {
-    int sd;
+    /* persistent connection to the backup server, or -1 */
+    int sd = -1;
     int bport = 8888;
     string bname = "localhost";
 
+/** connect to backup server and switch the connection to persistent mode */
+    bool open_persistent() {
+        sd = connect_to_server(bname, bport);
+        if (sd < 0) return false;
+        vec req, res;
+        unsigned char status;
+        vec_append(req, REQ_KAL);
+        vec_append(req, 0);
+        if (!send_reliably(sd, req) || !reliable_get_framed(sd, status, res)) {
+            close(sd);
+            sd = -1;
+            return false;
+        }
+        return true;
+    }
+
 public:
 
 /** Default constructor */
     Gateway() {}
 
-/** send the message to backup server */
-    vec communicate(const vec &req) {
-        cout << "test gateway!" << endl;
-        cout << "size: " << req.size() << endl;
-        for (unsigned int i=0; i < req.size(); i++) {
-            cout << "req[i]:: " << req.at(i) << endl;
+/** Destructor, closes the connection to the backup server */
+    ~Gateway() {
+        if (sd >= 0) close(sd);
+    }
+
+/**
+ * send the message to backup server over one persistent connection, so that
+ * replicating an update does not cost a connect and close.  If the backup
+ * restarted since the last message, reconnect once and resend.  Returns
+ * whether the backup answered.
+ */
+    bool communicate(const vec &req) {
+        LatencyScope scope(LAT_REPLICATE);
+        LOG_DEBUG << "test gateway!";
+        LOG_DEBUG << "size: " << req.size();
+        for (int attempt = 0; attempt < 2; attempt++) {
+            if (sd < 0 && !open_persistent()) return false;
+            vec res;
+            unsigned char status;
+            if (send_reliably(sd, req) && reliable_get_framed(sd, status, res)) return true;
+            close(sd);
+            sd = -1;
         }
-        sd = connect_to_server(bname, bport);
-        send_reliably(sd, req);
-        vec res = reliable_get_to_eof(sd);
-        return res;
+        return false;
     }
 
-    vec send_file(const string &cmd, const vec &disk) {
-        vec req;
+/** stream a file to backup server without loading it into memory */
+    vec send_file(const string &cmd, const string &filename) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return {};
+        ContextManager closer([&]() { close(fd); });
+        struct stat stat_buf;
+        if (fstat(fd, &stat_buf) != 0) return {};
 
-        /* set up request */
+        /* set up request header, the body follows straight from the file */
+        vec req;
         vec_append(req, cmd);
-        vec_append(req, disk.size());
-        vec_append(req, disk);
-
-        /* send via socket */
-        vec res = communicate(req);
+        vec_append(req, (int)stat_buf.st_size);
+
+        /* send via its own socket, the backup reads the whole log before it answers */
+        int fsd = connect_to_server(bname, bport);
+        if (fsd < 0) return {};
+        send_reliably(fsd, req);
+        reliable_sendfile(fsd, fd, 0, stat_buf.st_size);
+        vec res = reliable_get_to_eof(fsd);
+        close(fsd);
         return res;
     }
 
-    vec send_message(const string &cmd, const int &key) {
-        std::cout << "send_message(PVD?)" << cmd << std::endl;
+    bool send_message(const string &cmd, const int &key) {
+        LOG_DEBUG << "send_message(PVD?)" << cmd;
         vec req;
         /* set up key */
         string k = to_string(key);
@@ -59,13 +106,12 @@ public:
         vec_append(req, msg);
 
         /* send via socket */
-        cout << "comm!" << endl;
-        vec res = communicate(req);
-        return res;
+        LOG_DEBUG << "comm!";
+        return communicate(req);
     }
 
-    vec send_message(const string &cmd, const int &key, const int &val) {
-        std::cout << "send_message(PVI?)" << cmd << std::endl;
+    bool send_message(const string &cmd, const int &key, const int &val) {
+        LOG_DEBUG << "send_message(PVI?)" << cmd;
         vec req;
         /* set up key and value */
         string k = to_string(key);
@@ -80,9 +126,8 @@ public:
         vec_append(req, msg);
 
         /* send via socket */
-        cout << "comm!!!!" << endl;
-        vec res = communicate(req);
-        return res;
+        LOG_DEBUG << "comm!!!!";
+        return communicate(req);
     }
 
     vec set_msg(const string &key, const string &val) {
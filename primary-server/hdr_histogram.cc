@@ -0,0 +1,116 @@
+/**
+ * @file hdr_histogram.cc
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "hdr_histogram.h"
+
+using namespace std;
+
+/**
+ * @brief Construct an empty histogram.  Values below twice 10^digits each get
+ * a bucket of their own; above that, every power of two is cut into the same
+ * number of buckets, so each bucket is narrower than 10^-digits of its value.
+ *
+ * @param highest The highest value to track; larger values count as this
+ * @param digits  Significant decimal digits to keep, 1 to 5
+ */
+HdrHistogram::HdrHistogram(uint64_t highest, int digits)
+    : highest(std::max<uint64_t>(highest, 2)), total(0), max_value(0) {
+    digits = min(std::max(digits, 1), 5);
+    half_magnitude = (int)ceil(log2(2 * pow(10.0, digits))) - 1;
+    half_count = 1ull << half_magnitude;
+    n_counts = index_of(this->highest) + 1;
+    counts.reset(new atomic<uint64_t>[n_counts]());
+}
+
+/** The index of the bucket that counts v */
+size_t HdrHistogram::index_of(uint64_t v) const {
+    /* which power of two (beyond the first 2 * half_count values), then where in it */
+    int bucket = 63 - __builtin_clzll(v | (2 * half_count - 1)) - half_magnitude;
+    uint64_t sub = v >> bucket;
+    return ((size_t)(bucket + 1) << half_magnitude) + (sub - half_count);
+}
+
+/** The lowest value that bucket index i counts */
+uint64_t HdrHistogram::value_at_index(size_t i) const {
+    int bucket = (int)(i >> half_magnitude) - 1;
+    uint64_t sub = (i & (half_count - 1)) + half_count;
+    if (bucket < 0) {
+        bucket = 0;
+        sub -= half_count;
+    }
+    return sub << bucket;
+}
+
+/** The highest value that bucket index i counts */
+uint64_t HdrHistogram::highest_equivalent(size_t i) const {
+    int bucket = std::max((int)(i >> half_magnitude) - 1, 0);
+    return value_at_index(i) + (1ull << bucket) - 1;
+}
+
+/** Count one value.  Only one thread may record at a time. */
+void HdrHistogram::record(uint64_t v) {
+    v = min(v, highest);
+    bump(counts[index_of(v)], 1);
+    bump(total, 1);
+    if (v > max_value.load(memory_order_relaxed))
+        max_value.store(v, memory_order_relaxed);
+}
+
+/**
+ * @brief Add another histogram with the same settings into this one.  The
+ * other may be recording meanwhile, so its total is taken as the sum of the
+ * counts that were seen.
+ */
+void HdrHistogram::add(const HdrHistogram &other) {
+    uint64_t seen = 0;
+    for (size_t i = 0; i < n_counts && i < other.n_counts; i++) {
+        uint64_t c = other.counts[i].load(memory_order_relaxed);
+        if (c) {
+            bump(counts[i], c);
+            seen += c;
+        }
+    }
+    bump(total, seen);
+    max_value.store(std::max(max(), other.max()), memory_order_relaxed);
+}
+
+/** The mean of the values counted, to the histogram's precision */
+double HdrHistogram::mean() const {
+    if (count() == 0) return 0;
+    double sum = 0;
+    for (size_t i = 0; i < n_counts; i++) {
+        uint64_t c = counts[i].load(memory_order_relaxed);
+        if (c) sum += c * (value_at_index(i) + highest_equivalent(i)) / 2.0;
+    }
+    return sum / count();
+}
+
+/**
+ * @brief The value that pct percent of the values are at or below, to the
+ * histogram's precision
+ */
+uint64_t HdrHistogram::value_at_percentile(double pct) const {
+    if (count() == 0) return 0;
+    uint64_t want = std::max<uint64_t>(1, (uint64_t)ceil(min(pct, 100.0) / 100 * count()));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < n_counts; i++) {
+        seen += counts[i].load(memory_order_relaxed);
+        if (seen >= want) return min(highest_equivalent(i), max());
+    }
+    return max();
+}
+
+/**
+ * @brief How many values are at or below v, to the histogram's precision:
+ * the values in v's own bucket count too
+ */
+uint64_t HdrHistogram::count_at_or_below(uint64_t v) const {
+    size_t last = std::min(index_of(min(v, highest)), n_counts - 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i <= last; i++) seen += counts[i].load(memory_order_relaxed);
+    return seen;
+}
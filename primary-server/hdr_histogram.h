@@ -0,0 +1,95 @@
+/**
+ * @file hdr_histogram.h
+ */
+
+#ifndef HDR_HISTOGRAM_DEF
+#define HDR_HISTOGRAM_DEF
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+/**
+ * @brief HdrHistogram counts values (such as latencies in nanoseconds) in
+ * buckets whose width grows with the value, as in Gil Tene's HdrHistogram:
+ * every value up to the highest trackable one is kept to a fixed number of
+ * significant digits, in a fixed amount of memory, with O(1) work per value.
+ *
+ * The counts are atomic, so that one thread can record into a histogram while
+ * others add() it into theirs, without a lock: each thread keeps its own, and
+ * they are merged when someone asks.  Only one thread may record into a
+ * histogram at a time.
+ */
+class HdrHistogram {
+public:
+  /**
+   * @brief Construct an empty histogram
+   *
+   * @param highest The highest value to track; larger values count as this
+   * @param digits  Significant decimal digits to keep, 1 to 5
+   */
+  HdrHistogram(uint64_t highest = 3600ull * 1000 * 1000 * 1000, int digits = 3);
+
+  HdrHistogram(const HdrHistogram &) = delete;
+  HdrHistogram &operator=(const HdrHistogram &) = delete;
+
+  /** Count one value.  Only one thread may record at a time. */
+  void record(uint64_t v);
+
+  /** Add another histogram with the same settings into this one */
+  void add(const HdrHistogram &other);
+
+  /** How many values have been counted */
+  uint64_t count() const { return total.load(std::memory_order_relaxed); }
+
+  /** The largest value counted */
+  uint64_t max() const { return max_value.load(std::memory_order_relaxed); }
+
+  /** The mean of the values counted, to the histogram's precision */
+  double mean() const;
+
+  /**
+   * @brief The value that pct percent of the values are at or below, to the
+   * histogram's precision
+   */
+  uint64_t value_at_percentile(double pct) const;
+
+  /**
+   * @brief How many values are at or below v, to the histogram's precision:
+   * the values in v's own bucket count too
+   */
+  uint64_t count_at_or_below(uint64_t v) const;
+
+private:
+  /** The range of values that bucket index i counts */
+  uint64_t value_at_index(size_t i) const;
+  uint64_t highest_equivalent(size_t i) const;
+
+  /** The index of the bucket that counts v */
+  size_t index_of(uint64_t v) const;
+
+  /** Bump a counter that only this thread writes */
+  static void bump(std::atomic<uint64_t> &c, uint64_t n) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  /** The highest value tracked */
+  uint64_t highest;
+
+  /** log2 of half the buckets per power of two, and half the buckets */
+  int half_magnitude;
+  uint64_t half_count;
+
+  /** The counts themselves, and how many there are */
+  std::unique_ptr<std::atomic<uint64_t>[]> counts;
+  size_t n_counts;
+
+  /** How many values, and the largest */
+  std::atomic<uint64_t> total;
+  std::atomic<uint64_t> max_value;
+};
+
+#endif
@@ -0,0 +1,233 @@
+/**
+ * @file latency.cc
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "hdr_histogram.h"
+#include "latency.h"
+#include "metrics.h"
+
+using namespace std;
+
+/** The highest latency tracked (a minute), and the significant digits kept */
+static const uint64_t LAT_HIGHEST = 60ull * 1000 * 1000 * 1000;
+static const int LAT_DIGITS = 2;
+
+/** The names of the series, for the report */
+static const char *LAT_NAMES[LAT_SERIES] = {"kvi",     "kvg",     "kvd",     "ror",     "multi",
+                                            "other",   "header",  "body",    "parse",   "storage",
+                                            "persist", "replicate", "send"};
+
+/** The commands and stages of the series, as Prometheus labels */
+static const char *LAT_LABELS[LAT_SERIES] = {"cmd=\"kvi\"",       "cmd=\"kvg\"",     "cmd=\"kvd\"",
+                                             "cmd=\"ror\"",       "cmd=\"multi\"",   "cmd=\"other\"",
+                                             "stage=\"header\"",  "stage=\"body\"",  "stage=\"parse\"",
+                                             "stage=\"storage\"", "stage=\"persist\"", "stage=\"replicate\"",
+                                             "stage=\"send\""};
+
+/** The first series that is a stage rather than a command */
+static const int LAT_FIRST_STAGE = LAT_HEADER;
+
+/** Bucket bounds of the Prometheus histograms, in seconds */
+static const double LAT_BOUNDS[] = {0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001,
+                                    0.0025,  0.005,    0.01,    0.025,  0.05,    0.1,    0.25,
+                                    0.5,     1};
+
+/** One thread's histograms, one per series, and its counters */
+struct lat_thread_t {
+    unique_ptr<HdrHistogram> series[LAT_SERIES];
+    atomic<uint64_t> counters[STAT_COUNTERS] = {};
+
+    lat_thread_t() {
+        for (auto &h : series) h.reset(new HdrHistogram(LAT_HIGHEST, LAT_DIGITS));
+    }
+};
+
+/**
+ * The histograms of every thread that has recorded, and those whose threads
+ * have exited, which the next new thread takes over.  The lock is only taken
+ * the first time a thread records, and to merge.
+ */
+struct lat_registry_t {
+    mutex lock;
+    vector<unique_ptr<lat_thread_t>> all;
+    vector<lat_thread_t *> unowned;
+};
+
+/** The registry, which is never destroyed, since detached threads may still record while the program exits */
+static lat_registry_t &registry() {
+    static lat_registry_t *r = new lat_registry_t();
+    return *r;
+}
+
+/** A thread's claim on a set of histograms, which it gives up when it exits */
+struct lat_claim_t {
+    lat_thread_t *mine = nullptr;
+
+    ~lat_claim_t() {
+        if (mine) {
+            lock_guard<mutex> guard(registry().lock);
+            registry().unowned.push_back(mine);
+        }
+    }
+
+    /** The calling thread's histograms, claimed on first use */
+    lat_thread_t &get() {
+        if (mine == nullptr) {
+            lat_registry_t &r = registry();
+            lock_guard<mutex> guard(r.lock);
+            if (!r.unowned.empty()) {
+                mine = r.unowned.back();
+                r.unowned.pop_back();
+            } else {
+                r.all.emplace_back(new lat_thread_t());
+                mine = r.all.back().get();
+            }
+        }
+        return *mine;
+    }
+};
+
+static thread_local lat_claim_t claim;
+
+/** The innermost scope the calling thread has open */
+static thread_local LatencyScope *current = nullptr;
+
+/**
+ * @brief Count one latency in the calling thread's histogram of a series.
+ * Each thread records into histograms of its own, so this takes no lock.
+ *
+ * @param s  The series
+ * @param ns The latency, in nanoseconds
+ */
+void lat_record(lat_series_t s, uint64_t ns) {
+    claim.get().series[s]->record(ns);
+}
+
+/**
+ * @brief Count events in the calling thread's counters, which take no lock
+ *
+ * @param c The counter
+ * @param n How many events
+ */
+void stat_add(stat_counter_t c, uint64_t n) {
+    atomic<uint64_t> &counter = claim.get().counters[c];
+    counter.store(counter.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/** Every thread's histograms and counters, added up */
+struct lat_merged_t {
+    vector<unique_ptr<HdrHistogram>> series;
+    uint64_t counters[STAT_COUNTERS] = {};
+};
+
+/** Add up every thread's histograms and counters, including those of threads that have exited */
+static void lat_merge(lat_merged_t &merged) {
+    for (int s = 0; s < LAT_SERIES; s++) merged.series.emplace_back(new HdrHistogram(LAT_HIGHEST, LAT_DIGITS));
+    lat_registry_t &r = registry();
+    lock_guard<mutex> guard(r.lock);
+    for (auto &t : r.all) {
+        for (int s = 0; s < LAT_SERIES; s++) merged.series[s]->add(*t->series[s]);
+        for (int c = 0; c < STAT_COUNTERS; c++) merged.counters[c] += t->counters[c].load(memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Merge every thread's histograms, and describe each series that has
+ * counted something: how many, the mean, some percentiles and the largest, in
+ * microseconds
+ *
+ * @return The report, as text with one line per series
+ */
+string lat_report() {
+    lat_merged_t merged;
+    lat_merge(merged);
+
+    ostringstream out;
+    out << fixed << setprecision(1);
+    out << left << setw(10) << "series" << right << setw(12) << "count" << setw(10) << "mean" << setw(10) << "p50"
+        << setw(10) << "p90" << setw(10) << "p99" << setw(10) << "p99.9" << setw(10) << "max" << "  (us)\n";
+    for (int s = 0; s < LAT_SERIES; s++) {
+        const HdrHistogram &h = *merged.series[s];
+        if (h.count() == 0) continue;
+        out << left << setw(10) << LAT_NAMES[s] << right << setw(12) << h.count() << setw(10) << h.mean() / 1000;
+        for (double pct : {50.0, 90.0, 99.0, 99.9}) out << setw(10) << h.value_at_percentile(pct) / 1000.0;
+        out << setw(10) << h.max() / 1000.0 << "\n";
+    }
+    return out.str();
+}
+
+/** Add one series to a Prometheus histogram family, in seconds */
+static void lat_histogram(MetricsText &out, const string &name, const HdrHistogram &h, const string &label) {
+    for (double bound : LAT_BOUNDS) {
+        char le[32];
+        snprintf(le, sizeof(le), "%g", bound);
+        out.sample(name + "_bucket", h.count_at_or_below((uint64_t)(bound * 1e9)), label + ",le=\"" + le + "\"");
+    }
+    out.sample(name + "_bucket", h.count(), label + ",le=\"+Inf\"");
+    out.sample(name + "_sum", h.mean() * h.count() / 1e9, label);
+    out.sample(name + "_count", h.count(), label);
+}
+
+/**
+ * @brief Merge every thread's histograms and counters, and add them to a
+ * Prometheus page: requests and their latency per command, the latency of
+ * each stage, errors and connections.  Latencies are to the histograms'
+ * precision, and each bucket counts the values within that precision of its
+ * bound.
+ *
+ * @param out The page
+ */
+void lat_metrics(MetricsText &out) {
+    lat_merged_t merged;
+    lat_merge(merged);
+
+    out.family("kv_requests_total", "counter", "Requests answered, by command");
+    for (int s = 0; s < LAT_FIRST_STAGE; s++) out.sample("kv_requests_total", merged.series[s]->count(), LAT_LABELS[s]);
+
+    out.family("kv_request_duration_seconds", "histogram",
+               "From the first byte of a request to the last byte of its response, by command");
+    for (int s = 0; s < LAT_FIRST_STAGE; s++)
+        lat_histogram(out, "kv_request_duration_seconds", *merged.series[s], LAT_LABELS[s]);
+
+    out.family("kv_stage_duration_seconds", "histogram", "Time requests spend in each stage, less nested stages");
+    for (int s = LAT_FIRST_STAGE; s < LAT_SERIES; s++)
+        lat_histogram(out, "kv_stage_duration_seconds", *merged.series[s], LAT_LABELS[s]);
+
+    out.family("kv_errors_total", "counter", "Error responses, and connections dropped for a bad request");
+    out.sample("kv_errors_total", merged.counters[STAT_ERR_KEY], "kind=\"key\"");
+    out.sample("kv_errors_total", merged.counters[STAT_ERR_INVALID], "kind=\"invalid\"");
+    out.sample("kv_errors_total", merged.counters[STAT_BAD_REQUEST], "kind=\"bad_request\"");
+
+    out.family("kv_connections_opened_total", "counter", "Client connections accepted");
+    out.sample("kv_connections_opened_total", merged.counters[STAT_CONN_OPENED]);
+    out.family("kv_connections_closed_total", "counter", "Client connections closed");
+    out.sample("kv_connections_closed_total", merged.counters[STAT_CONN_CLOSED]);
+    out.family("kv_connections", "gauge", "Client connections open now");
+    /* a connection may close between reading the two counters */
+    uint64_t opened = merged.counters[STAT_CONN_OPENED], closed = merged.counters[STAT_CONN_CLOSED];
+    out.sample("kv_connections", opened > closed ? opened - closed : 0);
+}
+
+/** Start timing a stage */
+LatencyScope::LatencyScope(lat_series_t s) : series(s), start(lat_now()), outer(current) { current = this; }
+
+/**
+ * @brief Record the stage now, less the stages nested in it.  Scopes close
+ * innermost first, so this must be the innermost open scope.
+ */
+void LatencyScope::done() {
+    if (recorded) return;
+    recorded = true;
+    uint64_t spent = lat_now() - start;
+    lat_record(series, spent - nested);
+    if (outer) outer->nested += spent;
+    current = outer;
+}
@@ -0,0 +1,139 @@
+/**
+ * @file latency.h
+ */
+
+#ifndef LATENCY_DEF
+#define LATENCY_DEF
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <time.h>
+
+/**
+ * The latencies the server keeps a histogram of.  The first few are end to
+ * end, per command: from the first byte of a request arriving to the last
+ * byte of its response being sent.  The rest are the stages a request goes
+ * through on the way.
+ */
+enum lat_series_t {
+  LAT_KVI,
+  LAT_KVG,
+  LAT_KVD,
+  LAT_ROR,
+  LAT_MULTI,
+  /** KAL, SHM, HELLO, STA and anything unknown */
+  LAT_OTHER,
+  /** From the first byte of a request to the last of its header */
+  LAT_HEADER,
+  /** From the end of the header to the last byte of the body */
+  LAT_BODY,
+  /** Turning a v1 body into a key and value */
+  LAT_PARSE,
+  /** The storage operation, including waiting for the lock, but not persist or replicate */
+  LAT_STORAGE,
+  /** Appending to the log */
+  LAT_PERSIST,
+  /** Forwarding an update to the backup and waiting for its answer */
+  LAT_REPLICATE,
+  /** From the first of a run of responses being queued to the last being sent */
+  LAT_SEND,
+  LAT_SERIES
+};
+
+/** Events the server counts, besides the requests in each series */
+enum stat_counter_t {
+  STAT_CONN_OPENED,
+  STAT_CONN_CLOSED,
+  /** Responses that said the key was missing, or already there */
+  STAT_ERR_KEY,
+  /** Responses that said the request was invalid */
+  STAT_ERR_INVALID,
+  /** Connections dropped for a header that could not be parsed */
+  STAT_BAD_REQUEST,
+  STAT_COUNTERS
+};
+
+/** Nanoseconds on the monotonic clock */
+inline uint64_t lat_now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Count one latency in the calling thread's histogram of a series.
+ * Each thread records into histograms of its own, so this takes no lock.
+ *
+ * @param s  The series
+ * @param ns The latency, in nanoseconds
+ */
+void lat_record(lat_series_t s, uint64_t ns);
+
+/**
+ * @brief Count events in the calling thread's counters, which take no lock
+ *
+ * @param c The counter
+ * @param n How many events
+ */
+void stat_add(stat_counter_t c, uint64_t n = 1);
+
+/**
+ * @brief Merge every thread's histograms, and describe each series that has
+ * counted something: how many, the mean, some percentiles and the largest, in
+ * microseconds
+ *
+ * @return The report, as text with one line per series
+ */
+std::string lat_report();
+
+class MetricsText;
+
+/**
+ * @brief Merge every thread's histograms and counters, and add them to a
+ * Prometheus page: requests and their latency per command, the latency of
+ * each stage, errors and connections
+ *
+ * @param out The page
+ */
+void lat_metrics(MetricsText &out);
+
+/**
+ * @brief LatencyScope times a stage of a request, from its construction to
+ * its destruction, and records it in the stage's series.  Scopes nest: the
+ * time spent in a scope that is opened inside another is taken off the outer
+ * one, so the storage stage does not also count the persist inside it.
+ * A stage that ends before the end of its block can be recorded early, with
+ * done().
+ */
+class LatencyScope {
+public:
+  /** Start timing a stage */
+  LatencyScope(lat_series_t s);
+
+  /** Record the stage, less the stages nested in it, unless done() already has */
+  ~LatencyScope() { done(); }
+
+  /** Record the stage now, less the stages nested in it */
+  void done();
+
+  LatencyScope(const LatencyScope &) = delete;
+  LatencyScope &operator=(const LatencyScope &) = delete;
+
+private:
+  /** The stage */
+  lat_series_t series;
+
+  /** When it started, and how much of it was spent in nested stages */
+  uint64_t start;
+  uint64_t nested = 0;
+
+  /** The scope this one is nested in, or nullptr */
+  LatencyScope *outer;
+
+  /** Has the stage been recorded? */
+  bool recorded = false;
+};
+
+#endif
@@ -0,0 +1,57 @@
+/**
+ * @file metrics.h
+ */
+
+#ifndef METRICS_DEF
+#define METRICS_DEF
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/**
+ * @brief MetricsText builds a page in the Prometheus text exposition format
+ * (version 0.0.4): each metric family is introduced by its HELP and TYPE
+ * lines, and followed by its samples, one per line.
+ */
+class MetricsText {
+public:
+  /**
+   * @brief Start a metric family
+   *
+   * @param name The family's name, such as kv_requests_total
+   * @param type counter, gauge or histogram
+   * @param help One line saying what it counts
+   */
+  void family(const std::string &name, const char *type, const char *help);
+
+  /**
+   * @brief Add a sample to the family just started
+   *
+   * @param name   The sample's name, which for a histogram has a suffix
+   * @param v      The value
+   * @param labels Labels without the braces, such as cmd="kvi", or ""
+   */
+  void sample(const std::string &name, double v, const std::string &labels = "");
+
+  /** The page so far */
+  const std::string &str() const { return text; }
+
+private:
+  std::string text;
+};
+
+/**
+ * @brief Serve metrics over HTTP on a listening socket, from a thread of its
+ * own, so that a scrape never waits behind clients and clients never wait
+ * behind a scrape.  Each connection gets one page, from render(), at GET
+ * /metrics (or /), and is then closed.
+ *
+ * @param sd     The listening socket, TCP or Unix
+ * @param render Builds the page, and may be called from the serving thread at any time
+ */
+void metrics_serve(int sd, std::function<std::string()> render);
+
+#endif
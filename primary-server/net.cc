@@ -2,7 +2,12 @@
  * @file net.cc
  */
 
+#include <sys/sendfile.h>
+#include <sys/un.h>
+
+#include "log.h"
 #include "net.h"
+#include "protocol.h"
 #include "server_parsing.h"
 
 using namespace std;
@@ -26,9 +31,11 @@ void error_message_and_exit(std::size_t code, std::size_t err, const char *prefi
 /**
  * Create a server socket that we can use to listen for new incoming requests
  *
- * @param port The port on which the program should listen for new connections
+ * @param port      The port on which the program should listen for new connections
+ * @param reuseport Set SO_REUSEPORT, so that several sockets can listen on the
+ *                  same port and the kernel spreads connections across them
  */
-int create_server_socket(std::size_t port) {    
+int create_server_socket(std::size_t port, bool reuseport) {    
     /** A socket is just a kind of file descriptor.  We want our connections to use IPV4 and TCP: */
     int sd = socket(AF_INET, SOCK_STREAM, 0);
     if (sd < 0) {
@@ -40,6 +47,10 @@ int create_server_socket(std::size_t port) {
         close(sd);
         error_message_and_exit(0, errno, "setsockopt(SO_REUSEADDR) failed: ");
     }
+    if (reuseport && setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &tmp, sizeof(int)) < 0) {
+        close(sd);
+        error_message_and_exit(0, errno, "setsockopt(SO_REUSEPORT) failed: ");
+    }
 
     /** Bind the socket to the server's address and the provided port, and then start listening for connections */
     sockaddr_in addr;
@@ -51,7 +62,40 @@ int create_server_socket(std::size_t port) {
         close(sd);
         error_message_and_exit(0, errno, "Error binding socket to local address: ");
     }
-    if (listen(sd, 0) < 0) {
+    /** A burst of clients should queue up in the kernel rather than be refused */
+    if (listen(sd, SOMAXCONN) < 0) {
+        close(sd);
+        error_message_and_exit(0, errno, "Error listening on socket: ");
+    }
+    return sd;
+}
+
+/**
+ * Create a Unix domain server socket, for clients on the same host.  Their
+ * requests skip the TCP/IP stack, which makes each one cheaper.  Any socket
+ * file left behind at path by an earlier run is removed first.
+ *
+ * @param path The file system path of the socket
+ */
+int create_unix_server_socket(const std::string &path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        error_message_and_exit(0, ENAMETOOLONG, "Error making unix socket: ");
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int sd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sd < 0) {
+        error_message_and_exit(0, errno, "Error making unix socket: ");
+    }
+    /** Unlike a port, a socket file outlives the server, so clear out the last one */
+    unlink(path.c_str());
+    if (bind(sd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sd);
+        error_message_and_exit(0, errno, "Error binding unix socket: ");
+    }
+    if (listen(sd, SOMAXCONN) < 0) {
         close(sd);
         error_message_and_exit(0, errno, "Error listening on socket: ");
     }
@@ -157,7 +201,7 @@ void echo_server(int sd, bool verbose) {
  */
 void sys_error(int err, const char *prefix) {
     char buf[1024];
-    cerr << prefix << " " << strerror_r(err, buf, sizeof(buf)) << endl;
+    LOG_ERROR << prefix << " " << strerror_r(err, buf, sizeof(buf));
 }
 
 /**
@@ -202,8 +246,8 @@ int reliable_get_to_eof_or_n(int sd, vec::iterator pos, int amnt) {
  * @return A vector with the data that was read, or an empty vector on error 
  */
 vec reliable_get_to_eof(int sd) {
-    // set up the initial buffer
-    vec res(16);
+    // set up the initial buffer, big enough that most responses need one recv()
+    vec res(4096);
     int recd = 0;
     // start reading.  Double the buffer any time we fill up
     while (true) {
@@ -232,38 +276,26 @@ vec reliable_get_to_eof(int sd) {
 }
 
 /**
- * @brief Given a listening socket, start calling accept() on it to get new
- * connections.  Each time a connection comes in, use the provided handler to
- * process the request.  Note that this is not multithreaded.  Only one client
- * will be served at a time.
+ * @brief Read one response from a persistent connection: a status byte, a
+ * 4-byte length, then that many bytes of payload
  * 
- * @param sd      The socket file descriptor on which to call accept
- * @param handler A function to call when a new connection comes in
+ * @param sd     The socket from which to read
+ * @param status Set to the status byte of the response
+ * @param res    The vector into which the payload should go
+ * @return false if the socket closed or failed before a whole response
+ *         arrived, true otherwise
  */
-void accept_client(int sd, function<bool(int)> handler) {
-    // Use accept() to wait for a client to connect.  When it connects, service
-    // it.  When it disconnects, then and only then will we accept a new client.
-    while (true) {
-        cout << "Waiting for a client to connect...\n";
-        sockaddr_in clientAddr = {0};
-        socklen_t clientAddrSize = sizeof(clientAddr);
-        int connSd = accept(sd, (sockaddr *)&clientAddr, &clientAddrSize);
-        if (connSd < 0) {
-            close(sd);
-            sys_error(errno, "Error accepting request from client: ");
-            return;
-        }
-        char clientname[1024];
-        cout << "Connected to "
-             << inet_ntop(AF_INET, &clientAddr.sin_addr, clientname,
-                          sizeof(clientname))
-             << endl;
-        bool done = handler(connSd);
-        // NB: ignore errors in close()
-        close(connSd);
-        if (done)
-            return;
-    }
+bool reliable_get_framed(int sd, unsigned char &status, vec &res) {
+    vec head(LEN_FRAME);
+    if (reliable_get_to_eof_or_n(sd, head.begin(), LEN_FRAME) != LEN_FRAME)
+        return false;
+    status = head[0];
+    int n;
+    memcpy(&n, head.data() + 1, sizeof(int));
+    if (n < 0)
+        return false;
+    res.resize(n);
+    return reliable_get_to_eof_or_n(sd, res.begin(), n) == n;
 }
 
 /**
@@ -280,7 +312,8 @@ bool reliable_send(int sd, const unsigned char *bytes, int len) {
     const unsigned char *next_byte = bytes;
     int remain = len;
     while (remain) {
-        int sent = send(sd, next_byte, remain, 0);
+        // NB: MSG_NOSIGNAL, so that a peer that went away is an error, not a SIGPIPE
+        int sent = send(sd, next_byte, remain, MSG_NOSIGNAL);
         // NB: Sending 0 bytes means the server closed the socket, and we should
         //     fail, so it's only EINTR that is recoverable.
         if (sent <= 0) {
@@ -318,6 +351,35 @@ bool send_reliably(int sd, const string &msg) {
     return reliable_send(sd, (const unsigned char *)msg.c_str(), msg.length());
 }
 
+/**
+ * @brief Send part of a file over a socket with sendfile(), so that the bytes
+ * go straight from the page cache to the socket without a user-space copy.
+ * 
+ * @param sd  The socket on which to send
+ * @param fd  The file descriptor from which to read
+ * @param off The offset in the file at which to start
+ * @param len The number of bytes to send
+ * @return True if all len bytes were sent, false otherwise 
+ */
+bool reliable_sendfile(int sd, int fd, off_t off, size_t len) {
+    // Like reliable_send(), be ready for short transfers.  sendfile() advances
+    // off for us, and leaves the file's own offset alone.
+    size_t remain = len;
+    while (remain) {
+        ssize_t sent = sendfile(sd, fd, &off, remain);
+        // NB: 0 bytes means the file got shorter than we expected
+        if (sent <= 0) {
+            if (sent < 0 && errno == EINTR)
+                continue;
+            if (sent < 0)
+                sys_error(errno, "Error in sendfile():");
+            return false;
+        }
+        remain -= sent;
+    }
+    return true;
+}
+
 /**
  * Connect to a server so that we can have bidirectional communication on the
  * socket (represented by a file descriptor) that this function returns
@@ -345,11 +407,13 @@ int connect_to_server(std::string hostname, std::size_t port) {
     if (sd < 0) {
         //error_message_and_exit(0, errno, "Error making client socket: ");
         sys_error(errno, "Error making client socket: ");
+        return -1;
     }
     if (connect(sd, (sockaddr *)&addr, sizeof(addr)) < 0) {
         close(sd);
         //error_message_and_exit(0, errno, "Error connecting socket to address: ");
         sys_error(errno, "Error connecting socket to address: ");
+        return -1;
     }
     return sd;
 }
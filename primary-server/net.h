@@ -55,9 +55,20 @@ void echo_server(int, bool);
 /**
  * Create a server socket that we can use to listen for new incoming requests
  *
- * @param port The port on which the program should listen for new connections
+ * @param port      The port on which the program should listen for new connections
+ * @param reuseport Set SO_REUSEPORT, so that several sockets can listen on the
+ *                  same port and the kernel spreads connections across them
  */
-int create_server_socket(std::size_t);
+int create_server_socket(std::size_t port, bool reuseport = false);
+
+/**
+ * Create a Unix domain server socket, for clients on the same host.  Their
+ * requests skip the TCP/IP stack, which makes each one cheaper.  Any socket
+ * file left behind at path by an earlier run is removed first.
+ *
+ * @param path The file system path of the socket
+ */
+int create_unix_server_socket(const std::string &path);
 
 /**
  * @brief Print an error message that combines some application-specific text with the
@@ -88,15 +99,16 @@ int reliable_get_to_eof_or_n(int sd, vec::iterator pos, int amnt);
 vec reliable_get_to_eof(int sd);
 
 /**
- * @brief Given a listening socket, start calling accept() on it to get new
- * connections.  Each time a connection comes in, use the provided handler to
- * process the request.  Note that this is not multithreaded.  Only one client
- * will be served at a time.
+ * @brief Read one response from a persistent connection: a status byte, a
+ * 4-byte length, then that many bytes of payload
  * 
- * @param sd      The socket file descriptor on which to call accept
- * @param handler A function to call when a new connection comes in
+ * @param sd     The socket from which to read
+ * @param status Set to the status byte of the response
+ * @param res    The vector into which the payload should go
+ * @return false if the socket closed or failed before a whole response
+ *         arrived, true otherwise
  */
-void accept_client(int sd, std::function<bool(int)> handler);
+bool reliable_get_framed(int sd, unsigned char &status, vec &res);
 
 /**
  * @brief Internal method to send a buffer of data over a socket.
@@ -126,6 +138,18 @@ bool send_reliably(int sd, const vec &msg);
  */
 bool send_reliably(int sd, const std::string &msg);
 
+/**
+ * @brief Send part of a file over a socket with sendfile(), so that the bytes
+ * go straight from the page cache to the socket without a user-space copy.
+ * 
+ * @param sd  The socket on which to send
+ * @param fd  The file descriptor from which to read
+ * @param off The offset in the file at which to start
+ * @param len The number of bytes to send
+ * @return True if all len bytes were sent, false otherwise 
+ */
+bool reliable_sendfile(int sd, int fd, off_t off, size_t len);
+
 /**
  * @brief Connect to primary or backup server
  *
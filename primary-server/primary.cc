@@ -1,5 +1,9 @@
 #include "net.h"
+#include "event_loop.h"
+#include "uring_loop.h"
 #include "config_t.h"
+#include "latency.h"
+#include "metrics.h"
 #include "server_parsing.h"
 #include "server_storage.h"
 
@@ -12,6 +16,17 @@ void usage() {
     cout << "  -s [string] Name of the server (probably 'localhost')" << endl;
     cout << "  -p [int]    Port number of the server" << endl;
     cout << "  -f [int]    Persistant file name" << endl;
+    cout << "  -i [string] Persistent index file name (optional)" << endl;
+    cout << "  -r [int]    Number of reactor threads (default 1).  Reads scale with it; updates" << endl;
+    cout << "              do not while a backup is attached, since each waits for the backup" << endl;
+    cout << "              on its reactor's thread, one at a time across reactors" << endl;
+    cout << "  -c          Pin each reactor thread to its own core" << endl;
+    cout << "  -u          Serve clients with io_uring instead of epoll" << endl;
+    cout << "  -U [string] Also listen on a Unix domain socket at this path" << endl;
+    cout << "  -a [int]    Serve Prometheus metrics over HTTP on this port" << endl;
+    cout << "  -A [string] Serve Prometheus metrics over HTTP on a Unix domain socket at this path" << endl;
+    cout << "  -T [int]    Seconds a client may idle between requests (default 60, 0 = forever)" << endl;
+    cout << "  -W [int]    Seconds a client may stall part way through a request or response (default 10, 0 = forever)" << endl;
     cout << "  -h          Print help (this message)" << endl;
 }
 
@@ -25,16 +40,46 @@ void usage() {
  */
 void parseargs(int argc, char** argv, config_t& config) {
     long opt;
-    while ((opt = getopt(argc, argv, "s:p:f:t:h")) != -1) {
+    while ((opt = getopt(argc, argv, "s:p:f:i:r:cuU:a:A:T:W:h")) != -1) {
         switch (opt) {
             case 's': config.server_name = std::string(optarg); break;
             case 'p': config.port = atoi(optarg); break;  
             case 'f': config.datafile = std::string(optarg); break;
+            case 'i': config.indexfile = std::string(optarg); break;
+            case 'r': config.reactors = max(1, atoi(optarg)); break;
+            case 'c': config.pin = true; break;
+            case 'u': config.uring = true; break;
+            case 'U': config.unix_path = std::string(optarg); break;
+            case 'a': config.admin_port = atoi(optarg); break;
+            case 'A': config.admin_path = std::string(optarg); break;
+            case 'T': config.idle_timeout = max(0, atoi(optarg)); break;
+            case 'W': config.io_timeout = max(0, atoi(optarg)); break;
             case 'h': usage(); break;
         }
     }
 }
 
+/**
+ * Build the page the admin listener serves: the request and stage latencies,
+ * errors and connections, and what the storage holds
+ *
+ * @param storage The Storage object the server serves
+ */
+string render_metrics(Storage &storage) {
+    MetricsText out;
+    lat_metrics(out);
+    Storage::stats_t st = storage.stats();
+    out.family("kv_keys", "gauge", "Keys stored");
+    out.sample("kv_keys", st.keys);
+    out.family("kv_log_bytes", "gauge", "Bytes in the log");
+    out.sample("kv_log_bytes", st.log_bytes);
+    if (st.replicate) {
+        out.family("kv_replication_lag_bytes", "gauge", "Bytes of the log the backup is not known to hold");
+        out.sample("kv_replication_lag_bytes", st.replication_lag);
+    }
+    return out.str();
+}
+
 int main(int argc, char **argv) {
     /** Parse command-line arguments */
     config_t args;
@@ -44,8 +89,16 @@ int main(int argc, char **argv) {
         exit(0);
     }
 
-    /** Set up server socket for listening */
-    int serverSd = create_server_socket(args.port);
+    /** Set up server sockets for listening, one per reactor */
+    vector<int> serverSds;
+    for (int i = 0; i < args.reactors; i++) {
+        serverSds.push_back(create_server_socket(args.port, args.reactors > 1));
+    }
+
+    /** Local clients get a Unix domain socket, served by a reactor of its own */
+    if (!args.unix_path.empty()) {
+        serverSds.push_back(create_unix_server_socket(args.unix_path));
+    }
 
     /** If the data file exists, load the data into a Storage object. Otherwise, create an empty Storage object */
     Storage storage(args.datafile);
@@ -53,11 +106,41 @@ int main(int argc, char **argv) {
     /** Initialize lazy list data structure */
     storage.init_lazylist();
 
+    /** Serve from a memory-mapped index instead of replaying the whole log */
+    if (!args.indexfile.empty() && !storage.use_index(args.indexfile)) {
+        exit(1);
+    }
+
     /** load data into storage if datafile exists */
     storage.load();
 
-    /** Accept client connections */
-    accept_client(serverSd, [&](int sd) {
-        return serve_client(sd, storage); 
-    });
+    /** Metrics for a scraper, answered by a thread of their own */
+    if (args.admin_port > 0) {
+        metrics_serve(create_server_socket(args.admin_port), [&]() { return render_metrics(storage); });
+    }
+    if (!args.admin_path.empty()) {
+        metrics_serve(create_unix_server_socket(args.admin_path), [&]() { return render_metrics(storage); });
+    }
+
+    /** Serve all clients from non-blocking event loops */
+    auto handler = [&](Connection &conn) {
+        return serve_client(conn, storage); 
+    };
+    /** Evict clients that idle or stall for too long */
+    timeouts_t timeouts;
+    timeouts.idle_ms = args.idle_timeout * 1000;
+    timeouts.io_ms = args.io_timeout * 1000;
+
+    auto loop = args.uring ? uring_loop : event_loop;
+    if (serverSds.size() == 1) {
+        loop(serverSds[0], handler, -1, timeouts);
+    } else {
+        run_reactors(serverSds, args.pin, handler, timeouts, loop);
+    }
+    if (!args.unix_path.empty()) {
+        unlink(args.unix_path.c_str());
+    }
+    if (!args.admin_path.empty()) {
+        unlink(args.admin_path.c_str());
+    }
 }
@@ -19,6 +19,28 @@ const string REQ_PVD = "PVD";
 const string REQ_DOR = "DOR";
 const string REQ_ROR = "ROR";
 
+/**
+ * Switch a connection to persistent mode.  From then on every response is
+ * framed (see ST_OK), the connection stays open for more requests until the
+ * client closes it, and the client may pipeline requests: it can send the next
+ * ones before the earlier responses arrive, which come back in order.
+ */
+const string REQ_KAL = "KAL";
+
+/**
+ * Move a client on the same host to a shared memory channel.  The body is the
+ * name of a segment the client created (see ShmChannel).  Once the server
+ * answers RES_OK, the client sends its requests through the channel instead,
+ * exactly as on a persistent connection.
+ */
+const string REQ_SHM = "SHM";
+
+/**
+ * Ask for the server's latency statistics (see latency.h).  The body is empty,
+ * and the response is a text table, framed on a persistent connection.
+ */
+const string REQ_STA = "STA";
+
 /** Response code to indicate that the command was successful */
 const string RES_OK = "TRUE";
 
@@ -26,3 +48,67 @@ const string RES_OK = "TRUE";
 const string RES_ERR_KEY = "FALSE";
 const string RES_ERR_INVALID = "INVALID";
 
+/**
+ * Response sent instead of serving a connection when the server is overloaded.
+ * It is sent as soon as the connection is accepted, unframed, and then the
+ * connection is closed: the client should back off and try again.
+ */
+const string RES_BUSY = "BUSY";
+
+/**
+ * Status byte that starts every framed response.  It is followed by the 4-byte
+ * length of the payload, and the payload itself: the value for KVG, the log
+ * for ROR, and nothing for the other commands.
+ */
+const unsigned char ST_OK = 0;
+
+/** Status byte of a framed RES_ERR_KEY */
+const unsigned char ST_ERR_KEY = 1;
+
+/** Status byte of a framed RES_ERR_INVALID */
+const unsigned char ST_ERR_INVALID = 2;
+
+/** Length of the status byte and payload length that start a framed response */
+const int LEN_FRAME = 5;
+
+/**
+ * Protocol v2 replaces the text header and decimal strings of v1 with fixed
+ * fields.  Every v2 request is LEN_V2_REQ bytes: PROTO_V2 (a magic byte that
+ * also names the version, and that no v1 command starts with), a 1-byte
+ * opcode, then the key and the value as 4-byte little-endian ints (the value
+ * is 0 for everything but OP_KVI).  Every response is framed as on a
+ * persistent connection (see ST_OK), and the payload of a found OP_KVG is the
+ * value as a 4-byte little-endian int.
+ *
+ * A client picks the protocol with a handshake: it sends OP_HELLO with the
+ * version it wants as the key, and the server answers with the version it
+ * speaks as the payload.  From then on the connection is persistent and
+ * speaks v2.  A client that never sends OP_HELLO keeps speaking v1.
+ */
+const unsigned char PROTO_V2 = 0xB2;
+
+/** Length of a v2 request */
+const int LEN_V2_REQ = 10;
+
+/** v2 opcodes */
+const unsigned char OP_HELLO = 0;
+const unsigned char OP_KVI = 1;
+const unsigned char OP_KVG = 2;
+const unsigned char OP_KVD = 3;
+const unsigned char OP_ROR = 4;
+
+/**
+ * Many v2 requests in one.  The key is how many, at most MAX_MULTI_OPS, and
+ * the request is followed by that many whole v2 requests, each of which must
+ * be OP_KVI, OP_KVG or OP_KVD.  The server runs them in order and sends one
+ * response, whose payload is LEN_MULTI_RES bytes per request: its status
+ * byte, then the value of a found OP_KVG as a 4-byte little-endian int (0 for
+ * everything else).
+ */
+const unsigned char OP_MULTI = 5;
+
+/** Most requests in one OP_MULTI */
+const int MAX_MULTI_OPS = 4096;
+
+/** Length of the result of each request in an OP_MULTI response */
+const int LEN_MULTI_RES = 5;
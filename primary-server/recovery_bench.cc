@@ -0,0 +1,305 @@
+/**
+ * @file recovery_bench.cc
+ *
+ * Crash-recovery harness for the primary's log.  For a range of log sizes it
+ * writes a log the way Storage::persist() does, damages it the way a crash
+ * would, and then times Storage::load() on it.  After every load it checks the
+ * recovered keys against a model of what the log held up to the damage, and
+ * that a record appended after recovery survives another restart.  The
+ * program exits non-zero if any recovered state is wrong, including when a
+ * record torn inside its key or value is replayed as if it were whole.
+ */
+
+#include <chrono>
+#include <cstring>
+#include <getopt.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "file.h"
+#include "server_storage.h"
+#include "vec.h"
+
+using namespace std;
+
+/** Size of one log record: an 8-byte command, then the key and the value */
+const size_t RECORD_LEN = 16;
+
+/** Command-line parameters of the harness */
+struct bench_config_t {
+    /** The largest log, in records.  Sizes go up by 10x from 1000. */
+    size_t max_records = 100000;
+
+    /** Largest number of distinct keys in a log */
+    int max_keys = 2048;
+
+    /** Directory in which to write the scratch log and index files */
+    string dir = "/tmp";
+
+    /** Also recover into the memory-mapped index */
+    bool index = true;
+
+    /** Seed for the generated workload and the damage */
+    unsigned seed = 1;
+
+    /** Is the user requesting a usage message? */
+    bool usage = false;
+};
+
+/** The ways a crash can damage the end of the log */
+enum fault_t { CLEAN, TRUNCATED, TORN, PARTIAL_SEGMENT };
+const char *fault_names[] = {"clean", "truncated", "torn", "partial-seg"};
+
+/**
+ * Display a help message to explain how the command-line parameters for this program work
+ */
+void usage() {
+    cout << "  -n [int]    Largest log size in records (default 100000)" << endl;
+    cout << "  -k [int]    Largest number of distinct keys (default 2048)" << endl;
+    cout << "  -d [string] Directory for scratch files (default /tmp)" << endl;
+    cout << "  -l          Only recover into the lazy list, not the index" << endl;
+    cout << "  -r [int]    Random seed" << endl;
+    cout << "  -h          Print help (this message)" << endl;
+}
+
+/**
+ * Parse the command-line arguments, and use them to populate the provided args
+ * object.
+ *
+ * @param argc   The number of command-line arguments passed to the program
+ * @param argv   The list of command-line arguments
+ * @param config The struct into which the parsed args should go
+ */
+void parseargs(int argc, char **argv, bench_config_t &config) {
+    long opt;
+    while ((opt = getopt(argc, argv, "n:k:d:lr:h")) != -1) {
+        switch (opt) {
+            case 'n': config.max_records = atol(optarg); break;
+            case 'k': config.max_keys = atoi(optarg); break;
+            case 'd': config.dir = string(optarg); break;
+            case 'l': config.index = false; break;
+            case 'r': config.seed = atoi(optarg); break;
+            case 'h': config.usage = true; break;
+        }
+    }
+}
+
+/**
+ * @brief Generate a log of n successful inserts and deletes, in the format
+ * written by Storage::persist()
+ *
+ * @param n    The number of records
+ * @param keys The number of distinct keys to draw from
+ * @param rng  The random number generator
+ * @return The log
+ */
+vec make_log(size_t n, int keys, mt19937 &rng) {
+    unordered_map<int, int> live;
+    uniform_int_distribution<int> pick(0, keys - 1);
+    vec disk;
+    disk.reserve(n * RECORD_LEN);
+    while (disk.size() < n * RECORD_LEN) {
+        int key = pick(rng);
+        // Only successful operations reach the log, so an insert of a live
+        // key becomes a delete, and vice versa
+        if (live.count(key)) {
+            live.erase(key);
+            vec_append(disk, string("KVDELETE"));
+            vec_append(disk, key);
+            vec_append(disk, 0);
+        } else {
+            int val = (int)rng();
+            live[key] = val;
+            vec_append(disk, string("KVINSERT"));
+            vec_append(disk, key);
+            vec_append(disk, val);
+        }
+    }
+    return disk;
+}
+
+/**
+ * @brief Compute the key/value pairs held by the first len bytes of a log
+ *
+ * @param disk The log
+ * @param len  The number of bytes that survived the crash
+ * @return The expected state
+ */
+unordered_map<int, int> model(const vec &disk, size_t len) {
+    unordered_map<int, int> live;
+    for (size_t n = 0; n + RECORD_LEN <= len; n += RECORD_LEN) {
+        int key, val;
+        memcpy(&key, disk.data() + n + 8, sizeof(int));
+        memcpy(&val, disk.data() + n + 12, sizeof(int));
+        if (memcmp(disk.data() + n, "KVINSERT", 8) == 0)
+            live[key] = val;
+        else
+            live.erase(key);
+    }
+    return live;
+}
+
+/**
+ * @brief Damage the tail of a log the way a crash would
+ *
+ * @param disk  The log, which is modified in place
+ * @param fault The kind of damage
+ * @param rng   The random number generator
+ * @return The number of bytes of the log that should be recovered
+ */
+size_t damage(vec &disk, fault_t fault, mt19937 &rng) {
+    size_t size = disk.size();
+    switch (fault) {
+        case CLEAN:
+            return size;
+        case TRUNCATED: {
+            // The process died in the middle of an append, leaving a prefix of
+            // the bytes it wrote, cut at any byte
+            size_t cut = uniform_int_distribution<size_t>(size / 2, size - 1)(rng);
+            disk.resize(cut);
+            return cut - cut % RECORD_LEN;
+        }
+        case TORN: {
+            // The file size reached the disk but its tail did not, so it reads
+            // back as zeros from some byte on, which may be inside the key or
+            // value of a record whose command survived
+            size_t from = uniform_int_distribution<size_t>(size / 2, size)(rng);
+            size_t rec = from - from % RECORD_LEN;
+            vec whole(disk.begin() + rec, disk.begin() + min(rec + RECORD_LEN, size));
+            memset(disk.data() + from, 0, size - from);
+            // A record whose lost bytes were zeros anyway is still whole
+            if (rec + RECORD_LEN <= size && memcmp(whole.data(), disk.data() + rec, RECORD_LEN) == 0)
+                return rec + RECORD_LEN;
+            return rec;
+        }
+        case PARTIAL_SEGMENT: {
+            // The log was preallocated, and its unused end is still zeros
+            size_t extra = uniform_int_distribution<size_t>(1, 64 * 1024)(rng);
+            disk.resize(size + extra, 0);
+            return size;
+        }
+    }
+    return size;
+}
+
+/**
+ * @brief Check that a Storage object holds exactly the expected keys
+ *
+ * @param storage  The recovered storage
+ * @param expected The expected key/value pairs
+ * @param keys     The number of distinct keys that the log drew from
+ * @return true if every key matches
+ */
+bool verify(Storage &storage, const unordered_map<int, int> &expected, int keys) {
+    for (int key = 0; key < keys; key++) {
+        pair<bool, vec> got = storage.kv_get(key);
+        auto it = expected.find(key);
+        if (got.first != (it != expected.end()))
+            return false;
+        if (got.first && string(got.second.begin(), got.second.end()) != to_string(it->second))
+            return false;
+    }
+    return true;
+}
+
+/** How a recovery turned out */
+enum outcome_t { RECOVERED, UNDETECTED, WRONG };
+const char *outcome_names[] = {"OK", "UNDETECTED", "FAIL"};
+
+/**
+ * @brief Recover one damaged log, time it, and check the result
+ *
+ * @return RECOVERED if the recovered state was correct, UNDETECTED if replay
+ *         took a torn record for a whole one, and WRONG otherwise
+ */
+outcome_t run_case(const bench_config_t &cfg, size_t records, fault_t fault, bool use_index, mt19937 &rng) {
+    int keys = min((int)records / 2, cfg.max_keys);
+    string logname = cfg.dir + "/recovery_bench." + to_string(getpid()) + ".log";
+    string idxname = logname + ".idx";
+    unlink(idxname.c_str());
+
+    vec disk = make_log(records, keys, rng);
+    size_t good = damage(disk, fault, rng);
+    unordered_map<int, int> expected = model(disk, good);
+    write_file(logname, (const char *)disk.data(), disk.size());
+
+    // A record torn after its command still looks whole, and the log has no
+    // checksum to tell it apart, so this is what replaying it would give
+    bool torn = good + RECORD_LEN <= disk.size() && (memcmp(disk.data() + good, "KVINSERT", 8) == 0 ||
+                                                     memcmp(disk.data() + good, "KVDELETE", 8) == 0);
+    unordered_map<int, int> replayed = torn ? model(disk, good + RECORD_LEN) : expected;
+
+    outcome_t outcome;
+    double secs;
+    {
+        Storage storage(logname, false);
+        storage.init_lazylist();
+        if (use_index) storage.use_index(idxname);
+        auto start = chrono::steady_clock::now();
+        storage.load();
+        secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (verify(storage, expected, keys))
+            outcome = RECOVERED;
+        else if (torn && verify(storage, replayed, keys))
+            outcome = UNDETECTED;
+        else
+            outcome = WRONG;
+        if (outcome == UNDETECTED) {
+            expected = replayed;
+            good += RECORD_LEN;
+        }
+
+        // New records must land right after the last good one
+        storage.kv_insert(keys, 42, false);
+        expected[keys] = 42;
+    }
+    {
+        Storage storage(logname, false);
+        storage.init_lazylist();
+        if (use_index) storage.use_index(idxname);
+        storage.load();
+        if (!verify(storage, expected, keys + 1)) outcome = WRONG;
+    }
+    unlink(logname.c_str());
+    unlink(idxname.c_str());
+
+    size_t recs = good / RECORD_LEN;
+    cout << "RESULT " << records << "\t" << fault_names[fault] << "\t" << (use_index ? "index" : "list")
+         << "\t" << recs << "\t" << disk.size() << "\t" << secs * 1000 << "\t"
+         << (secs > 0 ? recs / secs : 0) << "\t" << (secs > 0 ? good / secs / 1e6 : 0) << "\t"
+         << outcome_names[outcome] << endl;
+    return outcome;
+}
+
+int main(int argc, char **argv) {
+    /** Parse command-line arguments */
+    bench_config_t args;
+    parseargs(argc, argv, args);
+    if (args.usage) {
+        usage();
+        exit(0);
+    }
+
+    mt19937 rng(args.seed);
+    cout << "RESULT records\tfault\tbackend\treplayed\tfile_bytes\tms\trecords/s\tMB/s\tstate" << endl;
+    int counts[3] = {0, 0, 0};
+    for (size_t records = 1000; records <= args.max_records; records *= 10) {
+        for (fault_t fault : {CLEAN, TRUNCATED, TORN, PARTIAL_SEGMENT}) {
+            counts[run_case(args, records, fault, false, rng)]++;
+            if (args.index)
+                counts[run_case(args, records, fault, true, rng)]++;
+        }
+    }
+    if (counts[WRONG])
+        cout << counts[WRONG] << " recoveries were WRONG" << endl;
+    if (counts[UNDETECTED])
+        cout << counts[UNDETECTED] << " recoveries replayed a torn record as a whole one: the log "
+             << "has no per-record checksum to catch it" << endl;
+    if (!counts[WRONG] && !counts[UNDETECTED])
+        cout << "All recoveries correct" << endl;
+    return counts[WRONG] || counts[UNDETECTED] ? 1 : 0;
+}
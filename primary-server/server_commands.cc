@@ -1,23 +1,30 @@
+#include <cstring>
+#include <endian.h>
 #include <iostream>
 #include <string>
 
 #include "server_commands.h"
 #include "server_storage.h"
-#include "net.h"
+#include "connection.h"
+#include "latency.h"
+#include "log.h"
+#include "protocol.h"
 
 using namespace std;
 
-/* request API call from backup server */
-bool server_cmd_ror(int sd, const vec &req, Storage &storage) {
-    std::cout << "ROR!" << std::endl;
-    vec disk = storage.load_disk();
-    send_reliably(sd, disk);
+/* request API call from backup server; every request gets a reply, even if the log can't be opened */
+bool server_cmd_ror(Connection &conn, const vec &req, Storage &storage) {
+    LOG_INFO << "ROR!";
+    off_t len = 0;
+    int fd = storage.open_log(len);
+    if (fd >= 0) conn.reply_file(fd, len);
+    else conn.reply_status(ST_ERR_INVALID);
     return false;
 }
 
 
 /* update API call from primary server */
-bool server_cmd_pvi(int sd, const vec &req, Storage &storage) {
+bool server_cmd_pvi(Connection &conn, const vec &req, Storage &storage) {
     /** same as server_cmd_kvi */
     std::string key_str = "";
     std::string val_str = "";
@@ -34,20 +41,20 @@ bool server_cmd_pvi(int sd, const vec &req, Storage &storage) {
     int key = stoi(key_str);
     int val = stoi(val_str);
     /***************************/
-    std::cout << "PVI!" << std::endl;
-    std::cout << "key: " << key << std::endl;
-    std::cout << "val: " << val << std::endl;
+    LOG_DEBUG << "PVI!";
+    LOG_DEBUG << "key: " << key;
+    LOG_DEBUG << "val: " << val;
 
     /** Call insert() on storage object represented by hash table */
     bool from_primer = true;
     vec status = storage.kv_insert(key, val, from_primer);
 
     /** Send response to client */
-    send_reliably(sd, status);
+    conn.reply(status);
     return false;
 }
 
-bool server_cmd_pvd(int sd, const vec &req, Storage &storage) {
+bool server_cmd_pvd(Connection &conn, const vec &req, Storage &storage) {
     /** same as server_cmd_kvd */
     std::string key_str = "";
     unsigned char ulen[4] = {req.at(0), req.at(1), req.at(2), req.at(3)};
@@ -63,7 +70,7 @@ bool server_cmd_pvd(int sd, const vec &req, Storage &storage) {
     std::pair<bool, vec> result = storage.kv_delete(key, from_primer);
 
     /** Send response to client */
-    send_reliably(sd, result.second);
+    conn.reply(result.second);
     return false;
 }
 
@@ -71,22 +78,23 @@ bool server_cmd_pvd(int sd, const vec &req, Storage &storage) {
 /**
  * @brief Server command servering the Insert API call 
  * 
- * @param sd      The socket onto which the result should be written
+ * @param conn    The connection onto which the result should be queued
  * @param req     The unencrypted contents of the request
  * @param storage The Storage object
  * @return        false, to indicate that the server shouldn't stop 
  */
-bool server_cmd_kvi(int sd, const vec &req, Storage &storage) {
+bool server_cmd_kvi(Connection &conn, const vec &req, Storage &storage) {
+    LatencyScope parse(LAT_PARSE);
     /** Parse 'req' vector into strings */
     std::string key_str = "";
     std::string val_str = "";
-    cout << "size! " << req.size() << endl;
+    LOG_DEBUG << "size! " << req.size();
     unsigned char ulen[4] = {req.at(0), req.at(1), req.at(2), req.at(3)};
     int usize = *(int*) ulen;
-    cout << "usize: " << usize << endl;
+    LOG_DEBUG << "usize: " << usize;
     for (int i=4; i < usize+4; i++) {
         key_str += req[i];
-        cout << "req[i]: " << req.at(i) << endl;
+        LOG_DEBUG << "req[i]: " << req.at(i);
     }
     unsigned char plen[4] = {req.at(usize+4), req.at(usize+5), req.at(usize+6), req.at(usize+7)};
     int psize = *(int*) plen;
@@ -97,29 +105,31 @@ bool server_cmd_kvi(int sd, const vec &req, Storage &storage) {
     /** Store integer representation of key and value */
     int key = stoi(key_str);
     int val = stoi(val_str);
-    cout << "Key: " << key << endl;
-    cout << "Value: " << val << endl;
+    parse.done();
+    LOG_DEBUG << "Key: " << key;
+    LOG_DEBUG << "Value: " << val;
 
     /** Call insert() on storage object represented by hash table */
     bool from_primer = false;
     vec status = storage.kv_insert(key, val, from_primer);
 
     /** Send response to client */
-    cout << "Sending response to client..." << endl;
-    send_reliably(sd, status);
-    cout << "Sent!" << endl;
+    LOG_DEBUG << "Sending response to client...";
+    conn.reply(status);
+    LOG_DEBUG << "Sent!";
     return false;
 }
 
 /**
  * @brief Server command servering the Remove API call 
  * 
- * @param sd      The socket onto which the result should be written
+ * @param conn    The connection onto which the result should be queued
  * @param req     The unencrypted contents of the request
  * @param storage The Storage object
  * @return        false, to indicate that the server shouldn't stop 
  */
-bool server_cmd_kvg(int sd, const vec &req, Storage &storage) {
+bool server_cmd_kvg(Connection &conn, const vec &req, Storage &storage) {
+    LatencyScope parse(LAT_PARSE);
     /** Parse 'req' vector into strings */
     std::string key_str = "";
     unsigned char ulen[4] = {req.at(0), req.at(1), req.at(2), req.at(3)};
@@ -130,25 +140,27 @@ bool server_cmd_kvg(int sd, const vec &req, Storage &storage) {
 
     /** Store integer representation of key */
     int key = stoi(key_str);
-    cout << "Key: " << key << endl;
+    parse.done();
+    LOG_DEBUG << "Key: " << key;
 
     /** Call contains() on storage object represented by hash table */
     pair<bool, vec> result = storage.kv_get(key);
 
     /** Send response to client */
-    send_reliably(sd, result.second);
+    conn.reply(result.second);
     return false;
 }
 
 /**
  * @brief Server command servering the Contains API call 
  * 
- * @param sd      The socket onto which the result should be written
+ * @param conn    The connection onto which the result should be queued
  * @param req     The unencrypted contents of the request
  * @param storage The Storage object
  * @return        false, to indicate that the server shouldn't stop 
  */
-bool server_cmd_kvd(int sd, const vec &req, Storage &storage) {
+bool server_cmd_kvd(Connection &conn, const vec &req, Storage &storage) {
+    LatencyScope parse(LAT_PARSE);
     /** Parse 'req' vector into strings */
     std::string key_str = "";
     unsigned char ulen[4] = {req.at(0), req.at(1), req.at(2), req.at(3)};
@@ -159,13 +171,88 @@ bool server_cmd_kvd(int sd, const vec &req, Storage &storage) {
 
     /** Store integer representation of key */
     int key = stoi(key_str);
-    cout << "key: " << key << endl;
+    parse.done();
+    LOG_DEBUG << "key: " << key;
 
     /** Call remove() on storage object represented by hash table */
     bool from_primer = false;
     std::pair<bool, vec> result = storage.kv_delete(key, from_primer);
 
     /** Send response to client */
-    send_reliably(sd, result.second);
+    conn.reply(result.second);
+    return false;
+}
+
+/* v2 commands: the fields arrive as ints, so they go straight to storage */
+
+/** Answer the handshake with the version this server speaks */
+bool server_op_hello(Connection &conn, Storage &storage) {
+    conn.reply_int(2);
+    return false;
+}
+
+bool server_op_kvi(Connection &conn, Storage &storage) {
+    conn.reply(storage.kv_insert(conn.key, conn.val, false));
+    return false;
+}
+
+bool server_op_kvg(Connection &conn, Storage &storage) {
+    int val;
+    if (storage.kv_find(conn.key, val))
+        conn.reply_int(val);
+    else
+        conn.reply_status(ST_ERR_KEY);
+    return false;
+}
+
+bool server_op_kvd(Connection &conn, Storage &storage) {
+    conn.reply(storage.kv_delete(conn.key, false).second);
+    return false;
+}
+
+bool server_op_ror(Connection &conn, Storage &storage) {
+    return server_cmd_ror(conn, conn.body, storage);
+}
+
+/** The status byte of a text response from Storage */
+static unsigned char status_of(const vec &res) {
+    string text(res.begin(), res.end());
+    if (text == RES_OK) return ST_OK;
+    if (text == RES_ERR_KEY) return ST_ERR_KEY;
+    return ST_ERR_INVALID;
+}
+
+bool server_op_multi(Connection &conn, Storage &storage) {
+    size_t n = conn.body.size() / LEN_V2_REQ;
+    if (conn.key <= 0 || n != (size_t)conn.key) {
+        conn.reply_status(ST_ERR_INVALID);
+        return false;
+    }
+    vec res(n * LEN_MULTI_RES);
+    for (size_t i = 0; i < n; i++) {
+        const unsigned char *req = conn.body.data() + i * LEN_V2_REQ;
+        unsigned char *out = res.data() + i * LEN_MULTI_RES;
+        uint32_t k, v;
+        memcpy(&k, req + 2, sizeof(k));
+        memcpy(&v, req + 6, sizeof(v));
+        int key = (int32_t)le32toh(k), val = (int32_t)le32toh(v), found = 0;
+        /* only the key/value requests can be batched, anything else is invalid */
+        unsigned char status = ST_ERR_INVALID;
+        if (req[0] == PROTO_V2 && req[1] == OP_KVI)
+            status = status_of(storage.kv_insert(key, val, false));
+        else if (req[0] == PROTO_V2 && req[1] == OP_KVG)
+            status = storage.kv_find(key, found) ? ST_OK : ST_ERR_KEY;
+        else if (req[0] == PROTO_V2 && req[1] == OP_KVD)
+            status = status_of(storage.kv_delete(key, false).second);
+        /* errors inside a batch count the same as errors on their own */
+        if (status == ST_ERR_KEY)
+            stat_add(STAT_ERR_KEY);
+        else if (status == ST_ERR_INVALID)
+            stat_add(STAT_ERR_INVALID);
+        uint32_t le = htole32((uint32_t)found);
+        out[0] = status;
+        memcpy(out + 1, &le, sizeof(le));
+    }
+    conn.reply(res);
     return false;
 }
@@ -8,42 +8,69 @@
 #pragma once
 
 #include "vec.h"
+#include "connection.h"
 #include "server_storage.h"
 
 /* update API call from primary server */
-bool server_cmd_pvi(int sd, const vec &req, Storage &storage);
-bool server_cmd_pvd(int sd, const vec &req, Storage &storage);
-bool server_cmd_ror(int sd, const vec &req, Storage &storage);
+bool server_cmd_pvi(Connection &conn, const vec &req, Storage &storage);
+bool server_cmd_pvd(Connection &conn, const vec &req, Storage &storage);
+bool server_cmd_ror(Connection &conn, const vec &req, Storage &storage);
 
 
 /**
  * @brief Server command servering the Insert API call 
  * 
- * @param sd      The socket onto which the result should be written
+ * @param conn    The connection onto which the result should be queued
  * @param req     The unencrypted contents of the request
  * @param storage The Storage object
  * @return        false, to indicate that the server shouldn't stop 
  */
-bool server_cmd_kvi(int sd, const vec &req, Storage &storage);
+bool server_cmd_kvi(Connection &conn, const vec &req, Storage &storage);
 
 /**
  * @brief Server command servering the Remove API call 
  * 
- * @param sd      The socket onto which the result should be written
+ * @param conn    The connection onto which the result should be queued
  * @param req     The unencrypted contents of the request
  * @param storage The Storage object
  * @return        false, to indicate that the server shouldn't stop 
  */
-bool server_cmd_kvg(int sd, const vec &req, Storage &storage);
+bool server_cmd_kvg(Connection &conn, const vec &req, Storage &storage);
 
 /**
  * @brief Server command servering the Contains API call 
  * 
- * @param sd      The socket onto which the result should be written
+ * @param conn    The connection onto which the result should be queued
  * @param req     The unencrypted contents of the request
  * @param storage The Storage object
  * @return        false, to indicate that the server shouldn't stop 
  */
-bool server_cmd_kvd(int sd, const vec &req, Storage &storage);
+bool server_cmd_kvd(Connection &conn, const vec &req, Storage &storage);
+
+/**
+ * @brief v2 commands (see PROTO_V2).  The request's fields are already in
+ * conn.key and conn.val, so there is nothing to parse.
+ * 
+ * @param conn    The connection holding the request, onto which the result
+ *                should be queued
+ * @param storage The Storage object
+ * @return        false, to indicate that the server shouldn't stop 
+ */
+bool server_op_hello(Connection &conn, Storage &storage);
+bool server_op_kvi(Connection &conn, Storage &storage);
+bool server_op_kvg(Connection &conn, Storage &storage);
+bool server_op_kvd(Connection &conn, Storage &storage);
+bool server_op_ror(Connection &conn, Storage &storage);
+
+/**
+ * @brief Run the v2 requests in the body of an OP_MULTI, in order, and queue
+ * all of their results as one response
+ * 
+ * @param conn    The connection holding the request, onto which the result
+ *                should be queued
+ * @param storage The Storage object
+ * @return        false, to indicate that the server shouldn't stop 
+ */
+bool server_op_multi(Connection &conn, Storage &storage);
 
 #endif
\ No newline at end of file
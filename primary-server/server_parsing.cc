@@ -6,54 +6,66 @@
 #include <string>
 
 #include "vec.h"
-#include "net.h"
+#include "connection.h"
+#include "latency.h"
 #include "protocol.h"
 #include "server_commands.h"
+#include "shm_loop.h"
 #include "server_storage.h"
 
 /**
- * @brief Serve client connection and execute requested API
+ * @brief Execute the request that a connection has read, and queue the
+ * response on the connection
  * 
- * @param sd      The socket on which communication with the client takes place
+ * @param conn    The connection holding a complete request
  * @param storage The Storage object with which clients interact
  * @return true if the server should halt immediately, false otherwise 
  */
-bool serve_client(int sd, Storage &storage) {
-    /* request block */
-    vec res(LEN_RKBLOCK);
-
-    /* get request from socket */
-    reliable_get_to_eof_or_n(sd, res.begin(), LEN_RKBLOCK);
-
-    /* recognize API command */
-    std::string cmd = "";
-    unsigned int j = 0;
-    unsigned char alen[4];
-    for (unsigned i=0; i < LEN_RKBLOCK; i++) {
-        if (i < 3) {
-            cmd += res[i];
-        } else if (i >= 3 && i < 7) {
-            alen[j] = res[i];
-            j++;
-        }
+bool serve_client(Connection &conn, Storage &storage) {
+    conn.series = LAT_OTHER;
+
+    /* switch to persistent mode, the OK is the first framed response */
+    if (conn.cmd == REQ_KAL) {
+        conn.persistent = true;
+        conn.reply(vec_from_string(RES_OK));
+        return false;
     }
 
-    /* parse content */
-    int alen_int = *(int*) alen;
-    vec msg(alen_int);
-    reliable_get_to_eof_or_n(sd, msg.begin(), alen_int);
+    /* move to a shared memory channel, which another thread serves from now on */
+    if (conn.cmd == REQ_SHM && conn.version == 1) {
+        std::string name(conn.body.begin(), conn.body.end());
+        bool ok = shm_serve(name, [&storage](Connection &c) { return serve_client(c, storage); });
+        conn.reply(vec_from_string(ok ? RES_OK : RES_ERR_INVALID));
+        return false;
+    }
 
-    /** If there's a recovery request from backup server, send log */
-    //if (cmd == "ROR") {
-    //    storage.do_request();
-    //}
+    /* the latency statistics, merged from every thread */
+    if (conn.cmd == REQ_STA) {
+        conn.reply(vec_from_string(lat_report()));
+        return false;
+    }
+
+    /* a v2 request names its command by opcode, so it is a lookup in a table */
+    if (conn.version == 2) {
+        decltype(server_op_kvi) *ops[] = {server_op_hello, server_op_kvi, server_op_kvg, server_op_kvd,
+                                          server_op_ror,   server_op_multi};
+        lat_series_t series[] = {LAT_OTHER, LAT_KVI, LAT_KVG, LAT_KVD, LAT_ROR, LAT_MULTI};
+        if (conn.op < sizeof(ops) / sizeof(ops[0])) {
+            conn.series = series[conn.op];
+            return ops[conn.op](conn, storage);
+        }
+        conn.reply_status(ST_ERR_INVALID);
+        return false;
+    }
 
     /* execute a command */
     std::vector<std::string> s = {REQ_KVI, REQ_KVG, REQ_KVD, REQ_ROR};
     decltype(server_cmd_kvi) *cmds[] = {server_cmd_kvi, server_cmd_kvg, server_cmd_kvd, server_cmd_ror};
+    lat_series_t series[] = {LAT_KVI, LAT_KVG, LAT_KVD, LAT_ROR};
     for (size_t i = 0; i < s.size(); ++i) {
-        if (cmd == s[i]) {
-            return cmds[i](sd, msg, storage);
+        if (conn.cmd == s[i]) {
+            conn.series = series[i];
+            return cmds[i](conn, conn.body, storage);
         }
     }
     return true;
@@ -5,15 +5,17 @@
 #ifndef SERVER_PARSING_DEF
 #define SERVER_PARSING_DEF
 
+#include "connection.h"
 #include "server_storage.h"
 
 /**
- * @brief Serve client connection and execute requested API
+ * @brief Execute the request that a connection has read, and queue the
+ * response on the connection
  * 
- * @param sd      The socket on which communication with the client takes place
+ * @param conn    The connection holding a complete request
  * @param storage The Storage object with which clients interact
  * @return true if the server should halt immediately, false otherwise 
  */
-bool serve_client(int sd, Storage &storage);
+bool serve_client(Connection &conn, Storage &storage);
 
 #endif
\ No newline at end of file
@@ -2,7 +2,15 @@
  * @file server_storage.cc 
  */
 
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <unordered_map>
 #include <utility>
 
@@ -12,6 +20,10 @@
 #include "../lazy-list/sequential_lazy_list.h"
 #include "file.h"
 #include "gateway.h"
+#include "contextmanager.h"
+#include "disk_index.h"
+#include "latency.h"
+#include "log.h"
 
 using namespace std;
 
@@ -36,10 +48,35 @@ struct Storage::Internal {
     /* is backup server? */
     bool is_backup = false;
 
+    /** Optional memory-mapped index that replaces the lazy list */
+    DiskIndex index;
+
+    /** Number of bytes in the log file */
+    uint64_t log_bytes = 0;
+
+    /** Does the primary forward updates to the backup server? */
+    bool replicate = true;
+
+    /** Keys in the lazy list (the index counts its own) */
+    uint64_t keys = 0;
+
+    /**
+     * Bytes of the log the backup is known to hold: it has answered every
+     * update up to here, or been sent the log this long.  Shipping the log
+     * for ROR only holds the lock shared, hence the atomic.
+     */
+    atomic<uint64_t> replicated_bytes{0};
+
+    /** Shared by lookups, held alone by updates */
+    shared_mutex lock;
+
     /* API commands in file as an unique 8-byte code */
     inline static const string KVINSERT = "KVINSERT";
     inline static const string KVDELETE = "KVDELETE";
 
+    /** Size of one log record: an 8-byte command, then the key and the value */
+    static const size_t RECORD_LEN = 16;
+
     /**
      * @brief Construct the Storage::Internal object by setting the filename 
      * 
@@ -47,22 +84,123 @@ struct Storage::Internal {
      */
     Internal(string fname)
       : lazylist(), gateway(), filename(fname) {}
+
+    /**
+     * @brief Apply every complete record in a chunk of the log to the lazy
+     * list, or to the index if one is open.  Replay stops at the first record
+     * that is cut short or does not start with a known command, since that is
+     * where a crash interrupted an append.
+     * 
+     * @param disk The log records to apply
+     * @return The number of bytes of disk that held valid records
+     */
+    size_t replay(const vec &disk);
+
+    /**
+     * @brief Stop using the index once an update that is already in the log
+     * could not be applied to it, and rebuild the lazy list from the log, so
+     * that what is served matches what was logged.  The caller must hold lock.
+     */
+    void drop_index() {
+        LOG_ERROR << "Index update failed, serving from the lazy list instead";
+        index.close();
+        keys = 0;
+        replay(load_file_from(filename, 0));
+    }
+
+    /**
+     * Updates are forwarded to the backup after the storage lock is released,
+     * so that lookups never wait on the backup.  Each update takes a turn
+     * while it still holds the lock, and the turns go in log order.
+     */
+    struct repl_ticket_t {
+        /** The update's turn */
+        uint64_t turn;
+        /** The end of the log, with the update in it */
+        uint64_t end;
+    };
+
+    /** The next turn to hand out, guarded by lock */
+    uint64_t repl_next = 0;
+
+    /** The turn whose update goes to the backup now, guarded by repl_lock, which also guards the gateway */
+    uint64_t repl_turn = 0;
+    mutex repl_lock;
+    condition_variable repl_ready;
+
+    /** Take a turn for the update just logged.  The caller must hold lock. */
+    repl_ticket_t take_turn() { return {repl_next++, log_bytes}; }
+
+    /**
+     * @brief Forward an update to the backup, once the updates logged before
+     * it have been.  The caller must not hold lock.  The backup only stays
+     * caught up if it answers, and was caught up before.
+     */
+    template <typename... Args> void replicate_update(repl_ticket_t ticket, const string &cmd, Args... args) {
+        unique_lock<mutex> guard(repl_lock);
+        repl_ready.wait(guard, [&]() { return repl_turn == ticket.turn; });
+        if (gateway.send_message(cmd, args...) && replicated_bytes.load() == ticket.end - RECORD_LEN)
+            replicated_bytes.store(ticket.end);
+        repl_turn++;
+        repl_ready.notify_all();
+    }
 };
 
+/**
+ * @brief Apply every complete record in a chunk of the log to the lazy
+ * list, or to the index if one is open.  Replay stops at the first record
+ * that is cut short or does not start with a known command, since that is
+ * where a crash interrupted an append.
+ * 
+ * @param disk The log records to apply
+ * @return The number of bytes of disk that held valid records
+ */
+size_t Storage::Internal::replay(const vec &disk) {
+    size_t total = disk.size();
+    size_t n = 0;
+    while (n + RECORD_LEN <= total) {
+        const unsigned char *rec = disk.data() + n;
+        int key, val;
+        memcpy(&key, rec + 8, sizeof(int));
+        memcpy(&val, rec + 12, sizeof(int));
+
+        /* Read INSERT command */
+        if (memcmp(rec, KVINSERT.data(), 8) == 0) {
+            if (index.is_open()) index.insert(key, val);
+            else if (lazylist.parse_insert(key, val)) keys++;
+        }
 
+        /* Read DELETE command */
+        else if (memcmp(rec, KVDELETE.data(), 8) == 0) {
+            if (index.is_open()) index.remove(key);
+            else if (lazylist.parse_delete(key)) keys--;
+        }
+
+        /* Anything else is a torn or unwritten record */
+        else {
+            break;
+        }
+        n += RECORD_LEN;
+    }
+    return n;
+}
 
 /**
  * @brief Construct a new Storage::Storage object
  * 
  * @param fname The name of the file that should be used to load/store the data
  */
-Storage::Storage(const string &fname) 
-    : fields(new Internal(fname)) {}
+Storage::Storage(const string &fname, bool replicate) 
+    : fields(new Internal(fname)) {
+    fields->replicate = replicate;
+}
 
 /** 
  *  Destructor for the storage object
  */
-Storage::~Storage() = default;
+Storage::~Storage() {
+    if (fields->fp) fclose(fields->fp);
+}
 
 
 /** Initialize lazy list data structure */
@@ -74,9 +212,41 @@ bool Storage::is_backup() {
     return fields->is_backup;
 }
 
-vec Storage::load_disk() {
-    vec disk = load_entire_file(fields->filename);
-    return disk;
+/**
+ * @brief Serve requests from a memory-mapped index file instead of the lazy
+ * list.  Must be called before load().
+ * 
+ * @param iname The name of the index file
+ * @return false if the index could not be opened, true otherwise
+ */
+bool Storage::use_index(const string &iname) {
+    return fields->index.open(iname);
+}
+
+/**
+ * @brief Open the log file for shipping to the backup, so that it can be
+ * sent straight from the page cache without reading it into memory.
+ * 
+ * @param len Set to the number of bytes in the log
+ * @return A read-only descriptor for the log, or -1 on error
+ */
+int Storage::open_log(off_t &len) {
+    /* no append is half done while we look at the length */
+    shared_lock<shared_mutex> guard(fields->lock);
+    int fd = open(fields->filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG_ERROR << "File " << fields->filename << " not found";
+        return -1;
+    }
+    struct stat stat_buf;
+    if (fstat(fd, &stat_buf) != 0) {
+        close(fd);
+        return -1;
+    }
+    len = stat_buf.st_size;
+    /* the backup is about to hold the log up to here */
+    fields->replicated_bytes.store(len);
+    return fd;
 }
 
 /**
@@ -91,60 +261,40 @@ bool Storage::load() {
     /* Read a data file if it exists */
     if (file_exists(fields->filename)) {
         has_log = true;
-        vec disk = load_entire_file(fields->filename);
-        unsigned int total = disk.size();
-        if (total > 0) fields->gateway.send_file(REQ_DOR, disk);
-        cout << "Reading datafile..." << endl;
-        unsigned int n = 0;
-        while (n < total) {
-            std::string prefix(disk.begin()+n, disk.begin()+n+8);
-            cout << "prefix: " << prefix << endl;
-
-            /* Read INSERT command */
-            if (prefix == fields->KVINSERT) {
-                /* prefix length */
-                n += 8;
-                /* key length */
-                unsigned char kstr[4] = {disk.at(n), disk.at(n+1), disk.at(n+2), disk.at(n+3)};
-                int key = *(int*) kstr;
-                n += 4;
-                /* value length */
-                unsigned char vstr[4] = {disk.at(n), disk.at(n+1), disk.at(n+2), disk.at(n+3)};
-                int val = *(int*) vstr;
-                n += 4;
-                /* execute a command */
-                fields->lazylist.parse_insert(key, val);
-            }
-
-            /* Read DELETE command */
-            else if (prefix == fields->KVDELETE) {
-                /* prefix length */
-                n += 8;
-                /* key length */
-                unsigned char kstr[4] = {disk.at(n), disk.at(n+1), disk.at(n+2), disk.at(n+3)};
-                int key = *(int*) kstr;
-                n += 8;
-                /* execute a command */
-                fields->lazylist.parse_delete(key);
-            }
-
-            else {
-                cout << "something wrong!" << endl;
-                n += 16;
+        struct stat stat_buf;
+        if (stat(fields->filename.c_str(), &stat_buf) != 0) return false;
+        uint64_t size = stat_buf.st_size;
+        LOG_INFO << "Reading datafile...";
+        uint64_t applied = 0;
+        if (fields->index.is_open()) {
+            /* the index already reflects a prefix of the log, so only replay the rest */
+            applied = fields->index.log_bytes();
+            if (applied > size) {
+                LOG_WARN << "Index is ahead of the log, rebuilding it";
+                fields->index.reset();
+                applied = 0;
             }
+        }
+        fields->log_bytes = applied + fields->replay(load_file_from(fields->filename, applied));
+        if (fields->index.is_open()) fields->index.set_log_bytes(fields->log_bytes);
 
-            /* break condition */
-            cout << "n: " << n << endl;
-            cout << "total: " << total << endl;
-            //if (n >= total) break;
+        /* cut off a torn tail, so that new records are appended right after the last good one */
+        if (fields->log_bytes < size) {
+            LOG_WARN << "Dropping " << size - fields->log_bytes << " bytes of torn log tail";
+            if (truncate(fields->filename.c_str(), fields->log_bytes) != 0) return false;
         }
+        if (fields->log_bytes > 0 && fields->replicate && !fields->gateway.send_file(REQ_DOR, fields->filename).empty())
+            fields->replicated_bytes.store(fields->log_bytes);
+    } else if (fields->index.is_open() && fields->index.log_bytes() > 0) {
+        /* no log means nothing the index holds can be trusted */
+        fields->index.reset();
     }
     if (has_log) {
         fields->fp = fopen(fields->filename.c_str(), "a");
     } else {
         fields->fp = fopen(fields->filename.c_str(), "w");
     }
-    cout << "Open initial backup file successfully!" << endl;
+    LOG_INFO << "Open initial backup file successfully!";
     return true;
 }
 
@@ -155,11 +305,13 @@ bool Storage::load() {
  * temporary file can be renamed to replace the older version of the Storage object
  */
 void Storage::persist(string prefix, const int &key, const int &val) {
+    LatencyScope scope(LAT_PERSIST);
     fputs(prefix.c_str(), fields->fp);
     fwrite (&key, sizeof(int), 1, fields->fp);
     fwrite (&val, sizeof(int), 1, fields->fp);
     fflush(fields->fp);
-    cout << "persisted data!" << endl;
+    fields->log_bytes += fields->RECORD_LEN;
+    LOG_DEBUG << "persisted data!";
 }
 
 /**
@@ -181,13 +333,35 @@ vec Storage::kv_insert(const int &key, const int &val, bool from_primer) {
     if (fields->is_backup && !from_primer) return vec_from_string(RES_ERR_INVALID);
     val_t key_ptr = (val_t)key;
     val_t val_ptr = (val_t)val;
-
-    cout << "kv_insert function!" << endl;
-    cout << "is from PVI? " << from_primer << endl;
+    LatencyScope scope(LAT_STORAGE);
+    unique_lock<shared_mutex> guard(fields->lock);
+
+    LOG_DEBUG << "kv_insert function!";
+    LOG_DEBUG << "is from PVI? " << from_primer;
+    if (fields->index.is_open()) {
+        /* log first, so a crash never leaves the index ahead of the log */
+        if (fields->index.find(key).second) return vec_from_string(RES_ERR_KEY);
+        persist(fields->KVINSERT, key, val);
+        if (fields->index.insert(key, val))
+            fields->index.set_log_bytes(fields->log_bytes);
+        else
+            fields->drop_index();
+        if (fields->replicate) {
+            auto ticket = fields->take_turn();
+            guard.unlock();
+            fields->replicate_update(ticket, REQ_PVI, key, val);
+        }
+        return vec_from_string(RES_OK);
+    }
     if (fields->lazylist.parse_insert(key_ptr, val_ptr)) {
+        fields->keys++;
         if (!fields->is_backup) {
             persist(fields->KVINSERT, key, val);
-            fields->gateway.send_message(REQ_PVI, key, val);
+            if (fields->replicate) {
+                auto ticket = fields->take_turn();
+                guard.unlock();
+                fields->replicate_update(ticket, REQ_PVI, key, val);
+            }
         }
         return vec_from_string(RES_OK);
     }
@@ -202,17 +376,34 @@ vec Storage::kv_insert(const int &key, const int &val, bool from_primer) {
  * @return pair<bool, vec> 
  */
 pair<bool, vec> Storage::kv_get(const int &key) {
-    val_t key_ptr = (val_t)key;
-
-    pair<int, int> success = fields->lazylist.parse_find(key_ptr);
-
-    if (success.second) {
-        return {true, vec_from_string(to_string(success.first))};
+    int val;
+    if (kv_find(key, val)) {
+        return {true, vec_from_string(to_string(val))};
     }
 
     return {false, vec_from_string(RES_ERR_KEY)};
 };
 
+/**
+ * @brief Look up the value to which a key is mapped, without formatting it
+ * 
+ * @param key The key whose value is being fetched
+ * @param val Set to the value, if the key is mapped
+ * @return true if the key is mapped, false otherwise
+ */
+bool Storage::kv_find(const int &key, int &val) {
+    val_t key_ptr = (val_t)key;
+    LatencyScope scope(LAT_STORAGE);
+    shared_lock<shared_mutex> guard(fields->lock);
+
+    pair<int, int> success;
+    if (fields->index.is_open()) success = fields->index.find(key);
+    else success = fields->lazylist.parse_find(key_ptr);
+
+    val = success.first;
+    return success.second;
+}
+
 /**
  * @brief Delete a key/value mapping
  * 
@@ -222,14 +413,52 @@ pair<bool, vec> Storage::kv_get(const int &key) {
 pair<bool, vec> Storage::kv_delete(const int &key, bool from_primer) {
     if (fields->is_backup && !from_primer) return {false, vec_from_string(RES_ERR_INVALID)};
     val_t key_ptr = (val_t)key;
-    
+    LatencyScope scope(LAT_STORAGE);
+    unique_lock<shared_mutex> guard(fields->lock);
+
+    if (fields->index.is_open()) {
+        if (!fields->index.find(key).second) return {false, vec_from_string(RES_ERR_KEY)};
+        persist(fields->KVDELETE, key, 0);
+        if (fields->index.remove(key))
+            fields->index.set_log_bytes(fields->log_bytes);
+        else
+            fields->drop_index();
+        if (fields->replicate) {
+            auto ticket = fields->take_turn();
+            guard.unlock();
+            fields->replicate_update(ticket, REQ_PVD, key);
+        }
+        return {true, vec_from_string(RES_OK)};
+    }
     if (fields->lazylist.parse_delete(key_ptr)) {
+        fields->keys--;
         if (!fields->is_backup) {
             persist(fields->KVDELETE, key, 0);
-            fields->gateway.send_message(REQ_PVD, key);
+            if (fields->replicate) {
+                auto ticket = fields->take_turn();
+                guard.unlock();
+                fields->replicate_update(ticket, REQ_PVD, key);
+            }
         }
         return {true, vec_from_string(RES_OK)};
     }
 
     return {false, vec_from_string(RES_ERR_KEY)};
 };
+
+/**
+ * @brief Take a consistent look at what the storage holds, for the admin
+ * listener.  No update is half done while we look.
+ *
+ * @return The key count, the log size and the replication lag
+ */
+Storage::stats_t Storage::stats() {
+    shared_lock<shared_mutex> guard(fields->lock);
+    stats_t st;
+    st.keys = fields->index.is_open() ? fields->index.size() : fields->keys;
+    st.log_bytes = fields->log_bytes;
+    st.replicate = fields->replicate;
+    uint64_t held = fields->replicated_bytes.load();
+    st.replication_lag = fields->replicate && held < st.log_bytes ? st.log_bytes - held : 0;
+    return st;
+}
@@ -10,6 +10,7 @@
 
 #include <memory>
 #include <string>
+#include <sys/types.h>
 #include <utility>
 #include "vec.h"
 #include "server_storage.h"
@@ -25,6 +26,11 @@
  * Storage is a persistent object.  For the time being, persistence is achieved
  * by writing the entire object to disk in response to SAV messages.  We use a
  * relatively simple binary wire format to write every K/V paur to disk
+ *
+ * Several reactor threads may share one Storage object: lookups run in
+ * parallel, while updates (and the log append they do) run one at a time.
+ * Updates go to the backup after the lock is released, so lookups never wait
+ * on the backup, but still one at a time and in log order.
  */
 
 class Storage {
@@ -41,11 +47,24 @@ class Storage {
   std::unique_ptr<Internal> fields;
 
 public:
+    /** What the storage holds, and how far the backup is behind it */
+    struct stats_t {
+      /** Keys mapped */
+      uint64_t keys;
+      /** Bytes in the log */
+      uint64_t log_bytes;
+      /** Are updates forwarded to the backup? */
+      bool replicate;
+      /** Bytes of the log the backup is not known to hold */
+      uint64_t replication_lag;
+    };
+
     /** Construct an empty object and specify the file from which it should be
      * loaded.  To avoid exceptions and errors in the constructor, the act of
-     * loading data is separate from construction.
+     * loading data is separate from construction.  Pass replicate = false to
+     * keep updates from being forwarded to the backup server.
      */
-    Storage(const std::string &fname);
+    Storage(const std::string &fname, bool replicate = true);
 
     /** Destructor for the storage object. */
     ~Storage();
@@ -56,12 +75,27 @@ public:
     /* is it backup server? */
     bool is_backup();
 
+    /**
+     * @brief Serve requests from a memory-mapped index file instead of the
+     * lazy list.  Must be called before load().
+     * 
+     * @param iname The name of the index file
+     * @return false if the index could not be opened, true otherwise
+     */
+    bool use_index(const std::string &iname);
+
     /** Send log files to backup upon backup server crash/restart */
     //void do_request();
     //bool do_request();
 
-    vec load_disk();
-    //bool send_file(const vec &disk);
+    /**
+     * @brief Open the log file for shipping to the backup, so that it can be
+     * sent straight from the page cache without reading it into memory.
+     * 
+     * @param len Set to the number of bytes in the log
+     * @return A read-only descriptor for the log, or -1 on error
+     */
+    int open_log(off_t &len);
 
     /**
      * @brief Populate the Storage object by loading this.filename. 
@@ -100,6 +134,15 @@ public:
      */
     std::pair<bool, vec> kv_get(const int &key);
 
+    /**
+     * @brief Look up the value to which a key is mapped, without formatting it
+     * 
+     * @param key The key whose value is being fetched
+     * @param val Set to the value, if the key is mapped
+     * @return true if the key is mapped, false otherwise
+     */
+    bool kv_find(const int &key, int &val);
+
     /**
      * @brief Delete a key/value mapping
      * 
@@ -107,6 +150,14 @@ public:
      * @return vec 
      */
     std::pair<bool, vec> kv_delete(const int &key, bool from_primer);
+
+    /**
+     * @brief Take a consistent look at what the storage holds, for the
+     * admin listener
+     *
+     * @return The key count, the log size and the replication lag
+     */
+    stats_t stats();
 };
 
 #endif
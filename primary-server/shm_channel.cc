@@ -0,0 +1,202 @@
+/**
+ * @file shm_channel.cc
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+#include "shm_channel.h"
+
+using namespace std;
+
+/** Sleep on a futex word in shared memory while it still holds val */
+static void futex_wait(atomic<uint32_t> &word, uint32_t val, int timeout_ms) {
+    timespec ts = {timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000};
+    // NB: not FUTEX_PRIVATE_FLAG, the word is shared with another process
+    syscall(SYS_futex, (uint32_t *)&word, FUTEX_WAIT, val, &ts, nullptr, 0);
+}
+
+/** Wake whoever sleeps on a futex word in shared memory */
+static void futex_wake(atomic<uint32_t> &word) {
+    syscall(SYS_futex, (uint32_t *)&word, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+
+/**
+ * @brief Wait for a condition that the other side makes true and then
+ * announces on seq: spin, then sleep.  Marking ourselves waiting before the
+ * last check means the other side either sees the mark and wakes us, or
+ * changed things before that check.
+ */
+template <typename F>
+static bool await(atomic<uint32_t> &seq, atomic<uint32_t> &waiting, F ready, uint32_t spin, int timeout_ms) {
+    /* spinning only pays when the other side has a core of its own to make progress on */
+    static const bool can_spin = thread::hardware_concurrency() > 1;
+    for (uint32_t i = 0; can_spin && i < spin; i++) {
+        if (ready())
+            return true;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    waiting.store(1);
+    uint32_t s = seq.load();
+    if (!ready())
+        futex_wait(seq, s, timeout_ms);
+    waiting.store(0);
+    return ready();
+}
+
+/** Tell a sleeping peer that seq's condition changed */
+static void announce(atomic<uint32_t> &seq, atomic<uint32_t> &waiting) {
+    if (waiting.load()) {
+        seq.fetch_add(1);
+        futex_wake(seq);
+    }
+}
+
+/**
+ * @brief Find the bytes that are ready to consume, up to where the ring wraps
+ *
+ * @param data Set to the first byte
+ * @return The number of bytes, which may be 0
+ */
+size_t ShmRing::peek(const unsigned char *&data) const {
+    uint64_t head = ring->head.load(memory_order_relaxed);
+    uint64_t avail = ring->tail.load(memory_order_acquire) - head;
+    size_t off = head & (SHM_RING_BYTES - 1);
+    data = ring->data + off;
+    return min<uint64_t>(avail, SHM_RING_BYTES - off);
+}
+
+/** Release the first n bytes that peek() returned */
+void ShmRing::consume(size_t n) {
+    ring->head.store(ring->head.load(memory_order_relaxed) + n);
+    announce(ring->space_seq, ring->space_waiting);
+}
+
+/**
+ * @brief Copy as much of a buffer into the ring as fits
+ *
+ * @return The number of bytes copied, which may be 0
+ */
+size_t ShmRing::put(const unsigned char *data, size_t len) {
+    uint64_t tail = ring->tail.load(memory_order_relaxed);
+    size_t n = min<uint64_t>(len, SHM_RING_BYTES - (tail - ring->head.load(memory_order_acquire)));
+    if (n == 0)
+        return 0;
+    size_t off = tail & (SHM_RING_BYTES - 1);
+    size_t first = min(n, SHM_RING_BYTES - off);
+    memcpy(ring->data + off, data, first);
+    memcpy(ring->data, data + first, n - first);
+    ring->tail.store(tail + n);
+    announce(ring->data_seq, ring->data_waiting);
+    return n;
+}
+
+/**
+ * @brief Wait until there are bytes to consume
+ *
+ * @param spin       How many times to check before sleeping
+ * @param timeout_ms How long to sleep at most
+ * @return false if there were still none after the timeout
+ */
+bool ShmRing::wait_data(uint32_t spin, int timeout_ms) {
+    auto ready = [&]() { return ring->tail.load() != ring->head.load(memory_order_relaxed); };
+    return await(ring->data_seq, ring->data_waiting, ready, spin, timeout_ms);
+}
+
+/**
+ * @brief Wait until there is room to put bytes
+ *
+ * @param spin       How many times to check before sleeping
+ * @param timeout_ms How long to sleep at most
+ * @return false if there was still none after the timeout
+ */
+bool ShmRing::wait_space(uint32_t spin, int timeout_ms) {
+    auto ready = [&]() { return ring->tail.load(memory_order_relaxed) - ring->head.load() < SHM_RING_BYTES; };
+    return await(ring->space_seq, ring->space_waiting, ready, spin, timeout_ms);
+}
+
+/** Unmap the channel; at the client's end, tell the server it is closed */
+ShmChannel::~ShmChannel() {
+    if (chan == nullptr)
+        return;
+    if (chan->client_pid == getpid())
+        chan->closed.store(1);
+    munmap(chan, sizeof(shm_channel_t));
+}
+
+/**
+ * @brief Create a new segment and set up an empty channel in it
+ *
+ * @param name The segment's name, such as "/kv-1234"
+ * @param spin Spins before a waiting side sleeps, for both sides
+ * @return false on error
+ */
+bool ShmChannel::create(const string &name, uint32_t spin) {
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return false;
+    void *mem = MAP_FAILED;
+    if (ftruncate(fd, sizeof(shm_channel_t)) == 0)
+        mem = mmap(nullptr, sizeof(shm_channel_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return false;
+    }
+    /* the segment starts zeroed, which is an empty ring; the atomics still need constructing */
+    chan = new (mem) shm_channel_t;
+    chan->client_pid = getpid();
+    chan->spin = spin;
+    chan->magic = SHM_MAGIC;
+    return true;
+}
+
+/**
+ * @brief Map the channel a client created, and remove its name
+ *
+ * @param name The segment's name
+ * @return false on error, or if the segment is not a channel
+ */
+bool ShmChannel::attach(const string &name) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        return false;
+    shm_unlink(name.c_str());
+    struct stat st;
+    void *mem = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size == (off_t)sizeof(shm_channel_t))
+        mem = mmap(nullptr, sizeof(shm_channel_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        return false;
+    chan = (shm_channel_t *)mem;
+    if (chan->magic != SHM_MAGIC)
+        return false;
+    chan->server_pid = getpid();
+    return true;
+}
+
+/**
+ * @brief Is the process at the other end still there?
+ *
+ * @param server true for the server's end of the channel
+ */
+bool ShmChannel::peer_alive(bool server) const {
+    if (server && chan->closed.load())
+        return false;
+    pid_t peer = server ? chan->client_pid : chan->server_pid;
+    return kill(peer, 0) == 0 || errno != ESRCH;
+}
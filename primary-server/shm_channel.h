@@ -0,0 +1,169 @@
+/**
+ * @file shm_channel.h
+ */
+
+#ifndef SHM_CHANNEL_DEF
+#define SHM_CHANNEL_DEF
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+
+/** Bytes in each direction of a channel, a power of two */
+const size_t SHM_RING_BYTES = 1 << 20;
+
+/** First word of a channel, to check that a segment really is one */
+const uint32_t SHM_MAGIC = 0x4b56534d;
+
+/**
+ * @brief The shared part of a single-producer single-consumer byte ring.  The
+ * producer owns tail and the consumer owns head, each on its own cache line.
+ * A side that has nothing to do spins for a while, then sleeps on a futex;
+ * the other side only pays for a wakeup when its peer is asleep.
+ */
+struct shm_ring_t {
+  /** Bytes consumed so far */
+  alignas(64) std::atomic<uint64_t> head;
+
+  /** Bytes produced so far */
+  alignas(64) std::atomic<uint64_t> tail;
+
+  /** The futex word of a sleeping consumer, and whether it is asleep */
+  alignas(64) std::atomic<uint32_t> data_seq;
+  std::atomic<uint32_t> data_waiting;
+
+  /** The futex word of a producer sleeping for space, and whether it is asleep */
+  alignas(64) std::atomic<uint32_t> space_seq;
+  std::atomic<uint32_t> space_waiting;
+
+  /** The bytes themselves */
+  alignas(64) unsigned char data[SHM_RING_BYTES];
+};
+
+/**
+ * @brief The shared memory segment of one client: a ring of requests from the
+ * client to the server, and a ring of responses back.  The bytes in the rings
+ * are the same requests and framed responses as on a persistent connection.
+ */
+struct shm_channel_t {
+  /** SHM_MAGIC, once the client has set the channel up */
+  uint32_t magic;
+
+  /** The processes at each end, so that each can tell if the other died */
+  int32_t client_pid;
+  int32_t server_pid;
+
+  /** Spins before a side that is waiting goes to sleep (0 = sleep at once) */
+  uint32_t spin;
+
+  /** Set by the client when it is done with the channel */
+  std::atomic<uint32_t> closed;
+
+  /** Requests from the client, and responses to it */
+  shm_ring_t requests;
+  shm_ring_t responses;
+};
+
+/**
+ * @brief ShmRing is one end of a shm_ring_t: a consumer uses peek(),
+ * consume() and wait_data(), a producer put() and wait_space()
+ */
+class ShmRing {
+public:
+  /** Construct an end of a ring */
+  ShmRing(shm_ring_t *ring = nullptr) : ring(ring) {}
+
+  /**
+   * @brief Find the bytes that are ready to consume, up to where the ring
+   * wraps
+   *
+   * @param data Set to the first byte
+   * @return The number of bytes, which may be 0
+   */
+  size_t peek(const unsigned char *&data) const;
+
+  /** Release the first n bytes that peek() returned */
+  void consume(size_t n);
+
+  /**
+   * @brief Copy as much of a buffer into the ring as fits
+   *
+   * @return The number of bytes copied, which may be 0
+   */
+  size_t put(const unsigned char *data, size_t len);
+
+  /**
+   * @brief Wait until there are bytes to consume
+   *
+   * @param spin       How many times to check before sleeping
+   * @param timeout_ms How long to sleep at most
+   * @return false if there were still none after the timeout
+   */
+  bool wait_data(uint32_t spin, int timeout_ms);
+
+  /**
+   * @brief Wait until there is room to put bytes
+   *
+   * @param spin       How many times to check before sleeping
+   * @param timeout_ms How long to sleep at most
+   * @return false if there was still none after the timeout
+   */
+  bool wait_space(uint32_t spin, int timeout_ms);
+
+private:
+  /** The shared ring */
+  shm_ring_t *ring;
+};
+
+/**
+ * @brief ShmChannel maps a shm_channel_t in a POSIX shared memory segment.
+ * The client creates the segment, and names it to the server, which attaches
+ * to it and removes the name, so the segment goes away with its last user.
+ */
+class ShmChannel {
+public:
+  /** Construct a channel that is not mapped yet */
+  ShmChannel() {}
+
+  /** Unmap the channel; at the client's end, tell the server it is closed */
+  ~ShmChannel();
+
+  ShmChannel(const ShmChannel &) = delete;
+  ShmChannel &operator=(const ShmChannel &) = delete;
+
+  /**
+   * @brief Create a new segment and set up an empty channel in it
+   *
+   * @param name The segment's name, such as "/kv-1234"
+   * @param spin Spins before a waiting side sleeps, for both sides
+   * @return false on error
+   */
+  bool create(const std::string &name, uint32_t spin);
+
+  /**
+   * @brief Map the channel a client created, and remove its name
+   *
+   * @param name The segment's name
+   * @return false on error, or if the segment is not a channel
+   */
+  bool attach(const std::string &name);
+
+  /** The mapped channel */
+  shm_channel_t *get() const { return chan; }
+
+  /**
+   * @brief Is the process at the other end still there?
+   *
+   * @param server true for the server's end of the channel
+   */
+  bool peer_alive(bool server) const;
+
+private:
+  /** The mapped channel, or nullptr */
+  shm_channel_t *chan = nullptr;
+};
+
+#endif
@@ -0,0 +1,91 @@
+/**
+ * @file shm_loop.cc
+ */
+
+#include <memory>
+#include <thread>
+
+#include "protocol.h"
+#include "shm_channel.h"
+#include "shm_loop.h"
+
+using namespace std;
+
+/** How long a side sleeps before it checks that its peer is still there */
+const int SHM_CHECK_MS = 1000;
+
+/**
+ * @brief Serve one channel until the client is done with it
+ *
+ * @param chan    The attached channel
+ * @param handler As for event_loop()
+ */
+static void serve_channel(unique_ptr<ShmChannel> chan, function<bool(Connection &)> handler) {
+    ShmRing requests(&chan->get()->requests), responses(&chan->get()->responses);
+    uint32_t spin = chan->get()->spin;
+
+    // NB: there is no socket, so the connection only parses and queues
+    Connection conn(-1);
+    conn.persistent = true;
+    vec out;
+    size_t out_off = 0;
+    bool halt = false;
+
+    while (!halt) {
+        /* responses first, so a full response ring holds back more requests */
+        if (out_off < out.size()) {
+            size_t n = responses.put(out.data() + out_off, out.size() - out_off);
+            out_off += n;
+            if (n == 0 && !responses.wait_space(spin, SHM_CHECK_MS) && !chan->peer_alive(true))
+                break;
+            continue;
+        }
+
+        /* serve every request in the ring, up to where it wraps */
+        const unsigned char *data;
+        size_t len = requests.peek(data);
+        size_t used = 0;
+        while (!halt && conn.reading() && (used < len || conn.state == Connection::READ_BODY)) {
+            ssize_t n = conn.feed(data + used, len - used);
+            if (n < 0) {
+                halt = true;
+                break;
+            }
+            used += n;
+            if (conn.state == Connection::READY) {
+                if (conn.cmd == REQ_ROR || (conn.version == 2 && conn.op == OP_ROR))
+                    conn.reply_status(ST_ERR_INVALID);
+                else
+                    halt = handler(conn);
+            } else if (n == 0) {
+                break;
+            }
+        }
+        requests.consume(used);
+
+        /* then pass on everything they queued */
+        conn.take_queued(out);
+        out_off = 0;
+        conn.drained();
+        if (!out.empty() || used > 0)
+            continue;
+        if (!requests.wait_data(spin, SHM_CHECK_MS) && !chan->peer_alive(true))
+            break;
+    }
+}
+
+/**
+ * @brief Serve a client on the same host over a shared memory channel that it
+ * created, from a thread of its own
+ *
+ * @param name    The name of the client's shared memory segment
+ * @param handler As for event_loop(); a request to halt ends this channel
+ * @return false if the channel could not be attached
+ */
+bool shm_serve(const string &name, function<bool(Connection &)> handler) {
+    auto chan = make_unique<ShmChannel>();
+    if (!chan->attach(name))
+        return false;
+    thread(serve_channel, move(chan), handler).detach();
+    return true;
+}
@@ -0,0 +1,32 @@
+/**
+ * @file shm_loop.h
+ */
+
+#ifndef SHM_LOOP_DEF
+#define SHM_LOOP_DEF
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "connection.h"
+
+/**
+ * @brief Serve a client on the same host over a shared memory channel (see
+ * ShmChannel) that it created, from a thread of its own.  Requests are read
+ * straight out of the request ring into a Connection with feed(), go through
+ * the same handler as requests from a socket, and the framed responses are
+ * copied into the response ring, so no system call is made while both sides
+ * keep busy.  The thread ends when the client closes the channel or exits.
+ *
+ * A file response (ROR) cannot go through the channel, so ROR gets INVALID;
+ * the backup asks for the log over TCP.
+ *
+ * @param name    The name of the client's shared memory segment
+ * @param handler As for event_loop(); a request to halt ends this channel
+ * @return false if the channel could not be attached
+ */
+bool shm_serve(const std::string &name, std::function<bool(Connection &)> handler);
+
+#endif
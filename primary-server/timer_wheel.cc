@@ -0,0 +1,101 @@
+/**
+ * @file timer_wheel.cc
+ */
+
+#include <algorithm>
+#include <chrono>
+
+#include "timer_wheel.h"
+
+using namespace std;
+
+/** Milliseconds on the monotonic clock */
+static uint64_t now_ms() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Take the timer out of its wheel, if it is armed */
+void TimerWheel::Timer::cancel() {
+    if (wheel == nullptr)
+        return;
+    if (prev != nullptr)
+        prev->next = next;
+    else
+        wheel->slots[due & (SLOTS - 1)] = next;
+    if (next != nullptr)
+        next->prev = prev;
+    wheel->count--;
+    wheel = nullptr;
+    prev = next = nullptr;
+}
+
+/**
+ * @brief Construct an empty wheel
+ *
+ * @param tick_ms The length of a tick, in milliseconds
+ */
+TimerWheel::TimerWheel(int tick_ms) : tick_ms(max(1, tick_ms)) { tick = now_tick(); }
+
+/** Disarm every timer still in the wheel */
+TimerWheel::~TimerWheel() {
+    for (auto &slot : slots)
+        while (slot != nullptr)
+            slot->cancel();
+}
+
+/** The current tick of the clock */
+uint64_t TimerWheel::now_tick() const { return now_ms() / tick_ms; }
+
+/**
+ * @brief Arm a timer to expire after ms milliseconds, moving it if it is
+ * already armed
+ */
+void TimerWheel::arm(Timer &timer, int ms) {
+    timer.cancel();
+    uint64_t ticks = max(1, (ms + tick_ms - 1) / tick_ms);
+    timer.due = max(now_tick(), tick) + ticks;
+    Timer *&head = slots[timer.due & (SLOTS - 1)];
+    timer.next = head;
+    if (head != nullptr)
+        head->prev = &timer;
+    head = &timer;
+    timer.wheel = this;
+    count++;
+}
+
+/**
+ * @brief How long a poll may sleep before the next tick is due
+ *
+ * @return Milliseconds, or -1 if no timer is armed
+ */
+int TimerWheel::next_wait() const {
+    if (count == 0)
+        return -1;
+    uint64_t now = now_ms();
+    if (now / tick_ms > tick)
+        return 0;
+    return tick_ms - now % tick_ms;
+}
+
+/**
+ * @brief Catch up with the clock: disarm every timer that is due, and pass
+ * each to expire, which may destroy it
+ */
+void TimerWheel::advance(const function<void(Timer &)> &expire) {
+    uint64_t cur = now_tick();
+    /* after a long sleep every slot is due at most once, so visit each only once */
+    uint64_t steps = count == 0 ? 0 : min(cur - tick, SLOTS);
+    for (uint64_t s = 1; s <= steps; s++) {
+        Timer *timer = slots[(tick + s) & (SLOTS - 1)];
+        while (timer != nullptr) {
+            Timer *next = timer->next;
+            // a timer more than a turn away stays for a later turn
+            if (timer->due <= cur) {
+                timer->cancel();
+                expire(*timer);
+            }
+            timer = next;
+        }
+    }
+    tick = max(tick, cur);
+}
@@ -0,0 +1,114 @@
+/**
+ * @file timer_wheel.h
+ */
+
+#ifndef TIMER_WHEEL_DEF
+#define TIMER_WHEEL_DEF
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+/**
+ * @brief TimerWheel tracks many deadlines with O(1) work to arm, cancel, or
+ * expire each one.  Time is cut into ticks, and the wheel is a ring of slots,
+ * one per tick; a timer sits in the slot of the tick it is due, in an
+ * intrusive list, so it needs no allocation.  A deadline further away than
+ * one turn of the wheel waits in its slot until the wheel comes round to it
+ * again.  Deadlines are rounded up to a whole tick, which is plenty for
+ * evicting idle and slow clients.
+ */
+class TimerWheel {
+public:
+  /**
+   * @brief Timer is one deadline.  It lives inside whatever it times (such as
+   * a Connection), and leaves the wheel when it is destroyed.
+   */
+  class Timer {
+  public:
+    /** Construct a timer that is not armed */
+    Timer() {}
+
+    /** Take the timer out of its wheel */
+    ~Timer() { cancel(); }
+
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+
+    /** Take the timer out of its wheel, if it is armed */
+    void cancel();
+
+    /** Is the timer waiting in a wheel? */
+    bool armed() const { return wheel != nullptr; }
+
+    /** What the timer is for, such as a socket; the wheel never looks at it */
+    int id = -1;
+
+  private:
+    friend class TimerWheel;
+
+    /** The wheel the timer is armed in, or nullptr */
+    TimerWheel *wheel = nullptr;
+
+    /** The neighbours in the slot's list */
+    Timer *prev = nullptr;
+    Timer *next = nullptr;
+
+    /** The tick at which the timer is due */
+    uint64_t due = 0;
+  };
+
+  /**
+   * @brief Construct an empty wheel
+   *
+   * @param tick_ms The length of a tick, in milliseconds
+   */
+  TimerWheel(int tick_ms = 100);
+
+  /** Disarm every timer still in the wheel */
+  ~TimerWheel();
+
+  TimerWheel(const TimerWheel &) = delete;
+  TimerWheel &operator=(const TimerWheel &) = delete;
+
+  /**
+   * @brief Arm a timer to expire after ms milliseconds, moving it if it is
+   * already armed
+   */
+  void arm(Timer &timer, int ms);
+
+  /**
+   * @brief How long a poll may sleep before the next tick is due
+   *
+   * @return Milliseconds, or -1 if no timer is armed
+   */
+  int next_wait() const;
+
+  /**
+   * @brief Catch up with the clock: disarm every timer that is due, and pass
+   * each to expire, which may destroy it
+   */
+  void advance(const std::function<void(Timer &)> &expire);
+
+private:
+  /** The number of slots, a power of two */
+  static const uint64_t SLOTS = 512;
+
+  /** The current tick of the clock */
+  uint64_t now_tick() const;
+
+  /** Milliseconds per tick */
+  int tick_ms;
+
+  /** The last tick that has been expired */
+  uint64_t tick;
+
+  /** How many timers are armed */
+  size_t count = 0;
+
+  /** The first timer of each slot's list, or nullptr */
+  Timer *slots[SLOTS] = {};
+};
+
+#endif
@@ -0,0 +1,713 @@
+/**
+ * @file uring_loop.cc
+ */
+
+#include <cstring>
+#include <linux/io_uring.h>
+#include <memory>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "contextmanager.h"
+#include "event_loop.h"
+#include "log.h"
+#include "net.h"
+#include "uring_loop.h"
+
+using namespace std;
+
+/** Number of submission queue entries */
+const unsigned RING_ENTRIES = 4096;
+
+/** Number of provided receive buffers (a power of two), and the size of each */
+const unsigned BUF_COUNT = 512;
+const unsigned BUF_SIZE = 4096;
+
+/** The buffer group of the receive buffers */
+const unsigned short BUF_GROUP = 0;
+
+/** What a completion is for.  It is the low byte of user_data, above it is the socket. */
+enum op_t : uint8_t { OP_ACCEPT, OP_RECV, OP_SEND, OP_SHUTDOWN, OP_POLL, OP_STOP, OP_CANCEL };
+
+/**
+ * @brief Ring is a minimal io_uring, set up with the raw system calls since
+ * liburing is not a dependency: the submission and completion queues, and a
+ * ring of provided buffers for recv.
+ */
+class Ring {
+public:
+    /** Construct a ring that is not set up yet */
+    Ring() {}
+
+    /** Close the ring and release its memory */
+    ~Ring();
+
+    Ring(const Ring &) = delete;
+    Ring &operator=(const Ring &) = delete;
+
+    /**
+     * @brief Create the ring and register the receive buffers
+     *
+     * @return false if the kernel lacks io_uring or a feature we need
+     */
+    bool setup();
+
+    /**
+     * @brief Get a zeroed submission entry, submitting the queue first if it
+     * is full
+     *
+     * @param opcode The operation
+     * @param fd     The file descriptor to operate on
+     * @param op     What the completion is for
+     * @return The entry, or nullptr if the queue stayed full
+     */
+    io_uring_sqe *get_sqe(uint8_t opcode, int fd, op_t op);
+
+    /**
+     * @brief Make sure the next n entries fit in the submission queue, so that
+     * a linked chain is not split across two submissions
+     */
+    void reserve(unsigned n);
+
+    /**
+     * @brief Submit everything queued, and wait for at least one completion
+     *
+     * @param timeout_ms Stop waiting after this long, or -1 to wait forever
+     * @return false on an error other than an interruption
+     */
+    bool submit_and_wait(int timeout_ms = -1);
+
+    /**
+     * @brief Pop one completion, if one is available
+     *
+     * @param cqe Set to the completion
+     * @return false if no completion is available
+     */
+    bool pop(io_uring_cqe &cqe);
+
+    /** The memory of a provided buffer */
+    unsigned char *buffer(unsigned bid) { return bufs + (size_t)bid * BUF_SIZE; }
+
+    /** Give a provided buffer back to the kernel */
+    void recycle(unsigned bid);
+
+private:
+    /**
+     * @brief Check that the kernel takes a multishot recv, which needs Linux
+     * 6.0: older kernels set the ring up, then fail every such recv
+     */
+    bool probe_recv_multishot();
+
+    /** The ring's file descriptor */
+    int fd = -1;
+
+    /** The mapped queues, and their lengths */
+    unsigned char *rings = nullptr;
+    size_t rings_len = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqes_len = 0;
+
+    /** Submission queue fields, and the tail we have filled up to */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries = 0;
+    unsigned sq_local_tail = 0;
+
+    /** Completion queue fields */
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe *cqes;
+
+    /** The provided buffer ring, its tail, and the buffers themselves */
+    io_uring_buf_ring *buf_ring = nullptr;
+    size_t buf_ring_len = 0;
+    unsigned short buf_tail = 0;
+    unsigned char *bufs = nullptr;
+};
+
+/** Close the ring and release its memory */
+Ring::~Ring() {
+    if (fd >= 0)
+        close(fd);
+    if (rings)
+        munmap(rings, rings_len);
+    if (sqes)
+        munmap(sqes, sqes_len);
+    if (buf_ring)
+        munmap(buf_ring, buf_ring_len);
+    if (bufs)
+        munmap(bufs, (size_t)BUF_COUNT * BUF_SIZE);
+}
+
+/**
+ * @brief Create the ring and register the receive buffers
+ *
+ * @return false if the kernel lacks io_uring or a feature we need
+ */
+bool Ring::setup() {
+    io_uring_params p = {};
+    p.flags = IORING_SETUP_CLAMP;
+    fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+    if (fd < 0)
+        return false;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP) ||
+        !(p.features & IORING_FEAT_EXT_ARG))
+        return false;
+
+    /* one mapping holds both queues, another the submission entries */
+    rings_len = max(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                    p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+    void *r = mmap(nullptr, rings_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                   IORING_OFF_SQ_RING);
+    if (r == MAP_FAILED)
+        return false;
+    rings = (unsigned char *)r;
+    sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+    void *s = mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (s == MAP_FAILED)
+        return false;
+    sqes = (io_uring_sqe *)s;
+    sq_head = (unsigned *)(rings + p.sq_off.head);
+    sq_tail = (unsigned *)(rings + p.sq_off.tail);
+    sq_mask = (unsigned *)(rings + p.sq_off.ring_mask);
+    sq_array = (unsigned *)(rings + p.sq_off.array);
+    sq_entries = p.sq_entries;
+    sq_local_tail = *sq_tail;
+    cq_head = (unsigned *)(rings + p.cq_off.head);
+    cq_tail = (unsigned *)(rings + p.cq_off.tail);
+    cq_mask = (unsigned *)(rings + p.cq_off.ring_mask);
+    cqes = (io_uring_cqe *)(rings + p.cq_off.cqes);
+
+    /* the kernel picks a buffer from this ring for each recv */
+    buf_ring_len = BUF_COUNT * sizeof(io_uring_buf);
+    void *b = mmap(nullptr, buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b == MAP_FAILED)
+        return false;
+    buf_ring = (io_uring_buf_ring *)b;
+    void *mem = mmap(nullptr, (size_t)BUF_COUNT * BUF_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+    if (mem == MAP_FAILED)
+        return false;
+    bufs = (unsigned char *)mem;
+    io_uring_buf_reg reg = {};
+    reg.ring_addr = (uint64_t)buf_ring;
+    reg.ring_entries = BUF_COUNT;
+    reg.bgid = BUF_GROUP;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return false;
+    for (unsigned bid = 0; bid < BUF_COUNT; bid++)
+        recycle(bid);
+    return probe_recv_multishot();
+}
+
+/**
+ * @brief Check that the kernel takes a multishot recv, which needs Linux 6.0:
+ * older kernels set the ring up, then fail every such recv with EINVAL.  One
+ * byte is received over a socketpair, and a shutdown then ends the recv, so
+ * nothing is left in flight.
+ *
+ * @return false if the recv failed, or did not stay armed
+ */
+bool Ring::probe_recv_multishot() {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+        return false;
+    ContextManager closer([&]() {
+        close(sv[0]);
+        close(sv[1]);
+    });
+    io_uring_sqe *sqe = get_sqe(IORING_OP_RECV, sv[0], OP_RECV);
+    if (sqe == nullptr)
+        return false;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    if (write(sv[1], "", 1) != 1)
+        return false;
+
+    /* the byte should arrive with the recv still armed, then the shutdown ends it */
+    bool armed = false, ended = false;
+    for (int waits = 0; !ended && waits < 10; waits++) {
+        if (!submit_and_wait(100))
+            return false;
+        io_uring_cqe cqe;
+        while (pop(cqe)) {
+            if (cqe.flags & IORING_CQE_F_BUFFER)
+                recycle(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            if (cqe.res == 1 && (cqe.flags & IORING_CQE_F_MORE)) {
+                armed = true;
+                shutdown(sv[0], SHUT_RDWR);
+            }
+            if (!(cqe.flags & IORING_CQE_F_MORE))
+                ended = true;
+        }
+    }
+    return armed && ended;
+}
+
+/**
+ * @brief Get a zeroed submission entry, submitting the queue first if it is
+ * full
+ *
+ * @param opcode The operation
+ * @param sd     The file descriptor to operate on
+ * @param op     What the completion is for
+ * @return The entry, or nullptr if the queue stayed full
+ */
+io_uring_sqe *Ring::get_sqe(uint8_t opcode, int sd, op_t op) {
+    reserve(1);
+    if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+        return nullptr;
+    unsigned idx = sq_local_tail & *sq_mask;
+    io_uring_sqe *sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = sd;
+    sqe->user_data = ((uint64_t)(uint32_t)sd << 8) | op;
+    sq_array[idx] = idx;
+    sq_local_tail++;
+    return sqe;
+}
+
+/**
+ * @brief Make sure the next n entries fit in the submission queue, so that a
+ * linked chain is not split across two submissions
+ */
+void Ring::reserve(unsigned n) {
+    if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) + n > sq_entries) {
+        __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+        syscall(__NR_io_uring_enter, fd, sq_local_tail - *sq_head, 0, 0, nullptr, 0);
+    }
+}
+
+/**
+ * @brief Submit everything queued, and wait for at least one completion
+ *
+ * @param timeout_ms Stop waiting after this long, or -1 to wait forever
+ * @return false on an error other than an interruption
+ */
+bool Ring::submit_and_wait(int timeout_ms) {
+    __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    __kernel_timespec ts = {timeout_ms / 1000, (long long)(timeout_ms % 1000) * 1000000};
+    io_uring_getevents_arg arg = {};
+    arg.ts = (uint64_t)&ts;
+    long rc = timeout_ms < 0 ? syscall(__NR_io_uring_enter, fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0)
+                             : syscall(__NR_io_uring_enter, fd, to_submit, 1,
+                                       IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (rc < 0) {
+        // EBUSY means completions must be reaped before more can be submitted,
+        // ETIME that the wait timed out
+        if (errno == EINTR || errno == EBUSY || errno == EAGAIN || errno == ETIME)
+            return true;
+        sys_error(errno, "Error in io_uring_enter():");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Pop one completion, if one is available
+ *
+ * @param cqe Set to the completion
+ * @return false if no completion is available
+ */
+bool Ring::pop(io_uring_cqe &cqe) {
+    unsigned head = *cq_head;
+    if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+        return false;
+    cqe = cqes[head & *cq_mask];
+    __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/** Give a provided buffer back to the kernel */
+void Ring::recycle(unsigned bid) {
+    // the ring is an array of io_uring_buf whose first entry overlays the
+    // tail; index it directly, since C++ places the header's flexible bufs
+    // array past an empty struct
+    io_uring_buf *buf = (io_uring_buf *)buf_ring + (buf_tail & (BUF_COUNT - 1));
+    buf->addr = (uint64_t)buffer(bid);
+    buf->len = BUF_SIZE;
+    buf->bid = bid;
+    buf_tail++;
+    __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Client is everything the io_uring loop tracks about one connection,
+ * besides the Connection itself
+ */
+struct Client {
+    /** The request parser and response queue */
+    unique_ptr<Connection> conn;
+
+    /** Received bytes that the connection could not take yet */
+    vec inbox;
+
+    /** The bytes of the send in flight, which must stay put until it completes */
+    vec sending;
+
+    /** Operations whose completions have not arrived yet */
+    int inflight = 0;
+
+    /** Is the multishot recv still armed, being cancelled, a send in flight, a POLLOUT poll in flight? */
+    bool recv_armed = false;
+    bool cancel_inflight = false;
+    bool send_inflight = false;
+    bool poll_inflight = false;
+
+    /** Is the connection being closed, and has its shutdown been submitted? */
+    bool closing = false;
+    bool shut = false;
+};
+
+/**
+ * @brief Serve every client from one thread with io_uring, as an alternative
+ * to event_loop().  One multishot accept takes every new client, one multishot
+ * recv per client fills buffers from a provided buffer ring, and responses go
+ * out as sends; a one-shot connection links its send to a shutdown, so that
+ * the whole response-and-close costs a single submission.  Most requests are
+ * served without any syscall of their own: the loop submits everything it
+ * queued and waits for completions in one io_uring_enter().  The wait ends at
+ * the next tick of a TimerWheel, which closes clients that made no progress
+ * for too long.  A client that pipelines requests faster than it reads the
+ * responses has its recv cancelled once a megabyte of them waits in its inbox,
+ * and armed again once they are served, as event_loop() stops reading.
+ *
+ * If the kernel does not support io_uring (or the features above, multishot
+ * recv among them), this prints a message and falls back to event_loop().
+ *
+ * @param sd       The listening socket
+ * @param handler  As for event_loop()
+ * @param stop_fd  The loop also halts once this descriptor is readable, or -1
+ * @param timeouts As for event_loop()
+ */
+void uring_loop(int sd, function<bool(Connection &)> handler, int stop_fd, timeouts_t timeouts) {
+    /* the ring goes first, so it is torn down after every client */
+    Ring ring;
+    if (!ring.setup()) {
+        LOG_WARN << "io_uring is not available, falling back to epoll";
+        event_loop(sd, handler, stop_fd, timeouts);
+        return;
+    }
+    /* the wheel goes before the clients, so it outlives their timers */
+    TimerWheel wheel;
+    unordered_map<int, Client> clients;
+    bool halt = false;
+
+    /* start the clock again on a client that made progress; a send in flight counts as writing */
+    auto rearm = [&](Client &c) {
+        int ms = c.send_inflight || c.poll_inflight ? timeouts.io_ms : c.conn->timeout(timeouts);
+        if (ms > 0 && !c.closing)
+            wheel.arm(c.conn->timer, ms);
+        else
+            c.conn->timer.cancel();
+    };
+
+    auto arm_accept = [&]() {
+        io_uring_sqe *sqe = ring.get_sqe(IORING_OP_ACCEPT, sd, OP_ACCEPT);
+        if (sqe == nullptr)
+            return false;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK;
+        return true;
+    };
+
+    auto arm_recv = [&](int fd, Client &c) {
+        io_uring_sqe *sqe = ring.get_sqe(IORING_OP_RECV, fd, OP_RECV);
+        if (sqe == nullptr)
+            return;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUF_GROUP;
+        c.recv_armed = true;
+        c.inflight++;
+    };
+
+    /* a client that sends faster than it reads its responses is not read while its inbox is full */
+    auto inbox_full = [](Client &c) { return c.inbox.size() >= Connection::MAX_QUEUED; };
+
+    /* cancel the recv of a client whose inbox is full; if the queue is full too, the next recv tries again */
+    auto pause_recv = [&](int fd, Client &c) {
+        if (!c.recv_armed || c.cancel_inflight)
+            return;
+        io_uring_sqe *sqe = ring.get_sqe(IORING_OP_ASYNC_CANCEL, fd, OP_CANCEL);
+        if (sqe == nullptr)
+            return;
+        sqe->addr = ((uint64_t)(uint32_t)fd << 8) | OP_RECV;
+        c.cancel_inflight = true;
+        c.inflight++;
+    };
+
+    /* read again, once the inbox has room and no cancel is on its way */
+    auto resume_recv = [&](int fd, Client &c) {
+        if (!c.recv_armed && !c.cancel_inflight && !c.closing && !inbox_full(c))
+            arm_recv(fd, c);
+    };
+
+    /* closing clients whose shutdown found the submission queue full */
+    vector<int> unshut;
+
+    auto submit_shutdown = [&](int fd, Client &c) {
+        io_uring_sqe *sqe = ring.get_sqe(IORING_OP_SHUTDOWN, fd, OP_SHUTDOWN);
+        if (sqe == nullptr)
+            return false;
+        sqe->len = SHUT_RDWR;
+        c.shut = true;
+        c.inflight++;
+        return true;
+    };
+
+    /* a shutdown ends the recv, so every completion for fd arrives before we close it */
+    auto begin_close = [&](int fd, Client &c) {
+        c.closing = true;
+        if (c.recv_armed && !c.shut && !submit_shutdown(fd, c))
+            unshut.push_back(fd);
+    };
+
+    /* try the shutdowns that did not fit again, each once its client has no send in flight to cut short */
+    auto retry_shutdowns = [&]() {
+        vector<int> later;
+        for (int fd : unshut) {
+            auto it = clients.find(fd);
+            if (it == clients.end())
+                continue;
+            Client &c = it->second;
+            if (!c.closing || !c.recv_armed || c.shut)
+                continue;
+            if (c.send_inflight || c.poll_inflight || !submit_shutdown(fd, c))
+                later.push_back(fd);
+        }
+        unshut.swap(later);
+    };
+
+    /* hand the connection whatever it can take of the inbox and the new bytes */
+    auto pump = [&](Client &c, const unsigned char *data, size_t len) {
+        bool from_inbox = !c.inbox.empty();
+        if (from_inbox) {
+            c.inbox.insert(c.inbox.end(), data, data + len);
+            data = c.inbox.data();
+            len = c.inbox.size();
+        }
+        size_t used = 0;
+        while (!halt && c.conn->reading() && (used < len || c.conn->state == Connection::READ_BODY)) {
+            ssize_t n = c.conn->feed(data + used, len - used);
+            if (n < 0)
+                return false;
+            used += n;
+            if (c.conn->state == Connection::READY)
+                halt = handler(*c.conn);
+            else if (n == 0)
+                break;
+        }
+        if (from_inbox)
+            c.inbox.erase(c.inbox.begin(), c.inbox.begin() + used);
+        else
+            c.inbox.insert(c.inbox.end(), data + used, data + len);
+        return true;
+    };
+
+    /* start sending whatever the connection has queued */
+    auto flush = [&](int fd, Client &c) {
+        if (c.send_inflight || c.poll_inflight || c.closing)
+            return;
+        c.conn->take_queued(c.sending);
+        if (!c.sending.empty()) {
+            ring.reserve(2);
+            io_uring_sqe *sqe = ring.get_sqe(IORING_OP_SEND, fd, OP_SEND);
+            if (sqe == nullptr) {
+                begin_close(fd, c);
+                return;
+            }
+            sqe->addr = (uint64_t)c.sending.data();
+            sqe->len = c.sending.size();
+            sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+            c.send_inflight = true;
+            c.inflight++;
+
+            /* the last response of a one-shot connection takes the close with it */
+            bool last = c.conn->state == Connection::WRITE && !c.conn->persistent && !c.conn->file_pending();
+            if (last) {
+                sqe->flags |= IOSQE_IO_LINK;
+                begin_close(fd, c);
+                /* no room for the shutdown, so link nothing; it is retried once the send is done */
+                if (!c.shut)
+                    sqe->flags &= ~IOSQE_IO_LINK;
+            }
+        } else if (c.conn->file_pending()) {
+            /* a file goes out with sendfile() once the socket has room */
+            io_uring_sqe *sqe = ring.get_sqe(IORING_OP_POLL_ADD, fd, OP_POLL);
+            if (sqe == nullptr) {
+                begin_close(fd, c);
+                return;
+            }
+            sqe->poll32_events = POLLOUT;
+            c.poll_inflight = true;
+            c.inflight++;
+        } else {
+            c.conn->drained();
+            if (c.conn->state == Connection::DONE)
+                begin_close(fd, c);
+        }
+    };
+
+    if (!arm_accept()) {
+        error_message_and_exit(0, EBUSY, "Error arming accept: ");
+    }
+    if (stop_fd >= 0) {
+        io_uring_sqe *sqe = ring.get_sqe(IORING_OP_POLL_ADD, stop_fd, OP_STOP);
+        if (sqe != nullptr)
+            sqe->poll32_events = POLLIN;
+    }
+
+    while (!halt) {
+        retry_shutdowns();
+        if (!ring.submit_and_wait(wheel.next_wait()))
+            break;
+        io_uring_cqe cqe;
+        while (!halt && ring.pop(cqe)) {
+            op_t op = (op_t)(cqe.user_data & 0xff);
+            int fd = (int)(cqe.user_data >> 8);
+            bool more = cqe.flags & IORING_CQE_F_MORE;
+
+            if (op == OP_STOP) {
+                halt = true;
+                break;
+            }
+            if (op == OP_ACCEPT) {
+                if (cqe.res >= 0) {
+                    Client &c = clients[cqe.res];
+                    c.conn = make_unique<Connection>(cqe.res);
+                    arm_recv(cqe.res, c);
+                    rearm(c);
+                } else if (cqe.res != -EAGAIN && cqe.res != -EINTR) {
+                    sys_error(-cqe.res, "Error accepting request from client: ");
+                }
+                if (!more)
+                    arm_accept();
+                continue;
+            }
+
+            auto it = clients.find(fd);
+            if (it == clients.end())
+                continue;
+            Client &c = it->second;
+            switch (op) {
+            case OP_RECV:
+                if (!more) {
+                    c.recv_armed = false;
+                    c.inflight--;
+                }
+                if (cqe.res > 0) {
+                    unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                    bool ok = c.closing || pump(c, ring.buffer(bid), cqe.res);
+                    ring.recycle(bid);
+                    if (!ok)
+                        begin_close(fd, c);
+                    else
+                        flush(fd, c);
+                    if (inbox_full(c))
+                        pause_recv(fd, c);
+                    else
+                        resume_recv(fd, c);
+                } else if (cqe.res == -ENOBUFS) {
+                    // every buffer was in use for a moment, they are back by now
+                    resume_recv(fd, c);
+                } else if (cqe.res == -ECANCELED && !c.closing) {
+                    /* paused by pause_recv(), until the inbox drains */
+                    resume_recv(fd, c);
+                } else if (cqe.res == 0 && !c.closing && c.conn->on_eof()) {
+                    /* a clean close between requests: finish sending, then close */
+                    if (!c.send_inflight && !c.poll_inflight)
+                        flush(fd, c);
+                    if (!c.send_inflight && !c.poll_inflight)
+                        begin_close(fd, c);
+                } else {
+                    begin_close(fd, c);
+                }
+                break;
+            case OP_SEND:
+                c.send_inflight = false;
+                c.inflight--;
+                if (cqe.res < (int)c.sending.size()) {
+                    if (cqe.res < 0 && cqe.res != -ECONNRESET && cqe.res != -EPIPE)
+                        sys_error(-cqe.res, "Error in send():");
+                    begin_close(fd, c);
+                    break;
+                }
+                c.sending.clear();
+                c.conn->drained();
+                if (c.closing)
+                    break;
+                if (c.conn->state == Connection::DONE && !c.conn->pending()) {
+                    begin_close(fd, c);
+                    break;
+                }
+                /* the connection may take requests again, some may be waiting in the inbox */
+                if (!pump(c, nullptr, 0)) {
+                    begin_close(fd, c);
+                } else {
+                    flush(fd, c);
+                    resume_recv(fd, c);
+                }
+                break;
+            case OP_POLL:
+                c.poll_inflight = false;
+                c.inflight--;
+                if (c.closing)
+                    break;
+                if (!c.conn->on_writable()) {
+                    begin_close(fd, c);
+                } else if (c.conn->pending()) {
+                    flush(fd, c);
+                } else if (c.conn->state == Connection::DONE) {
+                    begin_close(fd, c);
+                } else if (!pump(c, nullptr, 0)) {
+                    begin_close(fd, c);
+                } else {
+                    flush(fd, c);
+                    resume_recv(fd, c);
+                }
+                break;
+            case OP_CANCEL:
+                c.cancel_inflight = false;
+                c.inflight--;
+                resume_recv(fd, c);
+                break;
+            case OP_SHUTDOWN:
+                c.inflight--;
+                c.shut = false;
+                // the shutdown was linked to a send that failed, so try again
+                if (cqe.res == -ECANCELED)
+                    begin_close(fd, c);
+                else
+                    c.shut = true;
+                break;
+            default:
+                break;
+            }
+
+            /* close once nothing is in flight, so no completion can name a reused socket */
+            if (c.closing && c.inflight == 0)
+                clients.erase(it);
+            else
+                rearm(c);
+        }
+
+        /* evict every client whose deadline passed; the shutdown ends whatever it has in flight */
+        wheel.advance([&](TimerWheel::Timer &timer) {
+            auto it = clients.find(timer.id);
+            if (it == clients.end())
+                return;
+            shutdown(timer.id, SHUT_RDWR);
+            begin_close(timer.id, it->second);
+            if (it->second.inflight == 0)
+                clients.erase(it);
+        });
+    }
+    clients.clear();
+}
@@ -0,0 +1,35 @@
+/**
+ * @file uring_loop.h
+ */
+
+#ifndef URING_LOOP_DEF
+#define URING_LOOP_DEF
+
+#pragma once
+
+#include <functional>
+
+#include "connection.h"
+
+/**
+ * @brief Serve every client from one thread with io_uring, as an alternative
+ * to event_loop().  One multishot accept takes every new client, one multishot
+ * recv per client fills buffers from a provided buffer ring, and responses go
+ * out as sends; a one-shot connection links its send to a shutdown, so that
+ * the whole response-and-close costs a single submission.  Most requests are
+ * served without any syscall of their own: the loop submits everything it
+ * queued and waits for completions in one io_uring_enter().  The wait ends at
+ * the next tick of a TimerWheel, which closes clients that made no progress
+ * for too long.
+ *
+ * If the kernel does not support io_uring (or the features above), this
+ * prints a message and falls back to event_loop().
+ *
+ * @param sd       The listening socket
+ * @param handler  As for event_loop()
+ * @param stop_fd  The loop also halts once this descriptor is readable, or -1
+ * @param timeouts As for event_loop()
+ */
+void uring_loop(int sd, std::function<bool(Connection &)> handler, int stop_fd = -1, timeouts_t timeouts = {});
+
+#endif